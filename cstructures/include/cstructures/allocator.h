@@ -0,0 +1,45 @@
+#pragma once
+
+#include "cstructures/config.h"
+#include <stdint.h>
+
+C_BEGIN
+
+/*!
+ * @brief A set of allocation callbacks. Containers initialized with an
+ * allocator (see hashmap_init_with_allocator(), vector_init_with_allocator()
+ * and btree_init_with_allocator()) route all of their internal allocations
+ * through it. The container only stores the pointer, so the allocator must
+ * outlive it.
+ *
+ * The callbacks follow the semantics of malloc(), realloc() and free(), except
+ * that free is never called with NULL. The user pointer is passed to every
+ * callback.
+ */
+struct cs_allocator
+{
+    void* (*alloc)(void* user, uintptr_t size);
+    void* (*realloc)(void* user, void* ptr, uintptr_t new_size);
+    void  (*free)(void* user, void* ptr);
+    void* user;
+};
+
+/*! Calls malloc(), realloc() and free() directly, without any tracking. */
+CSTRUCTURES_PUBLIC_API extern const struct cs_allocator memory_system_allocator;
+
+#if defined(CSTRUCTURES_MEMORY_DEBUGGING)
+/*!
+ * Tracks every allocation for the leak report printed by memory_deinit().
+ * See cstructures_malloc().
+ */
+CSTRUCTURES_PUBLIC_API extern const struct cs_allocator memory_debug_allocator;
+#endif
+
+/*!
+ * The allocator containers use when none is specified. This is
+ * memory_debug_allocator if CSTRUCTURES_MEMORY_DEBUGGING is enabled,
+ * otherwise memory_system_allocator.
+ */
+CSTRUCTURES_PUBLIC_API extern const struct cs_allocator memory_default_allocator;
+
+C_END
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "cstructures/config.h"
+#include "cstructures/allocator.h"
+#include <stdint.h>
+
+/*
+ * A linear (bump) allocator. Memory is handed out from large chunks by
+ * advancing a pointer, and individual allocations are never freed. Instead,
+ * everything allocated after a mark is released at once by arena_rewind(),
+ * and arena_reset() releases everything in O(1). Released chunks are kept
+ * and reused, so an arena that is reset after every request stops calling
+ * malloc() once it has grown to the largest request.
+ *
+ * Containers can be put on an arena by passing &arena->allocator to their
+ * *_init_with_allocator() function. Such containers don't need to be
+ * deinitialized: resetting or rewinding the arena releases their memory. They
+ * must not be used afterwards.
+ */
+
+#define ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+#define ARENA_DEFAULT_ALIGNMENT  16
+
+C_BEGIN
+
+struct cs_arena_chunk;
+
+struct cs_arena
+{
+    /*!
+     * Allocates from this arena. Unlike arena_alloc(), allocations through
+     * this interface remember their size, so the most recent one can be
+     * grown or freed in place, and the rest are copied when grown.
+     * @note The callbacks refer to the arena by address, so the arena must
+     * not be moved after arena_init().
+     */
+    struct cs_allocator allocator;
+
+    struct cs_arena_chunk* chunks;       /* Chunks in use, most recent first */
+    struct cs_arena_chunk* first;        /* Oldest chunk in use, for arena_reset() */
+    struct cs_arena_chunk* free_chunks;  /* Released chunks, kept for reuse */
+    uint8_t*  ptr;                       /* Next free byte in the current chunk */
+    uint8_t*  end;                       /* End of the current chunk */
+    uintptr_t chunk_size;
+    uintptr_t alignment;
+};
+
+/*!
+ * @brief Position in an arena. See arena_mark().
+ */
+struct cs_arena_mark
+{
+    struct cs_arena_chunk* chunk;
+    uint8_t* ptr;
+};
+
+/*!
+ * @brief Allocates and initializes a new arena. See arena_init().
+ * @return Returns the new arena, or NULL if allocation failed.
+ */
+CSTRUCTURES_PUBLIC_API struct cs_arena*
+arena_create(uintptr_t chunk_size, uintptr_t alignment);
+
+/*!
+ * @brief Initializes an arena. No memory is allocated until the first
+ * allocation.
+ * @param[in] chunk_size Size of the chunks requested from MALLOC(), or 0 for
+ * ARENA_DEFAULT_CHUNK_SIZE. Allocations larger than this get a chunk of their
+ * own.
+ * @param[in] alignment Alignment of arena_alloc(), or 0 for
+ * ARENA_DEFAULT_ALIGNMENT. Must be a power of two. It is raised to at least
+ * sizeof(uintptr_t).
+ */
+CSTRUCTURES_PUBLIC_API void
+arena_init(struct cs_arena* arena, uintptr_t chunk_size, uintptr_t alignment);
+
+/*!
+ * @brief Frees all chunks, including the released ones.
+ */
+CSTRUCTURES_PUBLIC_API void
+arena_deinit(struct cs_arena* arena);
+
+CSTRUCTURES_PUBLIC_API void
+arena_free(struct cs_arena* arena);
+
+/*!
+ * @brief Allocates memory aligned to the arena's alignment.
+ * @return Returns NULL if a new chunk had to be allocated and that failed.
+ */
+CSTRUCTURES_PUBLIC_API void*
+arena_alloc(struct cs_arena* arena, uintptr_t size);
+
+/*!
+ * @brief Allocates memory with the specified alignment, which must be a
+ * power of two.
+ */
+CSTRUCTURES_PUBLIC_API void*
+arena_alloc_aligned(struct cs_arena* arena, uintptr_t size, uintptr_t alignment);
+
+/*!
+ * @brief Returns the current position of the arena. Passing it to
+ * arena_rewind() releases everything allocated since.
+ */
+CSTRUCTURES_PUBLIC_API struct cs_arena_mark
+arena_mark(const struct cs_arena* arena);
+
+/*!
+ * @brief Releases everything allocated since the mark was taken. Chunks that
+ * are no longer used are kept for reuse.
+ * @note The mark must have been taken after the last arena_reset() and
+ * before any mark that was already rewound to.
+ */
+CSTRUCTURES_PUBLIC_API void
+arena_rewind(struct cs_arena* arena, struct cs_arena_mark mark);
+
+/*!
+ * @brief Releases everything allocated from the arena in O(1). All chunks
+ * are kept for reuse.
+ */
+CSTRUCTURES_PUBLIC_API void
+arena_reset(struct cs_arena* arena);
+
+C_END
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "cstructures/config.h"
+#include "cstructures/allocator.h"
 #include "cstructures/hash.h"
 
 C_BEGIN
@@ -78,6 +79,7 @@ struct cs_btree
     cs_btree_size count;
     cs_btree_size capacity;
     uint32_t value_size;
+    const struct cs_allocator* allocator;
 };
 
 /*!
@@ -107,6 +109,17 @@ btree_create(struct cs_btree** btree, uint32_t value_size);
 CSTRUCTURES_PUBLIC_API void
 btree_init(struct cs_btree* btree, uint32_t value_size);
 
+/*!
+ * @brief Initialises an existing btree object. The keys and values are
+ * allocated through the specified allocator instead of
+ * memory_default_allocator.
+ * @param[in] allocator Must outlive the btree.
+ */
+CSTRUCTURES_PUBLIC_API void
+btree_init_with_allocator(struct cs_btree* btree,
+                          uint32_t value_size,
+                          const struct cs_allocator* allocator);
+
 CSTRUCTURES_PUBLIC_API void
 btree_deinit(struct cs_btree* btree);
 
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "cstructures/config.h"
+#include "cstructures/hash.h"
+#include "cstructures/hashmap.h"
+
+/*
+ * A hashmap that may be used from many threads at once. The table uses the
+ * same storage format and probing as cs_hashmap (control tags matched a
+ * group at a time), and keys and values are copied in and out exactly like
+ * hashmap_insert() and hashmap_find() do.
+ *
+ * - Lookups never take a lock. Tags only ever change from empty to claimed
+ *   to full to deleted, and a slot is never reused for a different key until
+ *   the table is rebuilt, so a reader that sees a full tag can copy the key
+ *   and value without them changing under it.
+ * - Inserts and erases lock one of CHM_STRIPES stripes, selected by the
+ *   key's hash, which serializes writers of the same key only. Free slots
+ *   are claimed with a compare-and-swap on their tag.
+ * - When the table fills up (erased slots count as used), a new table is
+ *   allocated and every writer that runs into it helps migrate the old table
+ *   a chunk of groups at a time. Readers keep using the old table until the
+ *   migration is complete. Old tables are freed once no reader can still be
+ *   looking at them.
+ *
+ * The structure is opaque because it uses C11 atomics.
+ */
+#define CHM_STRIPES 64
+
+C_BEGIN
+
+struct cs_chashmap;
+
+/*!
+ * @brief Allocates and initializes a new concurrent hashmap. See
+ * hashmap_create() for details on the parameters.
+ * @return If successful, returns HM_OK. If allocation fails, HM_OOM is returned.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+chashmap_create(struct cs_chashmap** hm,
+                uint32_t key_size,
+                uint32_t value_size);
+
+/*!
+ * @brief Allocates and initializes a new concurrent hashmap with a custom
+ * initial size and hash function. See hashmap_init_with_options().
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+chashmap_create_with_options(struct cs_chashmap** hm,
+                             uint32_t key_size,
+                             uint32_t value_size,
+                             uint32_t table_count,
+                             hash32_func hash_func);
+
+/*!
+ * @brief Cleans up all resources and frees the hashmap.
+ * @note No other thread may be using the hashmap.
+ */
+CSTRUCTURES_PRIVATE_API void
+chashmap_free(struct cs_chashmap* hm);
+
+/*!
+ * @brief Inserts a key and a copy of the value.
+ * @return Returns HM_OK if the key was inserted, HM_EXISTS if the key already
+ * exists (the value is not changed), or HM_OOM if the table needed to grow and
+ * allocation failed.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+chashmap_insert(struct cs_chashmap* hm, const void* key, const void* value);
+
+/*!
+ * @brief Looks up a key without taking any locks.
+ * @param[out] value If the key exists, value_size bytes are copied to this
+ * location. May be NULL to only test whether the key exists.
+ * @return Returns 1 if the key was found, 0 if not.
+ */
+CSTRUCTURES_PRIVATE_API int
+chashmap_find(struct cs_chashmap* hm, const void* key, void* value);
+
+/*!
+ * @brief Erases a key.
+ * @param[out] value If the key exists, its value is copied to this location
+ * before it is erased. May be NULL.
+ * @return Returns 1 if the key was erased, 0 if it didn't exist.
+ */
+CSTRUCTURES_PRIVATE_API int
+chashmap_erase(struct cs_chashmap* hm, const void* key, void* value);
+
+/*!
+ * @brief Returns the number of entries. If other threads are inserting or
+ * erasing, this is only a snapshot.
+ */
+CSTRUCTURES_PRIVATE_API uint32_t
+chashmap_count(const struct cs_chashmap* hm);
+
+C_END
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "cstructures/config.h"
+#include <stdint.h>
+
+/*
+ * Runtime CPU feature detection. cstructures_init() detects the features
+ * once with cpu_init(), then lets every module that has accelerated kernels
+ * pick its implementation (see hash_init()). Kernels must produce identical
+ * results on every path, so the choice only ever affects speed.
+ *
+ * Without CSTRUCTURES_CPU_DISPATCH, or on unsupported targets, no features
+ * are reported and the portable kernels are used.
+ */
+
+C_BEGIN
+
+enum cs_cpu_feature
+{
+    CPU_SSE2   = 0x01,
+    CPU_SSE42  = 0x02,  /* Includes the crc32 instruction */
+    CPU_AVX2   = 0x04   /* Only reported if the OS saves the YMM registers */
+};
+
+/*!
+ * @brief Detects the features of the CPU. Called by cstructures_init().
+ */
+CSTRUCTURES_PRIVATE_API void
+cpu_init(void);
+
+/*!
+ * @return Returns the bitwise combination of cs_cpu_feature supported by the
+ * CPU, minus the disabled ones. Returns 0 before cpu_init().
+ */
+CSTRUCTURES_PRIVATE_API uint32_t
+cpu_features(void);
+
+/*!
+ * @brief Hides features from cpu_features(), for testing and benchmarking
+ * the portable kernels. Kernels are only picked again by cstructures_init()
+ * or the module's init function.
+ * @param[in] features Bitwise combination of cs_cpu_feature, or 0 to enable
+ * all detected features again.
+ */
+CSTRUCTURES_PRIVATE_API void
+cpu_disable_features(uint32_t features);
+
+C_END
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "cstructures/config.h"
+#include "cstructures/hash.h"
+#include "cstructures/hashmap.h"
+
+/*
+ * An insertion-ordered hashmap, laid out like CPython's compact dict. Keys
+ * and values are appended to a dense entry array in insertion order, and a
+ * sparse index of int32 entry numbers is probed to find them. Iteration
+ * walks the entry array front to back, so it only touches entries, is
+ * sequential in memory and visits keys in the order they were inserted.
+ *
+ * Erasing a key marks its entry as erased. Once erased entries outnumber
+ * live ones, the next insert or erase compacts the entry array (keeping the
+ * order) and resizes the index to fit the live entries, so a map that was
+ * once large doesn't stay large.
+ *
+ * Each entry is laid out as [hash | erased flag | key | value], padded to a
+ * multiple of 8 bytes.
+ */
+#define DICT_INDEX_EMPTY   (-1)
+#define DICT_INDEX_DELETED (-2)
+
+/*
+ * The index is probed linearly, one slot at a time, so it is kept sparser
+ * than cs_hashmap (HM_REHASH_AT_PERCENT is tuned for 16-wide groups). At 70%
+ * a miss probes about 6 slots on average, at 88% about 35.
+ */
+#define DICT_MAX_LOAD_PERCENT 70
+
+C_BEGIN
+
+struct cs_dict
+{
+    uint32_t     table_count;     /* Slots in the index, a power of two */
+    uint32_t     key_size;
+    uint32_t     value_size;
+    uint32_t     entry_size;
+    uint32_t     entry_count;     /* Entries appended, including erased ones */
+    uint32_t     entry_capacity;
+    uint32_t     erased;          /* Erased entries not yet compacted away */
+    uint32_t     index_deleted;   /* DICT_INDEX_DELETED slots in the index */
+    hash32_func  hash;
+    int32_t*     index;
+    void*        entries;
+};
+
+/*!
+ * @brief Allocates and initializes a new dict. See hashmap_create() for
+ * details on the parameters.
+ * @return If successful, returns HM_OK. If allocation fails, HM_OOM is returned.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+dict_create(struct cs_dict** d,
+            uint32_t key_size,
+            uint32_t value_size);
+
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+dict_create_with_options(struct cs_dict** d,
+                         uint32_t key_size,
+                         uint32_t value_size,
+                         uint32_t element_count,
+                         hash32_func hash_func);
+
+/*!
+ * @brief Initializes a new dict. See hashmap_create() for details on
+ * parameters and return values.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+dict_init(struct cs_dict* d,
+          uint32_t key_size,
+          uint32_t value_size);
+
+/*!
+ * @brief Initializes a new dict with a custom hash function.
+ * @param[in] element_count Number of elements to make room for.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+dict_init_with_options(struct cs_dict* d,
+                       uint32_t key_size,
+                       uint32_t value_size,
+                       uint32_t element_count,
+                       hash32_func hash_func);
+
+/*!
+ * @brief Cleans up internal resources without freeing the dict object itself.
+ */
+CSTRUCTURES_PRIVATE_API void
+dict_deinit(struct cs_dict* d);
+
+/*!
+ * @brief Cleans up all resources and frees the dict.
+ */
+CSTRUCTURES_PRIVATE_API void
+dict_free(struct cs_dict* d);
+
+/*!
+ * @brief Makes room for the specified number of elements, so inserting them
+ * doesn't resize.
+ * @return Returns HM_OK on success, or HM_OOM if allocation fails.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+dict_reserve(struct cs_dict* d, uint32_t element_count);
+
+/*!
+ * @brief Appends a key and a copy of the value.
+ * @return Returns HM_OK if the key was inserted, HM_EXISTS if the key already
+ * exists (the value and the key's position are not changed), or HM_OOM if
+ * allocation failed.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+dict_insert(struct cs_dict* d, const void* key, const void* value);
+
+/*!
+ * @brief Erases a key.
+ * @return Returns a pointer to the erased value, which stays valid until the
+ * next insert or erase, or NULL if the key doesn't exist.
+ */
+CSTRUCTURES_PRIVATE_API void*
+dict_erase(struct cs_dict* d, const void* key);
+
+/*!
+ * @brief Returns a pointer to the value of a key, or NULL if the key doesn't
+ * exist. The pointer is valid until the next insert or erase.
+ */
+CSTRUCTURES_PRIVATE_API void*
+dict_find(const struct cs_dict* d, const void* key);
+
+#define dict_count(d) ((d)->entry_count - (d)->erased)
+
+#define DICT_ENTRY(d, n) ((uint8_t*)(d)->entries + (uintptr_t)(d)->entry_size * (uintptr_t)(n))
+
+/*!
+ * @brief Iterates over the live entries in insertion order. The key and
+ * value pointers are aligned to 8 bytes.
+ * @note The dict must not be modified during iteration.
+ */
+#define DICT_FOR_EACH(d, key_t, value_t, key, value) { \
+    key_t* key; \
+    value_t* value; \
+    uint32_t n_##value; \
+    for (n_##value = 0; \
+        n_##value != (d)->entry_count && \
+            ((key = (key_t*)(DICT_ENTRY(d, n_##value) + 8)) || 1) && \
+            ((value = (value_t*)(DICT_ENTRY(d, n_##value) + 8 + (((d)->key_size + 7) & ~7u))) || 1); \
+        ++n_##value) \
+    { \
+        if (((uint32_t*)DICT_ENTRY(d, n_##value))[1]) \
+            continue; \
+
+#define DICT_END_EACH }}
+
+C_END
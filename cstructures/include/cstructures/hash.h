@@ -3,20 +3,197 @@
 #include "cstructures/config.h"
 #include <stdint.h>
 
+#if defined(__cplusplus) || (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+#   define CS_HASH_INLINE static inline
+#elif defined(__GNUC__)
+#   define CS_HASH_INLINE static __inline__
+#elif defined(_MSC_VER)
+#   define CS_HASH_INLINE static __inline
+#else
+#   define CS_HASH_INLINE static
+#endif
+
 C_BEGIN
 
 typedef uint32_t cs_hash32;
 typedef cs_hash32 (*hash32_func)(const void*, uintptr_t);
+typedef uint64_t cs_hash64;
+typedef cs_hash64 (*hash64_func)(const void*, uintptr_t);
 
 CSTRUCTURES_PUBLIC_API cs_hash32
 hash32_jenkins_oaat(const void* key, uintptr_t len);
 
+/*!
+ * @brief wyhash (final version 4), folded to 32 bits. Processes 16 bytes per
+ * step (48 bytes in three independent lanes for long keys) using 64x64->128
+ * bit multiplications, and keys of up to 16 bytes without a loop. Passes
+ * SMHasher. This is HASH32_DEFAULT.
+ * @note The result depends on the byte order of the machine.
+ */
+CSTRUCTURES_PUBLIC_API cs_hash32
+hash32_wyhash(const void* key, uintptr_t len);
+
+/*!
+ * @brief State for hashing a key in pieces with hash32_wyhash_update().
+ * Hashing the pieces gives the same result as calling hash32_wyhash() on
+ * their concatenation, so composite keys don't have to be copied into a
+ * contiguous buffer first.
+ *
+ * ```c
+ * struct cs_wyhash_state state;
+ * hash32_wyhash_init(&state);
+ * hash32_wyhash_update(&state, &key->tenant, sizeof(key->tenant));
+ * hash32_wyhash_update(&state, key->name, strlen(key->name));
+ * hash32_wyhash_update(&state, &key->timestamp, sizeof(key->timestamp));
+ * hash = hash32_wyhash_final(&state);
+ * ```
+ */
+struct cs_wyhash_state
+{
+    uint64_t lanes[3];
+    uint64_t length;
+    uint32_t pending;
+    uint8_t  buf[64];   /* 16 bytes of history, followed by up to 48 pending bytes */
+};
+
+CSTRUCTURES_PUBLIC_API void
+hash32_wyhash_init(struct cs_wyhash_state* state);
+
+CSTRUCTURES_PUBLIC_API void
+hash32_wyhash_update(struct cs_wyhash_state* state, const void* data, uintptr_t len);
+
+/*!
+ * @brief Returns the hash of everything passed to hash32_wyhash_update() so
+ * far. The state is not modified, so more data can be appended afterwards.
+ */
+CSTRUCTURES_PUBLIC_API cs_hash32
+hash32_wyhash_final(const struct cs_wyhash_state* state);
+
+/*!
+ * @brief The full 64-bit result of wyhash. hash32_wyhash() returns the two
+ * halves of this XORed together.
+ */
+CSTRUCTURES_PUBLIC_API cs_hash64
+hash64_wyhash(const void* key, uintptr_t len);
+
+/*!
+ * @brief Same as hash32_wyhash_final(), but returns the result of
+ * hash64_wyhash().
+ */
+CSTRUCTURES_PUBLIC_API cs_hash64
+hash64_wyhash_final(const struct cs_wyhash_state* state);
+
+/*!
+ * @brief CRC32C (Castagnoli) of the key, as used by iSCSI, ext4 and SSE4.2.
+ * Uses the crc32 instruction if the CPU has it (see cpu.h), and slice-by-8
+ * tables otherwise. The result is the same on every path and every machine.
+ * @note CRC is linear, so unlike hash32_wyhash it has no avalanche, and
+ * colliding keys are trivial to construct. It is therefore never used unless
+ * passed explicitly. It beats hash32_wyhash for keys below about 64 bytes
+ * when the crc32 instruction is available, and is slower above that.
+ */
+CSTRUCTURES_PUBLIC_API cs_hash32
+hash32_crc32c(const void* key, uintptr_t len);
+
+/*!
+ * @brief Picks the kernel of hash32_crc32c(). Called by cstructures_init()
+ * after cpu_init().
+ */
+CSTRUCTURES_PRIVATE_API void
+hash_init(void);
+
+/*!
+ * @brief The hash function used by the hash containers unless a different
+ * one is specified.
+ */
+#define HASH32_DEFAULT hash32_wyhash
+
+/*!
+ * @brief Mixes an integer so every input bit affects every output bit
+ * ("lowbias32" by Chris Wellons). This is a bijection, so distinct keys never
+ * collide. Inline, so specialized maps (see hashmap_typed.h) can use it
+ * without a call.
+ */
+CS_HASH_INLINE cs_hash32
+hash32_mix_u32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+/*!
+ * @brief Mixes a 64-bit integer with the finalizer of MurmurHash3 (x64),
+ * which is a bijection.
+ */
+CS_HASH_INLINE cs_hash64
+hash64_mix_u64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+/*!
+ * @brief hash64_mix_u64() folded to 32 bits.
+ */
+CS_HASH_INLINE cs_hash32
+hash32_mix_u64(uint64_t x)
+{
+    cs_hash64 h = hash64_mix_u64(x);
+    return (cs_hash32)(h ^ (h >> 32));
+}
+
+/*!
+ * @brief Hash function for keys that are a uint32_t, using hash32_mix_u32().
+ * Unlike the byte hashes it doesn't loop over the key, and the result is the
+ * same on every machine with the same byte order.
+ */
+CSTRUCTURES_PUBLIC_API cs_hash32
+hash32_u32(const void* key, uintptr_t len);
+
+/*!
+ * @brief Hash function for keys that are a uint64_t, using hash32_mix_u64().
+ */
+CSTRUCTURES_PUBLIC_API cs_hash32
+hash32_u64(const void* key, uintptr_t len);
+
+/*!
+ * @brief Mixes the two halves of the pointer with hash32_combine(). The low
+ * bits of the result are poorly mixed, prefer hash32_mixed_ptr().
+ */
 CSTRUCTURES_PUBLIC_API cs_hash32
 hash32_ptr(const void* ptr, uintptr_t len);
 
+/*!
+ * @brief Divides the pointer by its size. The result is not mixed at all,
+ * prefer hash32_mixed_ptr().
+ */
 CSTRUCTURES_PUBLIC_API cs_hash32
 hash32_aligned_ptr(const void* ptr, uintptr_t len);
 
+/*!
+ * @brief Hashes a pointer (the key is a pointer to the pointer) with
+ * hash32_mix_u64() or hash32_mix_u32(), depending on the pointer size. The
+ * alignment bits and the bits shared by all heap pointers are mixed into
+ * the whole result.
+ */
+CSTRUCTURES_PUBLIC_API cs_hash32
+hash32_mixed_ptr(const void* ptr, uintptr_t len);
+
+/*!
+ * @brief Hashes a pointer to 64 bits (the key is a pointer to the pointer,
+ * like hash32_ptr()). Every input bit affects every output bit.
+ */
+CSTRUCTURES_PUBLIC_API cs_hash64
+hash64_ptr(const void* ptr, uintptr_t len);
+
 /*!
  * @brief Taken from boost::hash_combine. Combines two hash values into a
  * new hash value.
@@ -24,4 +201,10 @@ hash32_aligned_ptr(const void* ptr, uintptr_t len);
 CSTRUCTURES_PUBLIC_API cs_hash32
 hash32_combine(cs_hash32 lhs, cs_hash32 rhs);
 
+/*!
+ * @brief 64-bit version of hash32_combine().
+ */
+CSTRUCTURES_PUBLIC_API cs_hash64
+hash64_combine(cs_hash64 lhs, cs_hash64 rhs);
+
 C_END
@@ -1,14 +1,24 @@
 #pragma once
 
 #include "cstructures/config.h"
+#include "cstructures/allocator.h"
 #include "cstructures/hash.h"
 
-#define HM_SLOT_UNUSED    ((cs_hash32)0)
-#define HM_SLOT_RIP       ((cs_hash32)1)
-#define HM_SLOT_INVALID   ((cs_hash32)-1)
-#define HM_REHASH_AT_PERCENT   70
+/*
+ * Every slot has a one byte control tag. The tag is either one of the two
+ * special values below, or the lower 7 bits of the slot's hash. The tags are
+ * stored densely at the start of the storage so a group of HM_GROUP_SIZE tags
+ * can be matched at once (one SSE2 compare, if available).
+ */
+#define HM_CTRL_EMPTY     ((uint8_t)0x80)
+#define HM_CTRL_DELETED   ((uint8_t)0xFE)
+#define HM_CTRL_IS_FULL(ctrl) (((ctrl) & 0x80) == 0)
+#define HM_GROUP_SIZE     16
+#define HM_REHASH_AT_PERCENT   88
 #define HM_DEFAULT_TABLE_COUNT 128
-#define HM_EXPAND_FACTOR 3
+#define HM_EXPAND_FACTOR 2
+#define HM_BATCH_SIZE    16
+#define HM_INCREMENTAL_REHASH_STEP 4  /* Groups migrated per insert/erase */
 
 C_BEGIN
 
@@ -19,14 +29,98 @@ enum cs_hashmap_status
     HM_OOM = -1
 };
 
+/*
+ * With CSTRUCTURES_HASHMAP_64BIT, slot counts and hashes are 64 bits. Tables
+ * can then grow beyond 2^32 slots, and the full 64-bit hash stored in every
+ * slot rejects nearly all mismatching keys before they are compared. Hash
+ * functions are hash64_func instead of hash32_func in that case.
+ */
+#if defined(CSTRUCTURES_HASHMAP_64BIT)
+typedef uint64_t    cs_hashmap_size;
+typedef cs_hash64   cs_hashmap_hash;
+typedef hash64_func hashmap_hash_func;
+#   define HM_DEFAULT_HASH hash64_wyhash
+#else
+typedef uint32_t    cs_hashmap_size;
+typedef cs_hash32   cs_hashmap_hash;
+typedef hash32_func hashmap_hash_func;
+#   define HM_DEFAULT_HASH HASH32_DEFAULT
+#endif
+
+/*!
+ * @brief Hashes a whole key, see hashmap_set_key_hash().
+ * @param[in] user The pointer passed to hashmap_set_key_hash().
+ */
+typedef cs_hashmap_hash (*hashmap_key_hash_func)(const void* key, void* user);
+
+enum cs_hashmap_flags
+{
+    /*!
+     * Instead of copying the whole table when it grows, keep the old table
+     * around and migrate HM_INCREMENTAL_REHASH_STEP groups to the new table
+     * on every insert and erase. Lookups check both tables until migration
+     * has finished. This bounds the latency of a single insertion.
+     */
+    HM_INCREMENTAL_REHASH = 0x01,
+
+    /*!
+     * Use Robin Hood linear probing instead of group probing. Entries are
+     * kept ordered by their distance from their home slot, which bounds the
+     * variance of probe lengths and lets lookups stop early. Erase shifts the
+     * following entries back instead of leaving a tombstone.
+     */
+    HM_ROBIN_HOOD = 0x02,
+
+    /*!
+     * Shrink the table when erasing drops the load below
+     * CSTRUCTURES_HASHMAP_SHRINK_AT_PERCENT. The table is halved for as long
+     * as the load stays below half of HM_REHASH_AT_PERCENT, so it ends up
+     * between a quarter and half of HM_REHASH_AT_PERCENT (22% to 44%). This
+     * leaves room to grow and to shrink again, so the map doesn't oscillate
+     * between the two.
+     */
+    HM_SHRINK = 0x04,
+
+    /*!
+     * Keys are strings of any length. Instead of a fixed size key, every slot
+     * stores the key's length and its offset into an append-only key arena.
+     * Lookups compare the hash, then the length, then the bytes. Use the
+     * hashmap_*_str() functions with this mode. The key_size parameter is
+     * ignored. The bytes of erased keys are reclaimed when the arena would
+     * otherwise have to grow and at least half of it is erased keys, or by
+     * calling hashmap_shrink_to_fit().
+     */
+    HM_VARIABLE_KEYS = 0x08,
+
+    /*!
+     * Set by hashmap_open_mmap(), never pass this yourself. The storage
+     * points into a read-only file mapping: the hashmap can be looked up and
+     * iterated, but not modified. hashmap_deinit() unmaps the file.
+     */
+    HM_MAPPED = 0x10
+};
+
 struct cs_hashmap
 {
-    uint32_t     table_count;
-    uint32_t     key_size;
-    uint32_t     value_size;
-    uint32_t     slots_used;
-    hash32_func  hash;
-    void*        storage;
+    cs_hashmap_size table_count;
+    cs_hashmap_size slots_used;
+    cs_hashmap_size tombstones;   /* Slots marked HM_CTRL_DELETED in the current table */
+    cs_hashmap_size old_table_count;
+    cs_hashmap_size old_groups_migrated;
+    uint32_t        key_size;
+    uint32_t        value_size;
+    uint32_t        flags;
+    hashmap_hash_func hash;
+    hashmap_key_hash_func key_hash;  /* Replaces hash if not NULL */
+    void*           key_hash_user;
+    const struct cs_allocator* allocator;
+    void*           storage;
+    void*           old_storage;  /* Non-NULL while an incremental rehash is in progress */
+    void*           key_arena;    /* HM_VARIABLE_KEYS only */
+    uint32_t        key_arena_size;
+    uint32_t        key_arena_capacity;
+    uint32_t        key_arena_garbage;  /* Bytes belonging to erased keys */
+    uint64_t        mapped_size;  /* HM_MAPPED only: length of the file mapping */
 #ifdef CSTRUCTURES_HASHMAP_STATS
     struct {
         uintptr_t total_insertions;
@@ -36,9 +130,9 @@ struct cs_hashmap
         uintptr_t total_rehashes;
         uintptr_t total_insertion_probes;
         uintptr_t total_deletion_probes;
+        uintptr_t total_tag_collisions;  /* Tag matched, but the key didn't */
         uintptr_t max_slots_used;
         uintptr_t max_slots_tombstoned;
-        uint32_t current_tombstone_count;
     } stats;
 #endif
 };
@@ -54,10 +148,8 @@ struct cs_hashmap
  * ```
  * @param[in] key_size Specifies how many bytes of the "key" parameter to hash
  * in the hashmap_insert() call. Due to performance reasons, all keys are
- * identical in size. If you wish to use strings for keys, then you need to
- * specify the maximum possible string length here, and make sure you never
- * use strings that are longer than that (hashmap_insert_key contains a safety
- * check in debug mode for this case).
+ * identical in size. If you wish to use strings of varying length for keys,
+ * use hashmap_create_str() instead.
  * @note This parameter must be larger than 0.
  * @param[in] value_size Specifies how many bytes long the value type is. When
  * calling hashmap_insert(), value_size number of bytes are copied from the
@@ -74,8 +166,18 @@ CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
 hashmap_create_with_options(struct cs_hashmap** hm,
                             uint32_t key_size,
                             uint32_t value_size,
-                            uint32_t table_count,
-                            hash32_func hash_func);
+                            cs_hashmap_size table_count,
+                            hashmap_hash_func hash_func,
+                            uint32_t flags);
+
+/*!
+ * @brief Allocates and initializes a new hashmap with string keys of any
+ * length (see HM_VARIABLE_KEYS). Keys are inserted and looked up with the
+ * hashmap_*_str() functions. See hashmap_create() for the other parameters.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashmap_create_str(struct cs_hashmap** hm,
+                   uint32_t value_size);
 
 /*!
  * @brief Initializes a new hashmap. See hashmap_create() for details on
@@ -86,12 +188,77 @@ hashmap_init(struct cs_hashmap* hm,
              uint32_t key_size,
              uint32_t value_size);
 
+/*!
+ * @brief Initializes a new hashmap with string keys. See hashmap_create_str().
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashmap_init_str(struct cs_hashmap* hm,
+                 uint32_t value_size);
+
+/*!
+ * @brief Initializes a new hashmap with a custom initial size and hash
+ * function. See hashmap_create() for details on the other parameters.
+ * @param[in] table_count Number of slots to allocate. This is rounded up to
+ * the next power of two (and at least HM_GROUP_SIZE).
+ * @param[in] flags Bitwise combination of cs_hashmap_flags, or 0.
+ */
 CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
 hashmap_init_with_options(struct cs_hashmap* hm,
                           uint32_t key_size,
                           uint32_t value_size,
-                          uint32_t table_count,
-                          hash32_func hash_func);
+                          cs_hashmap_size table_count,
+                          hashmap_hash_func hash_func,
+                          uint32_t flags);
+
+/*!
+ * @brief Same as hashmap_init_with_options(), but all of the hashmap's
+ * storage is allocated through the specified allocator instead of
+ * memory_default_allocator.
+ * @param[in] allocator Must outlive the hashmap.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashmap_init_with_allocator(struct cs_hashmap* hm,
+                            uint32_t key_size,
+                            uint32_t value_size,
+                            cs_hashmap_size table_count,
+                            hashmap_hash_func hash_func,
+                            uint32_t flags,
+                            const struct cs_allocator* allocator);
+
+/*!
+ * @brief Writes the hashmap to a file so it can later be loaded with
+ * hashmap_open_mmap(). A versioned header (sizes, flags and an id for the
+ * hash function) is followed by the storage block and, with
+ * HM_VARIABLE_KEYS, the key arena. Any incremental rehash is finished first.
+ * @note Files can only be loaded on machines with the same byte order. Only
+ * the hash functions that don't depend on the process (currently
+ * hash32_jenkins_oaat, hash32_wyhash, hash32_crc32c, hash32_u32 and
+ * hash32_u64, or hash64_wyhash with CSTRUCTURES_HASHMAP_64BIT) can be saved. Files record the hash width
+ * and only open in builds with the same setting.
+ * The bytes of empty slots are written as zeros.
+ * @param[in] fd File descriptor open for writing. It must be seekable: the
+ * map is always written at offset 0, because that is where
+ * hashmap_open_mmap() expects it. It is not closed.
+ * @return Returns 0 on success, or -1 if the hash function can't be saved or
+ * writing failed.
+ */
+CSTRUCTURES_PRIVATE_API int
+hashmap_save(struct cs_hashmap* hm, int fd);
+
+/*!
+ * @brief Maps a file written by hashmap_save() and initializes a read-only
+ * hashmap that points into the mapping. Nothing is copied: pages are loaded
+ * on demand as lookups touch them. Use hashmap_find() and friends as usual,
+ * and hashmap_deinit() to unmap the file.
+ * @note All sizes in the header are checked against the file size. With
+ * HM_VARIABLE_KEYS, every key's position in the arena is checked too, which
+ * reads all of the slots once.
+ * @return Returns 0 on success, or -1 if the file can't be mapped, is
+ * inconsistent, or was not written by a compatible version on a compatible
+ * machine.
+ */
+CSTRUCTURES_PRIVATE_API int
+hashmap_open_mmap(struct cs_hashmap* hm, const char* path);
 
 /*!
  * @brief Cleans up internal resources without freeing the hashmap object itself.
@@ -105,14 +272,68 @@ hashmap_deinit(struct cs_hashmap* hm);
 CSTRUCTURES_PRIVATE_API void
 hashmap_free(struct cs_hashmap* hm);
 
+/*!
+ * @brief Grows the table so that it can hold the specified number of elements
+ * without exceeding HM_REHASH_AT_PERCENT, i.e. without rehashing.
+ * @note This never shrinks the table.
+ * @return Returns HM_OK on success, or HM_OOM if allocation fails.
+ */
 CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
 hashmap_reserve(struct cs_hashmap* hm,
-                uint32_t table_count);
+                cs_hashmap_size element_count);
+
+/*!
+ * @brief Resizes the table to the smallest power of two that holds the
+ * current number of elements without exceeding HM_REHASH_AT_PERCENT. If the
+ * table is already that small, all tombstones are purged instead. With
+ * HM_VARIABLE_KEYS, the key arena is compacted to the size of the live keys.
+ * @return Returns HM_OK on success, or HM_OOM if allocation fails.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashmap_shrink_to_fit(struct cs_hashmap* hm);
+
+/*!
+ * @brief Hashes keys with a callback instead of the hash function. Keys are
+ * still stored and compared as key_size bytes, but the callback can hash
+ * them field by field, e.g. with hash32_wyhash_update(), so a struct key
+ * made of several fields never has to be copied into a buffer for hashing.
+ * The callback must hash equal keys (as compared by memcmp) equally, so
+ * clear any padding and unused bytes of the keys.
+ * @note Must be called while the hashmap is empty. Not supported with
+ * HM_VARIABLE_KEYS. Such hashmaps can't be saved with hashmap_save().
+ * @param[in] key_hash The callback, or NULL to go back to the hash function.
+ * @param[in] user Passed to every call of the callback.
+ */
+CSTRUCTURES_PRIVATE_API void
+hashmap_set_key_hash(struct cs_hashmap* hm,
+                     hashmap_key_hash_func key_hash,
+                     void* user);
+
+/*!
+ * @brief Migrates all remaining entries of an incremental rehash that is in
+ * progress. Does nothing if there is none. Call this before HASHMAP_FOR_EACH
+ * to iterate a single table in slot order.
+ */
+CSTRUCTURES_PRIVATE_API void
+hashmap_finish_rehash(struct cs_hashmap* hm);
+
+/*!
+ * @brief Makes sure there is room for one more entry, growing the table or
+ * purging tombstones as necessary. This is called by every insertion function
+ * and only needs to be called directly by code that places entries itself,
+ * such as the functions generated by hashmap_typed.h.
+ * @return Returns HM_OK on success, or HM_OOM if allocation fails.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashmap_prepare_insert(struct cs_hashmap* hm);
 
 /*!
  * @brief Inserts a key and value into the hashmap.
  * @note Complexity is generally O(1). Inserting may cause a rehash if the
- * table size exceeds HM_REHASH_AT_PERCENT.
+ * table size exceeds HM_REHASH_AT_PERCENT. If more than
+ * CSTRUCTURES_HASHMAP_TOMBSTONE_PERCENT of the slots are tombstones, or
+ * the tombstones alone push the table over HM_REHASH_AT_PERCENT, the table is
+ * instead rehashed in place at the same size.
  * @param[in] hm A pointer to a valid hashmap object.
  * @param[in] key A pointer to where the key is stored. key_size number of
  * bytes are hashed and copied into the hashmap from this location in
@@ -130,40 +351,217 @@ hashmap_insert(
     const void* key,
     const void* value);
 
+/*!
+ * @brief Inserts many keys and values in one go.
+ *
+ * The table is grown once up front for all keys. Keys are then processed
+ * in windows of HM_BATCH_SIZE: all hashes of a window are computed and the
+ * home group of each key is prefetched before any probing takes place, so
+ * the cache misses of a window overlap.
+ * @param[in] keys Array of count keys, each key_size bytes long.
+ * @param[in] values Array of count values, each value_size bytes long. May
+ * be NULL.
+ * @param[in] count Number of keys to insert.
+ * @param[out] statuses If not NULL, the result of each individual insertion
+ * is written to this array (see hashmap_insert()).
+ * @return Returns HM_OOM if an allocation failed, in which case the remaining
+ * keys are not inserted. Otherwise HM_OK.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashmap_insert_batch(struct cs_hashmap* hm,
+                     const void* keys,
+                     const void* values,
+                     uint32_t count,
+                     enum cs_hashmap_status* statuses);
+
+/*!
+ * @brief If the key doesn't exist, inserts it and returns a pointer to its
+ * uninitialized value. If the key does exist, nothing is inserted and a
+ * pointer to the existing value is returned. The key is hashed and probed
+ * only once, unlike a hashmap_find() followed by hashmap_insert().
+ * Example:
+ * ```cpp
+ * int* count;
+ * switch (hashmap_find_or_emplace(hm, word, (void**)&count))
+ * {
+ *     case HM_OK     : *count = 1; break;
+ *     case HM_EXISTS : ++*count; break;
+ *     case HM_OOM    : handle_error();
+ * }
+ * ```
+ * @warning The returned pointer can be invalidated if any insertions or
+ * deletions are performed.
+ * @param[in] hm A pointer to a valid hashmap object.
+ * @param[in] key A pointer to the key. See hashmap_insert().
+ * @param[out] value Will be updated to point to either the newly inserted
+ * value, which must be initialized by the caller, or the existing value.
+ * @return Returns HM_OK if a new entry was made. Returns HM_EXISTS if the key
+ * already existed. Returns HM_OOM if a rehash failed to allocate memory, in
+ * which case "value" is not written.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashmap_find_or_emplace(struct cs_hashmap* hm,
+                        const void* key,
+                        void** value);
+
+/*!
+ * @brief Computes the hash of a key the same way the hashmap does internally.
+ * The result can be passed to the _with_hash() functions of any hashmap with
+ * the same key size and hash function, so a key that is looked up in several
+ * maps only needs to be hashed once.
+ * @note Every 32-bit value is a valid hash, nothing is reserved.
+ */
+CSTRUCTURES_PRIVATE_API cs_hashmap_hash
+hashmap_hash_key(const struct cs_hashmap* hm, const void* key);
+
+/*!
+ * @brief Same as hashmap_insert(), but uses a precomputed hash.
+ * @warning The hash must be equal to hashmap_hash_key(hm, key). If it isn't,
+ * the key will be stored where lookups can't find it.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashmap_insert_with_hash(struct cs_hashmap* hm,
+                         const void* key,
+                         cs_hashmap_hash hash,
+                         const void* value);
+
+/*!
+ * @brief Same as hashmap_find_or_emplace(), but uses a precomputed hash.
+ * @warning The hash must be equal to hashmap_hash_key(hm, key).
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashmap_find_or_emplace_with_hash(struct cs_hashmap* hm,
+                                  const void* key,
+                                  cs_hashmap_hash hash,
+                                  void** value);
+
+/*!
+ * @brief Inserts a null-terminated string key into a hashmap created with
+ * hashmap_create_str(). Only the actual length of the string is hashed,
+ * compared and stored. See hashmap_insert() for the other parameters and
+ * return values.
+ */
 CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
 hashmap_insert_str(struct cs_hashmap* hm,
                    const char* key,
                    const void* value);
 
+/*!
+ * @brief Same as hashmap_find_or_emplace(), but for string keys.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashmap_find_or_emplace_str(struct cs_hashmap* hm,
+                            const char* key,
+                            void** value);
+
 CSTRUCTURES_PRIVATE_API void*
 hashmap_erase(struct cs_hashmap* hm,
               const void* key);
 
+/*!
+ * @brief Same as hashmap_erase(), but uses a precomputed hash.
+ * @warning The hash must be equal to hashmap_hash_key(hm, key).
+ */
+CSTRUCTURES_PRIVATE_API void*
+hashmap_erase_with_hash(struct cs_hashmap* hm,
+                        const void* key,
+                        cs_hashmap_hash hash);
+
+/*!
+ * @brief Same as hashmap_erase(), but for string keys.
+ */
 CSTRUCTURES_PRIVATE_API void*
 hashmap_erase_str(struct cs_hashmap* hm,
-                  const char* key,
-                  enum cs_hashmap_status* status);
+                  const char* key);
 
 CSTRUCTURES_PRIVATE_API void*
 hashmap_find(const struct cs_hashmap* hm, const void* key);
 
+/*!
+ * @brief Same as hashmap_find(), but uses a precomputed hash.
+ * @warning The hash must be equal to hashmap_hash_key(hm, key).
+ */
+CSTRUCTURES_PRIVATE_API void*
+hashmap_find_with_hash(const struct cs_hashmap* hm,
+                       const void* key,
+                       cs_hashmap_hash hash);
+
+/*!
+ * @brief Looks up many keys in one go.
+ *
+ * Keys are processed in windows of HM_BATCH_SIZE. First all hashes of a
+ * window are computed and the control tags of each home group are
+ * prefetched, then the first matching slot of each key is prefetched, and
+ * only then are the probes resolved. This keeps up to HM_BATCH_SIZE cache
+ * misses in flight at once, which pays off when the table doesn't fit into
+ * the cache.
+ * @param[in] keys Array of count keys, each key_size bytes long.
+ * @param[in] count Number of keys to look up.
+ * @param[out] values Array of count pointers. Each is set to the value of the
+ * corresponding key, or NULL if the key does not exist (see hashmap_find()).
+ * @return Returns the number of keys that were found.
+ */
+CSTRUCTURES_PRIVATE_API uint32_t
+hashmap_find_many(const struct cs_hashmap* hm,
+                  const void* keys,
+                  uint32_t count,
+                  void** values);
+
+/*!
+ * @brief Same as hashmap_find(), but for string keys.
+ */
 CSTRUCTURES_PRIVATE_API void*
-hashmap_find_str(struct cs_hashmap* hm, const char* key);
+hashmap_find_str(const struct cs_hashmap* hm, const char* key);
+
+/*!
+ * @brief With HM_VARIABLE_KEYS, the key pointer of HASHMAP_FOR_EACH points to
+ * the slot's reference into the key arena. This returns the string it refers
+ * to. The string is not null-terminated.
+ * @param[out] length If not NULL, the length of the string is written here.
+ */
+CSTRUCTURES_PRIVATE_API const char*
+hashmap_key_str(const struct cs_hashmap* hm,
+                const void* slot_key,
+                uint32_t* length);
 
 #define hashmap_count(hm) ((hm)->slots_used)
 
+/*
+ * Iteration positions first cover the slots of the current table. During an
+ * incremental rehash they continue with the slots of the old table, starting
+ * at the first group that wasn't migrated yet. Every entry lives in exactly
+ * one of the two ranges.
+ */
+#define HASHMAP_ITER_IS_OLD(hm, pos) ((pos) >= (hm)->table_count)
+#define HASHMAP_ITER_END(hm) \
+    ((hm)->table_count + ((hm)->old_storage ? (hm)->old_table_count : 0))
+#define HASHMAP_ITER_NEXT(hm, pos) \
+    ((pos) + 1 == (hm)->table_count && (hm)->old_storage ? \
+        (pos) + 1 + (hm)->old_groups_migrated * HM_GROUP_SIZE : (pos) + 1)
+#define HASHMAP_ITER_STORAGE(hm, pos) \
+    ((uint8_t*)(HASHMAP_ITER_IS_OLD(hm, pos) ? (hm)->old_storage : (hm)->storage))
+#define HASHMAP_ITER_SLOTS(hm, pos) \
+    (HASHMAP_ITER_IS_OLD(hm, pos) ? (hm)->old_table_count : (hm)->table_count)
+#define HASHMAP_ITER_INDEX(hm, pos) \
+    (HASHMAP_ITER_IS_OLD(hm, pos) ? (pos) - (hm)->table_count : (pos))
+
+/*!
+ * Iterates over all entries. The hashmap is not modified, so this works on
+ * const hashmaps and doesn't finish an incremental rehash that is in
+ * progress: the entries that are still in the old table are visited after
+ * those in the current table.
+ */
 #define HASHMAP_FOR_EACH(hm, key_t, value_t, key, value) { \
     key_t* key; \
     value_t* value; \
-    cs_hash32 pos_##value; \
+    cs_hashmap_size pos_##value; \
     for (pos_##value = 0; \
-        pos_##value != (hm)->table_count && \
-            ((key = (key_t*)((uint8_t*)(hm)->storage + (sizeof(cs_hash32) + (hm)->key_size) * pos_##value + sizeof(cs_hash32))) || 1) && \
-            ((value = (value_t*)((uint8_t*)(hm)->storage + (sizeof(cs_hash32) + (hm)->key_size) * (hm)->table_count + (hm)->value_size * pos_##value)) || 1); \
-        ++pos_##value) \
+        pos_##value != HASHMAP_ITER_END(hm) && \
+            ((key = (key_t*)(HASHMAP_ITER_STORAGE(hm, pos_##value) + HASHMAP_ITER_SLOTS(hm, pos_##value) + (sizeof(cs_hashmap_hash) + (hm)->key_size) * HASHMAP_ITER_INDEX(hm, pos_##value) + sizeof(cs_hashmap_hash))) || 1) && \
+            ((value = (value_t*)(HASHMAP_ITER_STORAGE(hm, pos_##value) + (1 + sizeof(cs_hashmap_hash) + (hm)->key_size) * HASHMAP_ITER_SLOTS(hm, pos_##value) + (hm)->value_size * HASHMAP_ITER_INDEX(hm, pos_##value))) || 1); \
+        pos_##value = HASHMAP_ITER_NEXT(hm, pos_##value)) \
     { \
-        cs_hash32 slot_##value = *(cs_hash32*)((uint8_t*)(hm)->storage + (sizeof(cs_hash32) + (hm)->key_size) * pos_##value); \
-        if (slot_##value == HM_SLOT_UNUSED || slot_##value == HM_SLOT_RIP || slot_##value == HM_SLOT_INVALID) \
+        if (!HM_CTRL_IS_FULL(HASHMAP_ITER_STORAGE(hm, pos_##value)[HASHMAP_ITER_INDEX(hm, pos_##value)])) \
             continue; \
 
 
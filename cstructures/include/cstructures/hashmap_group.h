@@ -0,0 +1,132 @@
+#pragma once
+
+#include "cstructures/hashmap.h"
+#include <assert.h>
+
+/*
+ * Group probing primitives shared by hashmap.c, hashset.c, chashmap.c and
+ * hashmap_typed.h. Not part of the API: it is a header only so the typed maps
+ * can inline the exact same code as the generic ones.
+ */
+
+#if defined(CSTRUCTURES_HASHMAP_SIMD) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#   define CS_HM_USE_SSE2
+#   include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+#if defined(__cplusplus) || (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+#   define CS_HM_INLINE static inline
+#elif defined(__GNUC__)
+#   define CS_HM_INLINE static __inline__
+#elif defined(_MSC_VER)
+#   define CS_HM_INLINE static __inline
+#else
+#   define CS_HM_INLINE static
+#endif
+
+C_BEGIN
+
+/* ------------------------------------------------------------------------- */
+CS_HM_INLINE int
+cs_hm_ctz32(uint32_t mask)
+{
+    assert(mask != 0);
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#elif defined(_MSC_VER)
+    {
+        unsigned long idx;
+        _BitScanForward(&idx, mask);
+        return (int)idx;
+    }
+#else
+    {
+        int idx = 0;
+        while ((mask & 1) == 0)
+        {
+            mask >>= 1;
+            idx++;
+        }
+        return idx;
+    }
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+CS_HM_INLINE int
+cs_hm_ctz64(uint64_t mask)
+{
+    assert(mask != 0);
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(mask);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    {
+        unsigned long idx;
+        _BitScanForward64(&idx, mask);
+        return (int)idx;
+    }
+#else
+    {
+        int idx = 0;
+        while ((mask & 1) == 0)
+        {
+            mask >>= 1;
+            idx++;
+        }
+        return idx;
+    }
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * The group functions return a bitmask with bit i set if the i'th tag in the
+ * group satisfies the condition.
+ */
+#if defined(CS_HM_USE_SSE2)
+CS_HM_INLINE uint32_t
+cs_hm_group_match(const uint8_t* ctrl, uint8_t h2)
+{
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)h2)));
+}
+CS_HM_INLINE uint32_t
+cs_hm_group_match_empty_or_deleted(const uint8_t* ctrl)
+{
+    /* Both special tags have the high bit set, full slots don't */
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+}
+#else
+CS_HM_INLINE uint32_t
+cs_hm_group_match(const uint8_t* ctrl, uint8_t h2)
+{
+    uint32_t mask = 0;
+    int i;
+    for (i = 0; i != HM_GROUP_SIZE; ++i)
+        if (ctrl[i] == h2)
+            mask |= (uint32_t)1 << i;
+    return mask;
+}
+CS_HM_INLINE uint32_t
+cs_hm_group_match_empty_or_deleted(const uint8_t* ctrl)
+{
+    uint32_t mask = 0;
+    int i;
+    for (i = 0; i != HM_GROUP_SIZE; ++i)
+        if (!HM_CTRL_IS_FULL(ctrl[i]))
+            mask |= (uint32_t)1 << i;
+    return mask;
+}
+#endif
+CS_HM_INLINE uint32_t
+cs_hm_group_match_empty(const uint8_t* ctrl)
+{
+    return cs_hm_group_match(ctrl, HM_CTRL_EMPTY);
+}
+
+C_END
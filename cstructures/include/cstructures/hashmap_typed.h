@@ -0,0 +1,234 @@
+#pragma once
+
+#include "cstructures/hashmap.h"
+#include "cstructures/hashmap_group.h"
+#include <string.h>
+
+/*
+ * Generates a hashmap API specialized for a fixed key type, value type, hash
+ * function and equality. Example:
+ *
+ * ```c
+ * static cs_hashmap_hash hash_u32(uint32_t key) { ... }
+ * #define equal_u32(a, b) ((a) == (b))
+ * CS_HASHMAP_TYPED(u32map, uint32_t, uint32_t, hash_u32, equal_u32)
+ *
+ * struct cs_hashmap hm;
+ * u32map_init(&hm);
+ * u32map_insert(&hm, 42, 7);
+ * uint32_t* value = u32map_find(&hm, 42);
+ * hashmap_deinit(&hm);
+ * ```
+ *
+ * The generated functions operate on a regular struct cs_hashmap with the
+ * same storage layout, so hashmap_deinit(), hashmap_reserve(),
+ * hashmap_shrink_to_fit(), hashmap_count() and HASHMAP_FOR_EACH all work.
+ * Because the key and value sizes are compile time constants and the hash
+ * and equality are called directly, the compiler can inline slot addressing,
+ * hashing and key comparisons. Growing and purging tombstones are left to
+ * hashmap.c.
+ *
+ * The generated functions are:
+ *   enum cs_hashmap_status name_init(struct cs_hashmap* hm);
+ *   enum cs_hashmap_status name_insert(struct cs_hashmap* hm, key_t key, value_t value);
+ *   enum cs_hashmap_status name_find_or_emplace(struct cs_hashmap* hm, key_t key, value_t** value);
+ *   value_t* name_find(const struct cs_hashmap* hm, key_t key);
+ *   value_t* name_erase(struct cs_hashmap* hm, key_t key);
+ * They behave like their generic counterparts.
+ *
+ * @note Typed maps always use group probing. Don't combine the generic
+ * key-based functions (hashmap_find() etc.) with a custom equality, because
+ * those compare keys byte by byte.
+ */
+
+#define CS_HMT_CTRL(hm) ((uint8_t*)(hm)->storage)
+#define CS_HMT_SLOT(hm, key_t, pos) \
+    ((uint8_t*)(hm)->storage + (hm)->table_count + (sizeof(cs_hashmap_hash) + sizeof(key_t)) * (pos))
+#define CS_HMT_VALUE(hm, key_t, value_t, pos) \
+    ((value_t*)((uint8_t*)(hm)->storage + (1 + sizeof(cs_hashmap_hash) + sizeof(key_t)) * (hm)->table_count + sizeof(value_t) * (pos)))
+
+C_BEGIN
+
+/* ------------------------------------------------------------------------- */
+CS_HM_INLINE cs_hashmap_size
+cs_hmt_home_group(const struct cs_hashmap* hm, cs_hashmap_hash hash)
+{
+#if defined(CSTRUCTURES_HASHMAP_64BIT)
+    uint64_t mixed = hash * 0x9E3779B97F4A7C15ull;
+    return (mixed >> 1) >> (63 - cs_hm_ctz64(hm->table_count / HM_GROUP_SIZE));
+#else
+    cs_hash32 mixed = hash * 2654435769u;
+    return (cs_hashmap_size)(((uint64_t)mixed * (hm->table_count / HM_GROUP_SIZE)) >> 32);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+CS_HM_INLINE int
+cs_hmt_needs_prepare(const struct cs_hashmap* hm)
+{
+    /* A superset of the conditions checked by hashmap_prepare_insert() */
+    return (uint64_t)(hm->slots_used + hm->tombstones) * 100 >= (uint64_t)hm->table_count * HM_REHASH_AT_PERCENT ||
+        (uint64_t)hm->tombstones * 100 >= (uint64_t)hm->table_count * CSTRUCTURES_HASHMAP_TOMBSTONE_PERCENT;
+}
+
+C_END
+
+/* ------------------------------------------------------------------------- */
+#define CS_HASHMAP_TYPED(name, key_t, value_t, hash_func, equal_func)         \
+                                                                              \
+/* Lets the generic functions hash keys of this map */                        \
+CS_HM_INLINE cs_hashmap_hash                                                 \
+name##_hash_key(const void* key, uintptr_t len)                               \
+{                                                                             \
+    key_t k;                                                                  \
+    (void)len;                                                                \
+    memcpy(&k, key, sizeof(key_t));                                           \
+    return hash_func(k);                                                      \
+}                                                                             \
+                                                                              \
+CS_HM_INLINE enum cs_hashmap_status                                          \
+name##_init(struct cs_hashmap* hm)                                            \
+{                                                                             \
+    return hashmap_init_with_options(hm, sizeof(key_t), sizeof(value_t),      \
+                                     HM_DEFAULT_TABLE_COUNT,                  \
+                                     name##_hash_key, 0);                     \
+}                                                                             \
+                                                                              \
+CS_HM_INLINE cs_hashmap_size                                                 \
+name##_find_slot(const struct cs_hashmap* hm, key_t key, cs_hashmap_hash hash) \
+{                                                                             \
+    cs_hashmap_size group = cs_hmt_home_group(hm, hash);                      \
+    cs_hashmap_size group_mask = hm->table_count / HM_GROUP_SIZE - 1;         \
+    uint8_t h2 = (uint8_t)(hash & 0x7F);                                      \
+    cs_hashmap_size i;                                                        \
+                                                                              \
+    for (i = 0; i <= group_mask; ++i)                                         \
+    {                                                                         \
+        const uint8_t* ctrl = CS_HMT_CTRL(hm) + group * HM_GROUP_SIZE;        \
+        uint32_t match = cs_hm_group_match(ctrl, h2);                        \
+        while (match)                                                         \
+        {                                                                     \
+            cs_hashmap_size pos = group * HM_GROUP_SIZE + (cs_hashmap_size)cs_hm_ctz32(match); \
+            const uint8_t* slot = CS_HMT_SLOT(hm, key_t, pos);                \
+            cs_hashmap_hash stored_hash;                                      \
+            key_t stored_key;                                                 \
+            memcpy(&stored_hash, slot, sizeof(cs_hashmap_hash));              \
+            memcpy(&stored_key, slot + sizeof(cs_hashmap_hash), sizeof(key_t)); \
+            if (stored_hash == hash && equal_func(stored_key, key))           \
+                return pos;                                                   \
+            match &= match - 1;                                               \
+        }                                                                     \
+        if (cs_hm_group_match(ctrl, HM_CTRL_EMPTY))                          \
+            break;                                                            \
+        group = (group + i + 1) & group_mask;                                 \
+    }                                                                         \
+                                                                              \
+    return (cs_hashmap_size)-1;                                               \
+}                                                                             \
+                                                                              \
+CS_HM_INLINE value_t*                                                        \
+name##_find(const struct cs_hashmap* hm, key_t key)                           \
+{                                                                             \
+    cs_hashmap_size pos = name##_find_slot(hm, key, hash_func(key));          \
+    if (pos == (cs_hashmap_size)-1)                                           \
+        return NULL;                                                          \
+    return CS_HMT_VALUE(hm, key_t, value_t, pos);                             \
+}                                                                             \
+                                                                              \
+CS_HM_INLINE enum cs_hashmap_status                                          \
+name##_find_or_emplace(struct cs_hashmap* hm, key_t key, value_t** value)     \
+{                                                                             \
+    cs_hashmap_hash hash = hash_func(key);                                    \
+    uint8_t h2 = (uint8_t)(hash & 0x7F);                                      \
+    cs_hashmap_size pos;                                                      \
+    uint8_t* slot;                                                            \
+                                                                              \
+    if (cs_hmt_needs_prepare(hm))                                             \
+        if (hashmap_prepare_insert(hm) != HM_OK)                              \
+            return HM_OOM;                                                    \
+                                                                              \
+    for (;;)                                                                  \
+    {                                                                         \
+        cs_hashmap_size group = cs_hmt_home_group(hm, hash);                  \
+        cs_hashmap_size group_mask = hm->table_count / HM_GROUP_SIZE - 1;     \
+        cs_hashmap_size i;                                                    \
+        pos = (cs_hashmap_size)-1;                                            \
+                                                                              \
+        for (i = 0; i <= group_mask; ++i)                                     \
+        {                                                                     \
+            const uint8_t* ctrl = CS_HMT_CTRL(hm) + group * HM_GROUP_SIZE;    \
+            uint32_t match = cs_hm_group_match(ctrl, h2);                    \
+            while (match)                                                     \
+            {                                                                 \
+                cs_hashmap_size candidate = group * HM_GROUP_SIZE + (cs_hashmap_size)cs_hm_ctz32(match); \
+                cs_hashmap_hash stored_hash;                                  \
+                key_t stored_key;                                             \
+                slot = CS_HMT_SLOT(hm, key_t, candidate);                     \
+                memcpy(&stored_hash, slot, sizeof(cs_hashmap_hash));          \
+                memcpy(&stored_key, slot + sizeof(cs_hashmap_hash), sizeof(key_t)); \
+                if (stored_hash == hash && equal_func(stored_key, key))       \
+                {                                                             \
+                    *value = CS_HMT_VALUE(hm, key_t, value_t, candidate);     \
+                    return HM_EXISTS;                                         \
+                }                                                             \
+                match &= match - 1;                                           \
+            }                                                                 \
+            if (pos == (cs_hashmap_size)-1)                                   \
+            {                                                                 \
+                uint32_t available = cs_hm_group_match_empty_or_deleted(ctrl); \
+                if (available)                                                \
+                    pos = group * HM_GROUP_SIZE + (cs_hashmap_size)cs_hm_ctz32(available); \
+            }                                                                 \
+            if (cs_hm_group_match(ctrl, HM_CTRL_EMPTY))                      \
+                break;                                                        \
+            group = (group + i + 1) & group_mask;                             \
+        }                                                                     \
+                                                                              \
+        if (pos != (cs_hashmap_size)-1)                                       \
+            break;                                                            \
+                                                                              \
+        /* Every group is either full or tombstoned. Grow and try again */    \
+        if (hashmap_reserve(hm, hm->table_count) != HM_OK)                    \
+            return HM_OOM;                                                    \
+    }                                                                         \
+                                                                              \
+    hm->slots_used++;                                                         \
+    if (CS_HMT_CTRL(hm)[pos] == HM_CTRL_DELETED)                              \
+        hm->tombstones--;                                                     \
+    CS_HMT_CTRL(hm)[pos] = h2;                                                \
+    slot = CS_HMT_SLOT(hm, key_t, pos);                                       \
+    memcpy(slot, &hash, sizeof(cs_hashmap_hash));                             \
+    memcpy(slot + sizeof(cs_hashmap_hash), &key, sizeof(key_t));              \
+    *value = CS_HMT_VALUE(hm, key_t, value_t, pos);                           \
+                                                                              \
+    return HM_OK;                                                             \
+}                                                                             \
+                                                                              \
+CS_HM_INLINE enum cs_hashmap_status                                          \
+name##_insert(struct cs_hashmap* hm, key_t key, value_t value)                \
+{                                                                             \
+    value_t* slot_value;                                                      \
+    enum cs_hashmap_status status = name##_find_or_emplace(hm, key, &slot_value); \
+    if (status == HM_OK)                                                      \
+        *slot_value = value;                                                  \
+    return status;                                                            \
+}                                                                             \
+                                                                              \
+CS_HM_INLINE value_t*                                                        \
+name##_erase(struct cs_hashmap* hm, key_t key)                                \
+{                                                                             \
+    cs_hashmap_size pos = name##_find_slot(hm, key, hash_func(key));          \
+    if (pos == (cs_hashmap_size)-1)                                           \
+        return NULL;                                                          \
+                                                                              \
+    hm->slots_used--;                                                         \
+    if (cs_hm_group_match(CS_HMT_CTRL(hm) + pos / HM_GROUP_SIZE * HM_GROUP_SIZE, HM_CTRL_EMPTY)) \
+        CS_HMT_CTRL(hm)[pos] = HM_CTRL_EMPTY;                                 \
+    else                                                                      \
+    {                                                                         \
+        CS_HMT_CTRL(hm)[pos] = HM_CTRL_DELETED;                               \
+        hm->tombstones++;                                                     \
+    }                                                                         \
+                                                                              \
+    return CS_HMT_VALUE(hm, key_t, value_t, pos);                             \
+}
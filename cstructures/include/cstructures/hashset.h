@@ -0,0 +1,134 @@
+#pragma once
+
+#include "cstructures/config.h"
+#include "cstructures/hash.h"
+#include "cstructures/hashmap.h"
+
+/*
+ * A set of fixed size keys. Probing works like cs_hashmap's group probing
+ * (one control tag per slot, matched HM_GROUP_SIZE at a time), but the
+ * storage only holds the tags and the keys:
+ *   [ctrl tags]  1 byte per slot
+ *   [keys]       key_size per slot
+ * Hashes aren't stored. A matching tag is confirmed by comparing the key,
+ * and the keys are hashed again when the table is rebuilt. For 8 byte keys
+ * this is 9 bytes per slot instead of the 13 a cs_hashmap with
+ * value_size = 0 uses.
+ */
+
+C_BEGIN
+
+struct cs_hashset
+{
+    uint32_t     table_count;
+    uint32_t     key_size;
+    uint32_t     slots_used;
+    uint32_t     tombstones;
+    hash32_func  hash;
+    void*        storage;
+};
+
+/*!
+ * @brief Allocates and initializes a new hashset.
+ * @param[in] key_size Size of a key in bytes. Must be larger than 0.
+ * @return If successful, returns HM_OK. If allocation fails, HM_OOM is returned.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashset_create(struct cs_hashset** hs, uint32_t key_size);
+
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashset_create_with_options(struct cs_hashset** hs,
+                            uint32_t key_size,
+                            uint32_t table_count,
+                            hash32_func hash_func);
+
+/*!
+ * @brief Initializes a new hashset. See hashset_create().
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashset_init(struct cs_hashset* hs, uint32_t key_size);
+
+/*!
+ * @brief Initializes a new hashset with a custom initial size and hash
+ * function.
+ * @param[in] table_count Number of slots to allocate. This is rounded up to
+ * the next power of two (and at least HM_GROUP_SIZE).
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashset_init_with_options(struct cs_hashset* hs,
+                          uint32_t key_size,
+                          uint32_t table_count,
+                          hash32_func hash_func);
+
+CSTRUCTURES_PRIVATE_API void
+hashset_deinit(struct cs_hashset* hs);
+
+CSTRUCTURES_PRIVATE_API void
+hashset_free(struct cs_hashset* hs);
+
+/*!
+ * @brief Grows the table so it can hold the specified number of keys
+ * without rehashing.
+ * @return Returns HM_OK on success, or HM_OOM if allocation fails.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashset_reserve(struct cs_hashset* hs, uint32_t element_count);
+
+/*!
+ * @return Returns HM_OK if the key was inserted, HM_EXISTS if it was already
+ * in the set, or HM_OOM if allocation failed.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashset_insert(struct cs_hashset* hs, const void* key);
+
+/*!
+ * @return Returns 1 if the key is in the set, 0 if not.
+ */
+CSTRUCTURES_PRIVATE_API int
+hashset_contains(const struct cs_hashset* hs, const void* key);
+
+/*!
+ * @return Returns 1 if the key was erased, 0 if it wasn't in the set.
+ */
+CSTRUCTURES_PRIVATE_API int
+hashset_erase(struct cs_hashset* hs, const void* key);
+
+/*!
+ * @brief Inserts every key of src into dst. Keys are hashed and their home
+ * groups in dst prefetched HM_BATCH_SIZE at a time.
+ * @note Both sets must have the same key size and hash function. A union of
+ * a set with itself does nothing.
+ * @return Returns HM_OK, or HM_OOM if allocation failed, in which case dst
+ * holds some of the keys of src.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashset_union(struct cs_hashset* dst, const struct cs_hashset* src);
+
+/*!
+ * @brief Inserts every key that is in both a and b into dst. The smaller of
+ * the two sets is iterated and probed against the larger in batches.
+ * @note All sets must have the same key size and hash function. dst must
+ * not be a or b.
+ * @return Returns HM_OK, or HM_OOM if allocation failed.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashset_intersection(struct cs_hashset* dst,
+                     const struct cs_hashset* a,
+                     const struct cs_hashset* b);
+
+#define hashset_count(hs) ((hs)->slots_used)
+
+#define HASHSET_FOR_EACH(hs, key_t, key) { \
+    key_t* key; \
+    uint32_t pos_##key; \
+    for (pos_##key = 0; \
+        pos_##key != (hs)->table_count && \
+            ((key = (key_t*)((uint8_t*)(hs)->storage + (hs)->table_count + (uintptr_t)(hs)->key_size * pos_##key)) || 1); \
+        ++pos_##key) \
+    { \
+        if (!HM_CTRL_IS_FULL(((uint8_t*)(hs)->storage)[pos_##key])) \
+            continue; \
+
+#define HASHSET_END_EACH }}
+
+C_END
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "cstructures/config.h"
+#include "cstructures/allocator.h"
 #include <stdint.h>
 
 #if defined(CSTRUCTURES_MEMORY_DEBUGGING)
@@ -19,6 +20,15 @@
             FREE(p); \
     } while(0)
 
+/* Allocations of containers that were given a struct cs_allocator */
+#define ALLOCATOR_MALLOC(a, size)      ((a)->alloc((a)->user, size))
+#define ALLOCATOR_REALLOC(a, p, size)  ((a)->realloc((a)->user, p, size))
+#define ALLOCATOR_FREE(a, p)           ((a)->free((a)->user, p))
+#define ALLOCATOR_XFREE(a, p) do { \
+        if (p) \
+            ALLOCATOR_FREE(a, p); \
+    } while(0)
+
 C_BEGIN
 
 /*!
@@ -61,6 +71,22 @@ cstructures_realloc(void* ptr, uintptr_t new_size);
 CSTRUCTURES_PRIVATE_API void
 cstructures_free(void*);
 
+#if defined(CSTRUCTURES_MEMORY_DEBUGGING)
+/*!
+ * @brief Records an allocation that was not made through MALLOC(), e.g. an
+ * object handed out by a cs_pool. It is reported as a leak by
+ * memory_deinit() unless memory_track_free() is called.
+ */
+CSTRUCTURES_PRIVATE_API void
+memory_track_alloc(void* p, uintptr_t size);
+
+/*!
+ * @brief Removes an allocation recorded with memory_track_alloc().
+ */
+CSTRUCTURES_PRIVATE_API void
+memory_track_free(void* p);
+#endif
+
 CSTRUCTURES_PUBLIC_API uintptr_t
 memory_get_num_allocs(void);
 
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "cstructures/config.h"
+#include <stdint.h>
+
+/*
+ * An allocator for objects of one fixed size. Objects are carved out of
+ * slabs of POOL_DEFAULT_SLAB_SIZE bytes (larger if fewer than
+ * POOL_MIN_OBJECTS_PER_SLAB objects would fit), and released objects go onto
+ * intrusive free lists. Slabs are only returned to the system when the pool
+ * is freed, so a pool never fragments the heap.
+ *
+ * The pool may be used from many threads at once. Free objects are kept in a
+ * shared depot, protected by a spinlock. If caching is enabled, every thread
+ * additionally keeps a thread local cache of free objects. Allocations and
+ * releases are served from the cache without locking or atomics, and the
+ * cache exchanges objects with the depot cache_size at a time, so the depot
+ * lock is taken once per cache_size operations. A thread has
+ * POOL_THREAD_CACHES caches, and each pool maps to one of them by a unique
+ * id. Pools that map to the same cache evict each other's objects back to
+ * their depots. Caches are also flushed when their thread exits.
+ *
+ * With CSTRUCTURES_MEMORY_DEBUGGING, every object handed out is recorded
+ * like a MALLOC() allocation, so objects that are never released show up in
+ * the report printed by memory_deinit().
+ *
+ * The structure is opaque because it uses C11 atomics.
+ */
+#define POOL_DEFAULT_SLAB_SIZE     4096
+#define POOL_MIN_OBJECTS_PER_SLAB  8
+#define POOL_DEFAULT_CACHE_SIZE    32
+#define POOL_THREAD_CACHES         8   /* Must be a power of two */
+
+C_BEGIN
+
+struct cs_pool;
+
+/*!
+ * @brief Allocates a new pool with per-thread caches of
+ * POOL_DEFAULT_CACHE_SIZE objects.
+ * @param[in] object_size Size of every object. It is rounded up to a
+ * multiple of sizeof(void*). Objects are aligned to sizeof(void*), or to 16
+ * bytes if the rounded size is a multiple of 16.
+ * @return Returns the new pool, or NULL if allocation failed.
+ */
+CSTRUCTURES_PUBLIC_API struct cs_pool*
+pool_create(uint32_t object_size);
+
+/*!
+ * @brief Allocates a new pool. See pool_create().
+ * @param[in] slab_size Size of the slabs, or 0 for POOL_DEFAULT_SLAB_SIZE.
+ * @param[in] cache_size Number of objects moved between a thread's cache and
+ * the depot at a time. A cache holds up to twice this many objects. Pass 0
+ * to disable caching, in which case every operation locks the depot.
+ */
+CSTRUCTURES_PUBLIC_API struct cs_pool*
+pool_create_with_options(uint32_t object_size,
+                         uint32_t slab_size,
+                         uint32_t cache_size);
+
+/*!
+ * @brief Frees all slabs and the pool itself. Objects that were not
+ * released become invalid.
+ */
+CSTRUCTURES_PUBLIC_API void
+pool_free(struct cs_pool* pool);
+
+/*!
+ * @return Returns an uninitialized object, or NULL if a new slab was needed
+ * and allocating it failed.
+ */
+CSTRUCTURES_PUBLIC_API void*
+pool_alloc(struct cs_pool* pool);
+
+/*!
+ * @brief Gives an object back to the pool it was allocated from.
+ */
+CSTRUCTURES_PUBLIC_API void
+pool_release(struct cs_pool* pool, void* object);
+
+/*!
+ * @return Returns the (rounded up) size of the objects.
+ */
+CSTRUCTURES_PUBLIC_API uint32_t
+pool_object_size(const struct cs_pool* pool);
+
+C_END
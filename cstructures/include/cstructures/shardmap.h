@@ -0,0 +1,153 @@
+#pragma once
+
+#include "cstructures/config.h"
+#include "cstructures/hash.h"
+#include "cstructures/hashmap.h"
+
+/*
+ * A shardmap holds 2^shard_bits independent cs_hashmaps. A key's shard is
+ * selected by the top shard_bits bits of its hash, and the shard's hashmap
+ * places it using the same hash as usual. Every shard has its own lock, so
+ * threads working on different shards never contend, and growing a shard
+ * only rehashes 1/2^shard_bits of the entries.
+ *
+ * The shardmap_insert(), shardmap_find() and shardmap_erase() functions lock
+ * the key's shard. A thread that owns a shard (e.g. thread-per-core
+ * pipelines that partition the keys with shardmap_shard_index()) can use
+ * shardmap_shard() with the hashmap_*_with_hash() functions directly,
+ * without locking.
+ *
+ * The structure is opaque because the locks use C11 atomics.
+ */
+#define SHM_MAX_SHARD_BITS 16
+
+C_BEGIN
+
+struct cs_shardmap;
+
+/*!
+ * @brief Called by shardmap_for_each_shard() for every shard. The shard is
+ * locked during the call.
+ */
+typedef void (*shardmap_shard_func)(struct cs_hashmap* shard, uint32_t shard_index, void* user_data);
+
+/*!
+ * @brief Allocates and initializes a new shardmap.
+ * @param[in] shard_bits The map is split into 2^shard_bits shards. Must not
+ * be larger than SHM_MAX_SHARD_BITS.
+ * See hashmap_create() for details on the other parameters.
+ * @return If successful, returns HM_OK. If allocation fails, HM_OOM is returned.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+shardmap_create(struct cs_shardmap** sm,
+                uint32_t shard_bits,
+                uint32_t key_size,
+                uint32_t value_size);
+
+/*!
+ * @brief Allocates and initializes a new shardmap. The options are passed
+ * to hashmap_init_with_options() for every shard.
+ * @param[in] table_count Initial number of slots of each shard.
+ * @note HM_VARIABLE_KEYS is not supported.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+shardmap_create_with_options(struct cs_shardmap** sm,
+                             uint32_t shard_bits,
+                             uint32_t key_size,
+                             uint32_t value_size,
+                             uint32_t table_count,
+                             hashmap_hash_func hash_func,
+                             uint32_t flags);
+
+/*!
+ * @brief Cleans up all resources and frees the shardmap.
+ * @note No other thread may be using the shardmap.
+ */
+CSTRUCTURES_PRIVATE_API void
+shardmap_free(struct cs_shardmap* sm);
+
+CSTRUCTURES_PRIVATE_API uint32_t
+shardmap_shard_count(const struct cs_shardmap* sm);
+
+/*!
+ * @brief Hashes a key. The hash selects the shard (see
+ * shardmap_shard_index()) and can be passed to the hashmap_*_with_hash()
+ * functions of that shard.
+ */
+CSTRUCTURES_PRIVATE_API cs_hashmap_hash
+shardmap_hash_key(const struct cs_shardmap* sm, const void* key);
+
+/*!
+ * @brief Returns the index of the shard that holds keys with this hash.
+ */
+CSTRUCTURES_PRIVATE_API uint32_t
+shardmap_shard_index(const struct cs_shardmap* sm, cs_hashmap_hash hash);
+
+/*!
+ * @brief Returns the hashmap of a shard. The caller is responsible for
+ * holding the shard's lock, or for being the only thread using the shard.
+ */
+CSTRUCTURES_PRIVATE_API struct cs_hashmap*
+shardmap_shard(struct cs_shardmap* sm, uint32_t shard_index);
+
+CSTRUCTURES_PRIVATE_API void
+shardmap_lock(struct cs_shardmap* sm, uint32_t shard_index);
+
+CSTRUCTURES_PRIVATE_API void
+shardmap_unlock(struct cs_shardmap* sm, uint32_t shard_index);
+
+/*!
+ * @brief Locks a shard and grows it so it can hold the specified number of
+ * elements without rehashing. See hashmap_reserve().
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+shardmap_reserve(struct cs_shardmap* sm,
+                 uint32_t shard_index,
+                 uint32_t element_count);
+
+/*!
+ * @brief Locks the key's shard and inserts a copy of the value. See
+ * hashmap_insert() for the return values.
+ */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+shardmap_insert(struct cs_shardmap* sm, const void* key, const void* value);
+
+/*!
+ * @brief Locks the key's shard and looks the key up.
+ * @param[out] value If the key exists, value_size bytes are copied to this
+ * location. May be NULL.
+ * @return Returns 1 if the key was found, 0 if not.
+ */
+CSTRUCTURES_PRIVATE_API int
+shardmap_find(struct cs_shardmap* sm, const void* key, void* value);
+
+/*!
+ * @brief Locks the key's shard and erases the key.
+ * @param[out] value If the key exists, its value is copied to this location
+ * before it is erased. May be NULL.
+ * @return Returns 1 if the key was erased, 0 if it didn't exist.
+ */
+CSTRUCTURES_PRIVATE_API int
+shardmap_erase(struct cs_shardmap* sm, const void* key, void* value);
+
+/*!
+ * @brief Returns the total number of entries. Each shard is locked while it
+ * is counted.
+ */
+CSTRUCTURES_PRIVATE_API cs_hashmap_size
+shardmap_count(struct cs_shardmap* sm);
+
+/*!
+ * @brief Calls func for every shard with index % worker_count == worker,
+ * with the shard locked. Every one of worker_count threads calls this with
+ * its own worker index to process all shards in parallel. Call it with
+ * worker = 0 and worker_count = 1 to visit every shard from one thread.
+ */
+CSTRUCTURES_PRIVATE_API void
+shardmap_for_each_shard(struct cs_shardmap* sm,
+                        uint32_t worker,
+                        uint32_t worker_count,
+                        shardmap_shard_func func,
+                        void* user_data);
+
+C_END
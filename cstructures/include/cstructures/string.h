@@ -24,6 +24,14 @@ string_create(void);
 CSTRUCTURES_PUBLIC_API void
 string_init(struct cs_string* str);
 
+/*!
+ * @brief Initializes a string whose buffer is allocated through the specified
+ * allocator. See vector_init_with_allocator().
+ */
+CSTRUCTURES_PUBLIC_API void
+string_init_with_allocator(struct cs_string* str,
+                           const struct cs_allocator* allocator);
+
 CSTRUCTURES_PUBLIC_API void
 string_deinit(struct cs_string* str);
 
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "cstructures/config.h"
+#include "cstructures/allocator.h"
 #include <stdint.h>
 
 C_BEGIN
@@ -27,6 +28,7 @@ struct cs_vector
     cs_vec_size capacity;      /* how many elements actually fit into the allocated space */
     cs_vec_size count;         /* number of elements inserted */
     cs_vec_size element_size;  /* how large one element is in bytes */
+    const struct cs_allocator* allocator;  /* where data is allocated from */
 };
 
 /*!
@@ -50,6 +52,16 @@ CSTRUCTURES_PUBLIC_API void
 vector_init(struct cs_vector* vector,
             const cs_vec_size element_size);
 
+/*!
+ * @brief Initializes an existing vector object. The elements are allocated
+ * through the specified allocator instead of memory_default_allocator.
+ * @param[in] allocator Must outlive the vector.
+ */
+CSTRUCTURES_PUBLIC_API void
+vector_init_with_allocator(struct cs_vector* vector,
+                           const cs_vec_size element_size,
+                           const struct cs_allocator* allocator);
+
 CSTRUCTURES_PUBLIC_API void
 vector_deinit(struct cs_vector* vector);
 
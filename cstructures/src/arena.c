@@ -0,0 +1,255 @@
+#include "cstructures/arena.h"
+#include "cstructures/memory.h"
+#include <assert.h>
+#include <string.h>
+
+struct cs_arena_chunk
+{
+    struct cs_arena_chunk* next;
+    uintptr_t size;  /* Usable bytes following the header */
+};
+
+#define CHUNK_DATA(chunk) ((uint8_t*)((chunk) + 1))
+#define ALIGN_UP(x, alignment) (((uintptr_t)(x) + ((alignment) - 1)) & ~((uintptr_t)(alignment) - 1))
+#define IS_POWER_OF_TWO(x) ((x) != 0 && ((x) & ((x) - 1)) == 0)
+
+/*
+ * Allocations made through arena->allocator are preceded by a header of
+ * arena->alignment bytes holding their size, so realloc knows how much to
+ * copy. alignment is at least sizeof(uintptr_t).
+ */
+#define ALLOC_SIZE(arena, p) (*(uintptr_t*)((uint8_t*)(p) - (arena)->alignment))
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Makes a chunk with at least min_size usable bytes the current chunk. The
+ * most recently released chunk is reused if it is large enough.
+ */
+static int
+push_chunk(struct cs_arena* arena, uintptr_t min_size)
+{
+    struct cs_arena_chunk* chunk = arena->free_chunks;
+    if (chunk && chunk->size >= min_size)
+        arena->free_chunks = chunk->next;
+    else
+    {
+        uintptr_t size = arena->chunk_size > min_size ? arena->chunk_size : min_size;
+        chunk = MALLOC(sizeof(struct cs_arena_chunk) + size);
+        if (chunk == NULL)
+            return -1;
+        chunk->size = size;
+    }
+
+    if (arena->chunks == NULL)
+        arena->first = chunk;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->ptr = CHUNK_DATA(chunk);
+    arena->end = CHUNK_DATA(chunk) + chunk->size;
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+free_chunk_list(struct cs_arena_chunk* chunk)
+{
+    while (chunk)
+    {
+        struct cs_arena_chunk* next = chunk->next;
+        FREE(chunk);
+        chunk = next;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+static void*
+allocator_alloc(void* user, uintptr_t size)
+{
+    struct cs_arena* arena = (struct cs_arena*)user;
+    uint8_t* p = arena_alloc(arena, arena->alignment + size);
+    if (p == NULL)
+        return NULL;
+
+    p += arena->alignment;
+    ALLOC_SIZE(arena, p) = size;
+    return p;
+}
+
+/* ------------------------------------------------------------------------- */
+static void*
+allocator_realloc(void* user, void* ptr, uintptr_t new_size)
+{
+    struct cs_arena* arena = (struct cs_arena*)user;
+    uintptr_t old_size;
+    void* new_ptr;
+
+    if (ptr == NULL)
+        return allocator_alloc(user, new_size);
+
+    /* The most recent allocation can grow in place if the chunk has room */
+    old_size = ALLOC_SIZE(arena, ptr);
+    if ((uint8_t*)ptr + old_size == arena->ptr &&
+        new_size <= (uintptr_t)(arena->end - (uint8_t*)ptr))
+    {
+        arena->ptr = (uint8_t*)ptr + new_size;
+        ALLOC_SIZE(arena, ptr) = new_size;
+        return ptr;
+    }
+
+    if (new_size <= old_size)
+    {
+        ALLOC_SIZE(arena, ptr) = new_size;
+        return ptr;
+    }
+
+    new_ptr = allocator_alloc(user, new_size);
+    if (new_ptr == NULL)
+        return NULL;
+    memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+allocator_free(void* user, void* ptr)
+{
+    /* Only the most recent allocation can be given back */
+    struct cs_arena* arena = (struct cs_arena*)user;
+    if ((uint8_t*)ptr + ALLOC_SIZE(arena, ptr) == arena->ptr)
+        arena->ptr = (uint8_t*)ptr - arena->alignment;
+}
+
+/* ------------------------------------------------------------------------- */
+struct cs_arena*
+arena_create(uintptr_t chunk_size, uintptr_t alignment)
+{
+    struct cs_arena* arena = MALLOC(sizeof *arena);
+    if (arena == NULL)
+        return NULL;
+
+    arena_init(arena, chunk_size, alignment);
+    return arena;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+arena_init(struct cs_arena* arena, uintptr_t chunk_size, uintptr_t alignment)
+{
+    assert(arena);
+    assert(alignment == 0 || IS_POWER_OF_TWO(alignment));
+
+    if (chunk_size == 0)
+        chunk_size = ARENA_DEFAULT_CHUNK_SIZE;
+    if (alignment == 0)
+        alignment = ARENA_DEFAULT_ALIGNMENT;
+    if (alignment < sizeof(uintptr_t))
+        alignment = sizeof(uintptr_t);
+
+    arena->allocator.alloc = allocator_alloc;
+    arena->allocator.realloc = allocator_realloc;
+    arena->allocator.free = allocator_free;
+    arena->allocator.user = arena;
+    arena->chunks = NULL;
+    arena->first = NULL;
+    arena->free_chunks = NULL;
+    arena->ptr = NULL;
+    arena->end = NULL;
+    arena->chunk_size = chunk_size;
+    arena->alignment = alignment;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+arena_deinit(struct cs_arena* arena)
+{
+    free_chunk_list(arena->chunks);
+    free_chunk_list(arena->free_chunks);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+arena_free(struct cs_arena* arena)
+{
+    arena_deinit(arena);
+    FREE(arena);
+}
+
+/* ------------------------------------------------------------------------- */
+void*
+arena_alloc(struct cs_arena* arena, uintptr_t size)
+{
+    return arena_alloc_aligned(arena, size, arena->alignment);
+}
+
+/* ------------------------------------------------------------------------- */
+void*
+arena_alloc_aligned(struct cs_arena* arena, uintptr_t size, uintptr_t alignment)
+{
+    uintptr_t p;
+    assert(IS_POWER_OF_TWO(alignment));
+
+    p = ALIGN_UP(arena->ptr, alignment);
+    if (arena->chunks == NULL || p > (uintptr_t)arena->end || size > (uintptr_t)arena->end - p)
+    {
+        /* The remainder of the current chunk is left unused */
+        if (push_chunk(arena, size + alignment - 1) != 0)
+            return NULL;
+        p = ALIGN_UP(arena->ptr, alignment);
+    }
+
+    arena->ptr = (uint8_t*)(p + size);
+    return (void*)p;
+}
+
+/* ------------------------------------------------------------------------- */
+struct cs_arena_mark
+arena_mark(const struct cs_arena* arena)
+{
+    struct cs_arena_mark mark;
+    mark.chunk = arena->chunks;
+    mark.ptr = arena->ptr;
+    return mark;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+arena_rewind(struct cs_arena* arena, struct cs_arena_mark mark)
+{
+    while (arena->chunks != mark.chunk)
+    {
+        struct cs_arena_chunk* chunk = arena->chunks;
+        assert(chunk);
+        arena->chunks = chunk->next;
+        chunk->next = arena->free_chunks;
+        arena->free_chunks = chunk;
+    }
+
+    if (arena->chunks == NULL)
+    {
+        arena->first = NULL;
+        arena->ptr = NULL;
+        arena->end = NULL;
+    }
+    else
+    {
+        arena->ptr = mark.ptr;
+        arena->end = CHUNK_DATA(arena->chunks) + arena->chunks->size;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+void
+arena_reset(struct cs_arena* arena)
+{
+    if (arena->chunks == NULL)
+        return;
+
+    /* Splice the whole list of used chunks onto the free list */
+    arena->first->next = arena->free_chunks;
+    arena->free_chunks = arena->chunks;
+    arena->chunks = NULL;
+    arena->first = NULL;
+    arena->ptr = NULL;
+    arena->end = NULL;
+}
@@ -0,0 +1,68 @@
+#include "benchmark/benchmark.h"
+#include "cstructures/arena.h"
+#include "cstructures/hashmap.h"
+#include "cstructures/vector.h"
+
+using namespace benchmark;
+
+/*
+ * Simulates handling a request: a few short-lived vectors and hashmaps are
+ * built with range(0) elements each and torn down again.
+ */
+#define CONTAINERS_PER_REQUEST 8
+
+static void fill(struct cs_vector* vec, struct cs_hashmap* hm, uint32_t count)
+{
+    for (uint32_t i = 0; i != count; ++i)
+    {
+        vector_push(vec, &i);
+        hashmap_insert(hm, &i, &i);
+    }
+}
+
+static void BM_RequestContainersDefault(State& state)
+{
+    uint32_t count = state.range(0);
+    for (auto _ : state)
+    {
+        struct cs_vector vecs[CONTAINERS_PER_REQUEST];
+        struct cs_hashmap hms[CONTAINERS_PER_REQUEST];
+        for (int i = 0; i != CONTAINERS_PER_REQUEST; ++i)
+        {
+            vector_init(&vecs[i], sizeof(uint32_t));
+            hashmap_init_with_options(&hms[i], sizeof(uint32_t), sizeof(uint32_t), 16, HM_DEFAULT_HASH, 0);
+            fill(&vecs[i], &hms[i], count);
+        }
+        for (int i = 0; i != CONTAINERS_PER_REQUEST; ++i)
+        {
+            vector_deinit(&vecs[i]);
+            hashmap_deinit(&hms[i]);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RequestContainersDefault)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_RequestContainersArena(State& state)
+{
+    uint32_t count = state.range(0);
+    struct cs_arena arena;
+    arena_init(&arena, 0, 0);
+
+    for (auto _ : state)
+    {
+        struct cs_vector vecs[CONTAINERS_PER_REQUEST];
+        struct cs_hashmap hms[CONTAINERS_PER_REQUEST];
+        for (int i = 0; i != CONTAINERS_PER_REQUEST; ++i)
+        {
+            vector_init_with_allocator(&vecs[i], sizeof(uint32_t), &arena.allocator);
+            hashmap_init_with_allocator(&hms[i], sizeof(uint32_t), sizeof(uint32_t), 16, HM_DEFAULT_HASH, 0, &arena.allocator);
+            fill(&vecs[i], &hms[i], count);
+        }
+        arena_reset(&arena);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    arena_deinit(&arena);
+}
+BENCHMARK(BM_RequestContainersArena)->Arg(8)->Arg(64)->Arg(512);
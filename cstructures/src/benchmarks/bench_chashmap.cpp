@@ -0,0 +1,108 @@
+#include "benchmark/benchmark.h"
+#include "cstructures/chashmap.h"
+#include "cstructures/hashmap.h"
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+using namespace benchmark;
+
+/*
+ * Every thread runs a mix of lookups and writes over a shared key space that
+ * is half full. A write inserts the key, or erases it if it already exists,
+ * so the load stays around 50%. range(0) is the percentage of writes.
+ */
+static const uint32_t keySpace = 1 << 16;
+
+static uint32_t xorshift(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int maxThreads()
+{
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+static struct cs_chashmap* chm;
+
+static void BM_CHashmapMixed(State& state)
+{
+    uint32_t writePercent = state.range(0);
+    uint32_t rng = 0x9E3779B9u * (state.thread_index + 1);
+    uint64_t value = 0;
+
+    if (state.thread_index == 0)
+    {
+        chashmap_create(&chm, sizeof(uint32_t), sizeof(uint64_t));
+        for (uint32_t key = 0; key < keySpace; key += 2)
+            chashmap_insert(chm, &key, &value);
+    }
+
+    for (auto _ : state)
+    {
+        uint32_t r = xorshift(&rng);
+        uint32_t key = r % keySpace;
+        if ((r >> 16) % 100 < writePercent)
+        {
+            if (chashmap_insert(chm, &key, &value) == HM_EXISTS)
+                chashmap_erase(chm, &key, NULL);
+        }
+        else
+            DoNotOptimize(chashmap_find(chm, &key, &value));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index == 0)
+        chashmap_free(chm);
+}
+BENCHMARK(BM_CHashmapMixed)
+    ->Arg(10)->Arg(50)
+    ->ThreadRange(1, maxThreads())
+    ->UseRealTime()
+    ;
+
+/* For comparison, a cs_hashmap behind a single mutex */
+static struct cs_hashmap* lockedHm;
+static std::mutex lockedHmMutex;
+
+static void BM_LockedHashmapMixed(State& state)
+{
+    uint32_t writePercent = state.range(0);
+    uint32_t rng = 0x9E3779B9u * (state.thread_index + 1);
+    uint64_t value = 0;
+
+    if (state.thread_index == 0)
+    {
+        hashmap_create(&lockedHm, sizeof(uint32_t), sizeof(uint64_t));
+        for (uint32_t key = 0; key < keySpace; key += 2)
+            hashmap_insert(lockedHm, &key, &value);
+    }
+
+    for (auto _ : state)
+    {
+        uint32_t r = xorshift(&rng);
+        uint32_t key = r % keySpace;
+        std::lock_guard<std::mutex> guard(lockedHmMutex);
+        if ((r >> 16) % 100 < writePercent)
+        {
+            if (hashmap_insert(lockedHm, &key, &value) == HM_EXISTS)
+                hashmap_erase(lockedHm, &key);
+        }
+        else
+            DoNotOptimize(hashmap_find(lockedHm, &key));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index == 0)
+        hashmap_free(lockedHm);
+}
+BENCHMARK(BM_LockedHashmapMixed)
+    ->Arg(10)->Arg(50)
+    ->ThreadRange(1, maxThreads())
+    ->UseRealTime()
+    ;
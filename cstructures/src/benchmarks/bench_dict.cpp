@@ -0,0 +1,95 @@
+#include "benchmark/benchmark.h"
+#include "cstructures/dict.h"
+#include "cstructures/hashmap.h"
+
+using namespace benchmark;
+
+/*
+ * Iterating a map that once held range(0) entries, of which all but
+ * range(0) / range(1) were erased again.
+ */
+static void BM_HashmapIterateAfterErase(State& state)
+{
+    uint32_t entries = state.range(0);
+    uint32_t keep = state.range(1);
+    struct cs_hashmap hm;
+    uint64_t value = 0;
+
+    hashmap_init(&hm, sizeof(uint32_t), sizeof(uint64_t));
+    for (uint32_t key = 0; key != entries; ++key)
+        hashmap_insert(&hm, &key, &value);
+    for (uint32_t key = 0; key != entries; ++key)
+        if (key % keep)
+            hashmap_erase(&hm, &key);
+
+    for (auto _ : state)
+    {
+        uint64_t sum = 0;
+        HASHMAP_FOR_EACH(&hm, uint32_t, uint64_t, key, value)
+            sum += *key;
+        HASHMAP_END_EACH
+        DoNotOptimize(sum);
+    }
+
+    state.SetItemsProcessed(state.iterations() * hashmap_count(&hm));
+    hashmap_deinit(&hm);
+}
+BENCHMARK(BM_HashmapIterateAfterErase)
+    ->Args({1 << 20, 1})->Args({1 << 20, 1000});
+
+static void BM_DictIterateAfterErase(State& state)
+{
+    uint32_t entries = state.range(0);
+    uint32_t keep = state.range(1);
+    struct cs_dict d;
+    uint64_t value = 0;
+
+    dict_init(&d, sizeof(uint32_t), sizeof(uint64_t));
+    for (uint32_t key = 0; key != entries; ++key)
+        dict_insert(&d, &key, &value);
+    for (uint32_t key = 0; key != entries; ++key)
+        if (key % keep)
+            dict_erase(&d, &key);
+
+    for (auto _ : state)
+    {
+        uint64_t sum = 0;
+        DICT_FOR_EACH(&d, uint32_t, uint64_t, key, value)
+            sum += *key;
+        DICT_END_EACH
+        DoNotOptimize(sum);
+    }
+
+    state.SetItemsProcessed(state.iterations() * dict_count(&d));
+    dict_deinit(&d);
+}
+BENCHMARK(BM_DictIterateAfterErase)
+    ->Args({1 << 20, 1})->Args({1 << 20, 1000});
+
+/*
+ * Looking up keys that don't exist in a dict filled up to the point where
+ * the next insert rebuilds the index. Misses probe until an empty index
+ * slot, so this is the worst case of the linear probing.
+ */
+static void BM_DictFindMissAtMaxLoad(State& state)
+{
+    struct cs_dict d;
+    uint64_t value = 0;
+
+    dict_init(&d, sizeof(uint32_t), sizeof(uint64_t));
+    dict_reserve(&d, state.range(0));
+    for (uint32_t key = 0; key != d.entry_capacity; ++key)
+        dict_insert(&d, &key, &value);
+
+    uint32_t key = d.entry_capacity;
+    for (auto _ : state)
+    {
+        DoNotOptimize(dict_find(&d, &key));
+        if (++key == 2 * d.entry_capacity)
+            key = d.entry_capacity;
+    }
+
+    state.counters["load"] = (double)dict_count(&d) / d.table_count;
+    dict_deinit(&d);
+}
+BENCHMARK(BM_DictFindMissAtMaxLoad)->Arg(1 << 12)->Arg(1 << 20);
@@ -0,0 +1,112 @@
+#include "benchmark/benchmark.h"
+#include "cstructures/cpu.h"
+#include "cstructures/hash.h"
+#include <string.h>
+#include <vector>
+
+using namespace benchmark;
+
+/*
+ * Hashes a key of range(0) bytes, starting at an odd offset so the reads are
+ * unaligned. Keys are short enough for the latency of one hash to matter, so
+ * every hash depends on the previous one.
+ */
+static void hashLatency(State& state, hash32_func hash)
+{
+    uintptr_t len = state.range(0);
+    std::vector<uint8_t> buf(len + 1);
+    for (size_t i = 0; i != buf.size(); ++i)
+        buf[i] = (uint8_t)(i * 131);
+
+    cs_hash32 h = 0;
+    for (auto _ : state)
+    {
+        buf[1] = (uint8_t)h;
+        h = hash(buf.data() + 1, len);
+    }
+    DoNotOptimize(h);
+
+    state.SetBytesProcessed(state.iterations() * len);
+}
+
+template <hash32_func hash>
+static void BM_Hash(State& state)
+{
+    hashLatency(state, hash);
+}
+
+/* hash32_crc32c with the portable slice-by-8 kernel */
+static void BM_HashCrc32cPortable(State& state)
+{
+    cpu_disable_features(CPU_SSE42);
+    hash_init();
+    hashLatency(state, hash32_crc32c);
+    cpu_disable_features(0);
+    hash_init();
+}
+
+static void keyLengths(internal::Benchmark* b)
+{
+    for (int len = 1; len <= 4096; len *= 2)
+    {
+        b->Arg(len);
+        if (len >= 4 && len <= 64)
+            b->Arg(len + len / 2);
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_Hash, hash32_jenkins_oaat)->Apply(keyLengths);
+BENCHMARK_TEMPLATE(BM_Hash, hash32_wyhash)->Apply(keyLengths);
+BENCHMARK_TEMPLATE(BM_Hash, hash32_crc32c)->Apply(keyLengths);
+BENCHMARK(BM_HashCrc32cPortable)->Apply(keyLengths);
+
+/*
+ * A key made of a tenant id, a string of range(0) bytes and a timestamp,
+ * hashed by copying the fields into a buffer vs. streaming them.
+ */
+struct CompositeKey
+{
+    uint32_t tenant;
+    const char* name;
+    uint32_t nameLen;
+    uint64_t timestamp;
+};
+
+static CompositeKey makeCompositeKey(State& state, std::vector<char>& name)
+{
+    name.assign(state.range(0), 'x');
+    return CompositeKey{7, name.data(), (uint32_t)name.size(), 1234567};
+}
+
+static void BM_HashCompositeCopy(State& state)
+{
+    std::vector<char> name;
+    CompositeKey key = makeCompositeKey(state, name);
+    for (auto _ : state)
+    {
+        char buf[4 + 256 + 8];
+        memcpy(buf, &key.tenant, 4);
+        memcpy(buf + 4, key.name, key.nameLen);
+        memcpy(buf + 4 + key.nameLen, &key.timestamp, 8);
+        DoNotOptimize(hash32_wyhash(buf, 4 + key.nameLen + 8));
+        key.tenant++;
+    }
+}
+BENCHMARK(BM_HashCompositeCopy)->Arg(8)->Arg(32)->Arg(128);
+
+static void BM_HashCompositeStream(State& state)
+{
+    std::vector<char> name;
+    CompositeKey key = makeCompositeKey(state, name);
+    for (auto _ : state)
+    {
+        struct cs_wyhash_state st;
+        hash32_wyhash_init(&st);
+        hash32_wyhash_update(&st, &key.tenant, 4);
+        hash32_wyhash_update(&st, key.name, key.nameLen);
+        hash32_wyhash_update(&st, &key.timestamp, 8);
+        DoNotOptimize(hash32_wyhash_final(&st));
+        key.tenant++;
+    }
+}
+BENCHMARK(BM_HashCompositeStream)->Arg(8)->Arg(32)->Arg(128);
@@ -1,6 +1,9 @@
 #include "benchmark/benchmark.h"
 #include "cstructures/hashmap.h"
+#include "cstructures/hashmap_typed.h"
 #include "cstructures/hash.h"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <random>
 #include <unordered_map>
@@ -30,7 +33,7 @@ static void BM_HashmapCreation(State& state)
 
     for (auto _ : state)
     {
-        hashmap_t hm;
+        struct cs_hashmap hm;
         hashmap_init(&hm, key_size, value_size);
         DoNotOptimize(hm.storage);
         hashmap_deinit(&hm);
@@ -55,7 +58,7 @@ static void BM_HashmapInsert(State& state)
 
     for (auto _ : state)
     {
-        hashmap_t hm;
+        struct cs_hashmap hm;
         hashmap_init(&hm, keySize, valueSize);
         DoNotOptimize(hm.storage);
         for (int i = 0; i != state.range(0); ++i)
@@ -66,3 +69,507 @@ static void BM_HashmapInsert(State& state)
 }
 
 BENCHMARK(BM_HashmapInsert)->RangeMultiplier(2)->Ranges({{1<<0, 1<<16}, {1<<0, 1<<10}, {1<<0, 1<<16}});
+
+static void fillTable(struct cs_hashmap* hm, std::vector<std::vector<char>>& keys, int count, int keySize)
+{
+    keys.assign(count, std::vector<char>(keySize));
+    for (auto& key : keys)
+    {
+        fillRandom(key.data(), keySize);
+        hashmap_insert(hm, key.data(), NULL);
+    }
+}
+
+static void loadFactorArguments(internal::Benchmark* b)
+{
+    for (int keySize : {8, 64})
+        for (int loadFactor : {500, 625, 750, 875})
+            b->Args({loadFactor, keySize});
+}
+
+/*
+ * Lookups at a fixed load factor. The first argument is the load factor in
+ * per-mille, the second the key size. The table is pre-sized so that inserting
+ * the keys never triggers a rehash.
+ */
+static void BM_HashmapFindHit(State& state)
+{
+    const uint32_t tableCount = 1 << 16;
+    int keySize = state.range(1);
+    std::vector<std::vector<char>> keys;
+    struct cs_hashmap hm;
+    hashmap_init_with_options(&hm, keySize, sizeof(uint32_t), tableCount, HM_DEFAULT_HASH, 0);
+    fillTable(&hm, keys, tableCount * state.range(0) / 1000, keySize);
+
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        DoNotOptimize(hashmap_find(&hm, keys[i].data()));
+        if (++i == keys.size())
+            i = 0;
+    }
+
+    state.counters["load"] = (double)hashmap_count(&hm) / hm.table_count;
+    hashmap_deinit(&hm);
+}
+BENCHMARK(BM_HashmapFindHit)
+    ->Apply(loadFactorArguments);
+
+static void BM_HashmapFindMiss(State& state)
+{
+    const uint32_t tableCount = 1 << 16;
+    int keySize = state.range(1);
+    std::vector<std::vector<char>> keys;
+    std::vector<std::vector<char>> missingKeys;
+    struct cs_hashmap hm;
+    hashmap_init_with_options(&hm, keySize, sizeof(uint32_t), tableCount, HM_DEFAULT_HASH, 0);
+    fillTable(&hm, keys, tableCount * state.range(0) / 1000, keySize);
+    missingKeys.assign(keys.size(), std::vector<char>(keySize));
+    for (auto& key : missingKeys)
+        fillRandom(key.data(), keySize);
+
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        DoNotOptimize(hashmap_find(&hm, missingKeys[i].data()));
+        if (++i == missingKeys.size())
+            i = 0;
+    }
+
+    state.counters["load"] = (double)hashmap_count(&hm) / hm.table_count;
+    hashmap_deinit(&hm);
+}
+BENCHMARK(BM_HashmapFindMiss)
+    ->Apply(loadFactorArguments);
+
+/*
+ * Bulk loading 8 byte keys. The second argument selects the method:
+ * 0: hashmap_insert() loop, 1: hashmap_reserve() + hashmap_insert() loop,
+ * 2: hashmap_insert_batch()
+ */
+static void BM_HashmapBulkLoad(State& state)
+{
+    int count = state.range(0);
+    int method = state.range(1);
+    std::vector<uint64_t> keys(count);
+    std::vector<uint32_t> values(count);
+    for (int i = 0; i != count; ++i)
+    {
+        fillRandom((char*)&keys[i], sizeof(uint64_t));
+        values[i] = i;
+    }
+
+    for (auto _ : state)
+    {
+        struct cs_hashmap hm;
+        hashmap_init(&hm, sizeof(uint64_t), sizeof(uint32_t));
+        switch (method)
+        {
+            case 0:
+                for (int i = 0; i != count; ++i)
+                    hashmap_insert(&hm, &keys[i], &values[i]);
+                break;
+            case 1:
+                hashmap_reserve(&hm, count);
+                for (int i = 0; i != count; ++i)
+                    hashmap_insert(&hm, &keys[i], &values[i]);
+                break;
+            case 2:
+                hashmap_insert_batch(&hm, keys.data(), values.data(), count, NULL);
+                break;
+        }
+        ClobberMemory();
+        hashmap_deinit(&hm);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_HashmapBulkLoad)
+    ->Args({1<<16, 0})->Args({1<<16, 1})->Args({1<<16, 2})
+    ->Args({1<<22, 0})->Args({1<<22, 1})->Args({1<<22, 2})
+    ->Unit(kMillisecond);
+
+/*
+ * Time taken by a single growth rehash of a table holding the given number
+ * of 64 byte keys.
+ */
+static void BM_HashmapGrow(State& state)
+{
+    int count = state.range(0);
+    std::vector<char> keys((size_t)count * 64);
+    fillRandom(keys.data(), keys.size());
+
+    for (auto _ : state)
+    {
+        struct cs_hashmap hm;
+        state.PauseTiming();
+        hashmap_init(&hm, 64, sizeof(uint32_t));
+        hashmap_insert_batch(&hm, keys.data(), NULL, count, NULL);
+        state.ResumeTiming();
+
+        hashmap_reserve(&hm, hm.table_count);
+        ClobberMemory();
+
+        state.PauseTiming();
+        hashmap_deinit(&hm);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_HashmapGrow)->Arg(1<<16)->Arg(1<<20)->Unit(kMillisecond);
+
+/*
+ * Latency distribution of single insertions while growing a table from
+ * scratch. The argument is the flags passed to hashmap_init_with_options().
+ */
+static void BM_HashmapInsertLatency(State& state)
+{
+    const int count = 1 << 22;
+    std::vector<uint64_t> keys(count);
+    std::vector<double> latencies(count);
+    for (auto& key : keys)
+        fillRandom((char*)&key, sizeof(key));
+
+    for (auto _ : state)
+    {
+        struct cs_hashmap hm;
+        hashmap_init_with_options(&hm, sizeof(uint64_t), sizeof(uint32_t),
+                                  HM_DEFAULT_TABLE_COUNT, HM_DEFAULT_HASH, state.range(0));
+        for (int i = 0; i != count; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            hashmap_insert(&hm, &keys[i], &i);
+            auto end = std::chrono::steady_clock::now();
+            latencies[i] = std::chrono::duration<double, std::nano>(end - start).count();
+        }
+        hashmap_deinit(&hm);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    state.counters["p50_ns"] = latencies[count / 2];
+    state.counters["p99_ns"] = latencies[count - count / 100];
+    state.counters["p999_ns"] = latencies[count - count / 1000];
+    state.counters["max_ns"] = latencies[count - 1];
+}
+BENCHMARK(BM_HashmapInsertLatency)
+    ->Arg(0)->Arg(HM_INCREMENTAL_REHASH)
+    ->Iterations(1)->Unit(kMillisecond);
+
+/*
+ * Insert/erase cycles at a constant size of 48Ki entries, followed by a miss
+ * lookup. With tombstones, misses get slower the longer the churn runs. The
+ * argument is the flags passed to hashmap_init_with_options().
+ */
+static void BM_HashmapChurn(State& state)
+{
+    const uint64_t size = 48 * 1024;
+    struct cs_hashmap hm;
+    hashmap_init_with_options(&hm, sizeof(uint64_t), sizeof(uint32_t),
+                              1 << 16, HM_DEFAULT_HASH, state.range(0));
+    uint64_t next = 0;
+    uint32_t value = 0;
+    for (; next != size; ++next)
+        hashmap_insert(&hm, &next, &value);
+
+    for (auto _ : state)
+    {
+        uint64_t oldest = next - size;
+        uint64_t missing = ~next;
+        hashmap_insert(&hm, &next, &value);
+        hashmap_erase(&hm, &oldest);
+        DoNotOptimize(hashmap_find(&hm, &missing));
+        ++next;
+    }
+
+    state.counters["table_count"] = hm.table_count;
+    hashmap_deinit(&hm);
+}
+BENCHMARK(BM_HashmapChurn)
+    ->Arg(0)->Arg(HM_ROBIN_HOOD)
+    ->Iterations(500000);
+
+/*
+ * Counting occurrences of 2^20 keys drawn from a range of the given size.
+ * Method 0 looks up each key and inserts it on a miss, method 1 uses
+ * hashmap_find_or_emplace().
+ */
+static void BM_HashmapCount(State& state)
+{
+    int method = state.range(0);
+    std::vector<uint32_t> keys(1 << 20);
+    std::uniform_int_distribution<uint32_t> dist(0, state.range(1) - 1);
+    for (auto& key : keys)
+        key = dist(rng);
+
+    for (auto _ : state)
+    {
+        struct cs_hashmap hm;
+        hashmap_init_with_options(&hm, sizeof(uint32_t), sizeof(uint32_t), 128, HM_DEFAULT_HASH, 0);
+        for (uint32_t key : keys)
+        {
+            uint32_t* count;
+            if (method == 0)
+            {
+                count = (uint32_t*)hashmap_find(&hm, &key);
+                if (count)
+                    ++*count;
+                else
+                {
+                    uint32_t one = 1;
+                    hashmap_insert(&hm, &key, &one);
+                }
+            }
+            else
+            {
+                if (hashmap_find_or_emplace(&hm, &key, (void**)&count) == HM_OK)
+                    *count = 1;
+                else
+                    ++*count;
+            }
+        }
+        DoNotOptimize(hm.storage);
+        hashmap_deinit(&hm);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_HashmapCount)
+    ->Args({0, 1<<16})->Args({1, 1<<16})
+    ->Args({0, 1<<22})->Args({1, 1<<22})
+    ->Unit(kMillisecond);
+
+/*
+ * Looking up many keys in a table of the given size. With 2^24 entries the
+ * table is several hundred MB, far beyond the last level cache, so nearly
+ * every lookup misses. Method 0 calls hashmap_find() in a loop, method 1 uses
+ * hashmap_find_many().
+ */
+static void BM_HashmapFindMany(State& state)
+{
+    uint32_t entries = state.range(0);
+    int method = state.range(1);
+    std::vector<uint64_t> lookups(1 << 20);
+    std::vector<void*> values(lookups.size());
+    std::uniform_int_distribution<uint64_t> dist(0, entries - 1);
+
+    struct cs_hashmap hm;
+    hashmap_init_with_options(&hm, sizeof(uint64_t), sizeof(uint64_t), entries, HM_DEFAULT_HASH, 0);
+    for (uint64_t i = 0; i != entries; ++i)
+        hashmap_insert(&hm, &i, &i);
+    for (auto& key : lookups)
+        key = dist(rng);
+
+    for (auto _ : state)
+    {
+        if (method == 0)
+        {
+            for (size_t i = 0; i != lookups.size(); ++i)
+                values[i] = hashmap_find(&hm, &lookups[i]);
+        }
+        else
+        {
+            hashmap_find_many(&hm, lookups.data(), lookups.size(), values.data());
+        }
+        DoNotOptimize(values.data());
+        ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * lookups.size());
+
+    hashmap_deinit(&hm);
+}
+BENCHMARK(BM_HashmapFindMany)
+    ->Args({1<<16, 0})->Args({1<<16, 1})
+    ->Args({1<<24, 0})->Args({1<<24, 1})
+    ->Unit(kMillisecond);
+
+/*
+ * Generic versus specialized (hashmap_typed.h) maps with 4 and 8 byte keys.
+ * Both use the same cheap integer hash, the generic map calls it through a
+ * function pointer.
+ */
+static cs_hashmap_hash mixKey(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return (cs_hashmap_hash)key;
+}
+static cs_hashmap_hash mixKeyU32(uint32_t key) { return mixKey(key); }
+static cs_hashmap_hash mixKeyGeneric(const void* key, uintptr_t len)
+{
+    uint64_t k = 0;
+    memcpy(&k, key, len);
+    return mixKey(k);
+}
+#define keysEqual(a, b) ((a) == (b))
+CS_HASHMAP_TYPED(bench_u32, uint32_t, uint32_t, mixKeyU32, keysEqual)
+CS_HASHMAP_TYPED(bench_u64, uint64_t, void*, mixKey, keysEqual)
+
+template <typename K, typename V>
+struct TypedMap;
+template <>
+struct TypedMap<uint32_t, uint32_t>
+{
+    static enum cs_hashmap_status init(struct cs_hashmap* hm) { return bench_u32_init(hm); }
+    static enum cs_hashmap_status insert(struct cs_hashmap* hm, uint32_t k, uint32_t v) { return bench_u32_insert(hm, k, v); }
+    static uint32_t* find(struct cs_hashmap* hm, uint32_t k) { return bench_u32_find(hm, k); }
+};
+template <>
+struct TypedMap<uint64_t, void*>
+{
+    static enum cs_hashmap_status init(struct cs_hashmap* hm) { return bench_u64_init(hm); }
+    static enum cs_hashmap_status insert(struct cs_hashmap* hm, uint64_t k, void* v) { return bench_u64_insert(hm, k, v); }
+    static void** find(struct cs_hashmap* hm, uint64_t k) { return bench_u64_find(hm, k); }
+};
+
+/* Method 0 is the generic map, method 1 the specialized map */
+template <typename K, typename V>
+static void BM_HashmapTypedInsert(State& state)
+{
+    int method = state.range(0);
+    std::vector<K> keys(1 << 16);
+    for (size_t i = 0; i != keys.size(); ++i)
+        keys[i] = (K)(i * 7919);
+
+    for (auto _ : state)
+    {
+        struct cs_hashmap hm;
+        V value = V();
+        if (method == 0)
+        {
+            hashmap_init_with_options(&hm, sizeof(K), sizeof(V), HM_DEFAULT_TABLE_COUNT, mixKeyGeneric, 0);
+            for (K key : keys)
+                hashmap_insert(&hm, &key, &value);
+        }
+        else
+        {
+            TypedMap<K, V>::init(&hm);
+            for (K key : keys)
+                TypedMap<K, V>::insert(&hm, key, value);
+        }
+        DoNotOptimize(hm.storage);
+        hashmap_deinit(&hm);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK_TEMPLATE(BM_HashmapTypedInsert, uint32_t, uint32_t)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_HashmapTypedInsert, uint64_t, void*)->Arg(0)->Arg(1);
+
+template <typename K, typename V>
+static void BM_HashmapTypedFind(State& state)
+{
+    int method = state.range(0);
+    std::vector<K> keys(1 << 16);
+    struct cs_hashmap hm;
+    V value = V();
+    TypedMap<K, V>::init(&hm);
+    for (size_t i = 0; i != keys.size(); ++i)
+    {
+        keys[i] = (K)(i * 7919);
+        TypedMap<K, V>::insert(&hm, keys[i], value);
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);
+
+    for (auto _ : state)
+    {
+        if (method == 0)
+        {
+            for (K key : keys)
+                DoNotOptimize(hashmap_find(&hm, &key));
+        }
+        else
+        {
+            for (K key : keys)
+                DoNotOptimize(TypedMap<K, V>::find(&hm, key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+
+    hashmap_deinit(&hm);
+}
+BENCHMARK_TEMPLATE(BM_HashmapTypedFind, uint32_t, uint32_t)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_HashmapTypedFind, uint64_t, void*)->Arg(0)->Arg(1);
+
+/*
+ * Time until the first lookup: rebuilding a map of range(0) keys from
+ * scratch vs. mapping a map that was saved with hashmap_save().
+ */
+static void BM_HashmapStartupRebuild(State& state)
+{
+    uint32_t count = state.range(0);
+    for (auto _ : state)
+    {
+        struct cs_hashmap hm;
+        hashmap_init(&hm, sizeof(uint32_t), sizeof(uint32_t));
+        for (uint32_t i = 0; i != count; ++i)
+            hashmap_insert(&hm, &i, &i);
+        uint32_t key = count / 2;
+        DoNotOptimize(hashmap_find(&hm, &key));
+        hashmap_deinit(&hm);
+    }
+}
+BENCHMARK(BM_HashmapStartupRebuild)->Arg(1 << 16)->Arg(1 << 20)->Unit(kMicrosecond);
+
+static void BM_HashmapStartupMmap(State& state)
+{
+    const char* path = "bench_hashmap_mmap.bin";
+    uint32_t count = state.range(0);
+    struct cs_hashmap hm;
+    hashmap_init(&hm, sizeof(uint32_t), sizeof(uint32_t));
+    for (uint32_t i = 0; i != count; ++i)
+        hashmap_insert(&hm, &i, &i);
+    FILE* fp = fopen(path, "wb");
+    hashmap_save(&hm, fileno(fp));
+    fclose(fp);
+    hashmap_deinit(&hm);
+
+    for (auto _ : state)
+    {
+        hashmap_open_mmap(&hm, path);
+        uint32_t key = count / 2;
+        DoNotOptimize(hashmap_find(&hm, &key));
+        hashmap_deinit(&hm);
+    }
+
+    remove(path);
+}
+BENCHMARK(BM_HashmapStartupMmap)->Arg(1 << 16)->Arg(1 << 20)->Unit(kMicrosecond);
+
+/*
+ * Pointer keys, as in the allocation report of memory.c, hashed with each of
+ * the pointer hashes. Heap pointers share their low (alignment) and high
+ * bits, which hash32_ptr and hash32_aligned_ptr don't mix into the control
+ * tags. Stats builds report the probes and the tag collisions per insertion.
+ */
+#if !defined(CSTRUCTURES_HASHMAP_64BIT)
+template <hash32_func hash>
+static void BM_HashmapPointerKeys(State& state)
+{
+    std::vector<void*> ptrs;
+    for (int i = 0; i != state.range(0); ++i)
+        ptrs.push_back(malloc(16 + (i % 5) * 16));
+
+    for (auto _ : state)
+    {
+        struct cs_hashmap hm;
+        hashmap_init_with_options(&hm, sizeof(void*), sizeof(uint32_t), 16, hash, 0);
+        for (void*& p : ptrs)
+        {
+            uint32_t value = 0;
+            hashmap_insert(&hm, &p, &value);
+        }
+        for (void*& p : ptrs)
+            DoNotOptimize(hashmap_find(&hm, &p));
+#if defined(CSTRUCTURES_HASHMAP_STATS)
+        state.counters["probes"] = (double)hm.stats.total_insertion_probes / ptrs.size();
+        state.counters["tag_collisions"] = (double)hm.stats.total_tag_collisions / ptrs.size();
+#endif
+        hashmap_deinit(&hm);
+    }
+
+    for (void* p : ptrs)
+        free(p);
+    state.SetItemsProcessed(state.iterations() * ptrs.size());
+}
+BENCHMARK_TEMPLATE(BM_HashmapPointerKeys, hash32_ptr)->Arg(1 << 16)->Arg(1 << 20)->Unit(kMillisecond);
+BENCHMARK_TEMPLATE(BM_HashmapPointerKeys, hash32_aligned_ptr)->Arg(1 << 16)->Arg(1 << 20)->Unit(kMillisecond);
+BENCHMARK_TEMPLATE(BM_HashmapPointerKeys, hash32_mixed_ptr)->Arg(1 << 16)->Arg(1 << 20)->Unit(kMillisecond);
+#endif
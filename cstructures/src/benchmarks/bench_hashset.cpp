@@ -0,0 +1,101 @@
+#include "benchmark/benchmark.h"
+#include "cstructures/hashmap.h"
+#include "cstructures/hashset.h"
+
+using namespace benchmark;
+
+/*
+ * Membership tests on range(0) 8 byte IDs, half of the lookups miss. The
+ * "bytes_per_key" counter is the size of the table divided by the number of
+ * keys.
+ */
+static uint64_t id(uint64_t i) { return i * 0x9E3779B97F4A7C15ull; }
+
+static void BM_HashmapContains(State& state)
+{
+    uint64_t count = state.range(0);
+    struct cs_hashmap hm;
+
+    hashmap_init_with_options(&hm, sizeof(uint64_t), 0, 0, HM_DEFAULT_HASH, 0);
+    hashmap_reserve(&hm, (uint32_t)count);
+    for (uint64_t i = 0; i != count; ++i)
+    {
+        uint64_t key = id(i);
+        hashmap_insert(&hm, &key, NULL);
+    }
+
+    uint64_t i = 0;
+    for (auto _ : state)
+    {
+        uint64_t key = id(i++ % (count * 2));
+        DoNotOptimize(hashmap_find(&hm, &key));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["bytes_per_key"] =
+        (double)hm.table_count * (1 + sizeof(cs_hashmap_hash) + sizeof(uint64_t)) / count;
+    hashmap_deinit(&hm);
+}
+BENCHMARK(BM_HashmapContains)->Arg(1 << 16)->Arg(1 << 22);
+
+static void BM_HashsetContains(State& state)
+{
+    uint64_t count = state.range(0);
+    struct cs_hashset hs;
+
+    hashset_init(&hs, sizeof(uint64_t));
+    hashset_reserve(&hs, (uint32_t)count);
+    for (uint64_t i = 0; i != count; ++i)
+    {
+        uint64_t key = id(i);
+        hashset_insert(&hs, &key);
+    }
+
+    uint64_t i = 0;
+    for (auto _ : state)
+    {
+        uint64_t key = id(i++ % (count * 2));
+        DoNotOptimize(hashset_contains(&hs, &key));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["bytes_per_key"] =
+        (double)hs.table_count * (1 + sizeof(uint64_t)) / count;
+    hashset_deinit(&hs);
+}
+BENCHMARK(BM_HashsetContains)->Arg(1 << 16)->Arg(1 << 22);
+
+static void BM_HashsetUnion(State& state)
+{
+    uint64_t count = state.range(0);
+    struct cs_hashset a, b;
+
+    hashset_init(&b, sizeof(uint64_t));
+    for (uint64_t i = 0; i != count; ++i)
+    {
+        uint64_t key = id(i * 2);
+        hashset_insert(&b, &key);
+    }
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        hashset_init(&a, sizeof(uint64_t));
+        for (uint64_t i = 0; i != count; ++i)
+        {
+            uint64_t key = id(i * 3);
+            hashset_insert(&a, &key);
+        }
+        state.ResumeTiming();
+
+        hashset_union(&a, &b);
+
+        state.PauseTiming();
+        hashset_deinit(&a);
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * count);
+    hashset_deinit(&b);
+}
+BENCHMARK(BM_HashsetUnion)->Arg(1 << 16)->Arg(1 << 20);
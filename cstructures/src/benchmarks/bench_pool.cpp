@@ -0,0 +1,67 @@
+#include "benchmark/benchmark.h"
+#include "cstructures/pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+using namespace benchmark;
+
+/*
+ * Every thread allocates range(0) objects of 64 bytes and frees them again,
+ * in the reverse order.
+ */
+#define OBJECT_SIZE 64
+
+/* At least 4 threads, so contention shows up even on small machines */
+static int maxThreads()
+{
+    return std::max(4, (int)std::thread::hardware_concurrency());
+}
+
+static void BM_MallocAllocFree(State& state)
+{
+    int batch = state.range(0);
+    void* objects[256];
+
+    for (auto _ : state)
+    {
+        for (int i = 0; i != batch; ++i)
+            objects[i] = malloc(OBJECT_SIZE);
+        for (int i = batch; i--;)
+            free(objects[i]);
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_MallocAllocFree)
+    ->Arg(16)->Arg(256)
+    ->ThreadRange(1, maxThreads())
+    ->UseRealTime();
+
+static struct cs_pool* pool;
+
+static void BM_PoolAllocFree(State& state)
+{
+    int batch = state.range(0);
+    void* objects[256];
+
+    if (state.thread_index == 0)
+        pool = pool_create_with_options(OBJECT_SIZE, 0, state.range(1));
+
+    for (auto _ : state)
+    {
+        for (int i = 0; i != batch; ++i)
+            objects[i] = pool_alloc(pool);
+        for (int i = batch; i--;)
+            pool_release(pool, objects[i]);
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch);
+    if (state.thread_index == 0)
+        pool_free(pool);
+}
+BENCHMARK(BM_PoolAllocFree)
+    ->Args({16, 0})->Args({256, 0})
+    ->Args({16, POOL_DEFAULT_CACHE_SIZE})->Args({256, POOL_DEFAULT_CACHE_SIZE})
+    ->ThreadRange(1, maxThreads())
+    ->UseRealTime();
@@ -0,0 +1,65 @@
+#include "benchmark/benchmark.h"
+#include "cstructures/shardmap.h"
+#include <algorithm>
+#include <thread>
+
+using namespace benchmark;
+
+/*
+ * Same workload as bench_chashmap.cpp: a half full key space, range(0) is
+ * the percentage of writes, range(1) is the number of shard bits.
+ */
+static const uint32_t keySpace = 1 << 16;
+
+static uint32_t xorshift(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int maxThreads()
+{
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+static struct cs_shardmap* sm;
+
+static void BM_ShardmapMixed(State& state)
+{
+    uint32_t writePercent = state.range(0);
+    uint32_t rng = 0x9E3779B9u * (state.thread_index + 1);
+    uint64_t value = 0;
+
+    if (state.thread_index == 0)
+    {
+        shardmap_create_with_options(&sm, state.range(1), sizeof(uint32_t), sizeof(uint64_t),
+                                     HM_DEFAULT_TABLE_COUNT, HM_DEFAULT_HASH, 0);
+        for (uint32_t key = 0; key < keySpace; key += 2)
+            shardmap_insert(sm, &key, &value);
+    }
+
+    for (auto _ : state)
+    {
+        uint32_t r = xorshift(&rng);
+        uint32_t key = r % keySpace;
+        if ((r >> 16) % 100 < writePercent)
+        {
+            if (shardmap_insert(sm, &key, &value) == HM_EXISTS)
+                shardmap_erase(sm, &key, NULL);
+        }
+        else
+            DoNotOptimize(shardmap_find(sm, &key, &value));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index == 0)
+        shardmap_free(sm);
+}
+BENCHMARK(BM_ShardmapMixed)
+    ->Args({10, 0})->Args({10, 6})->Args({50, 0})->Args({50, 6})
+    ->ThreadRange(1, maxThreads())
+    ->UseRealTime()
+    ;
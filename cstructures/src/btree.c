@@ -17,7 +17,7 @@ btree_realloc(struct cs_btree* btree, cs_btree_size new_capacity)
      */
     if (!btree->data)
     {
-        btree->data = MALLOC(new_capacity * BTREE_KV_SIZE(btree));
+        btree->data = ALLOCATOR_MALLOC(btree->allocator, new_capacity * BTREE_KV_SIZE(btree));
         if (!btree->data)
             return BTREE_OOM;
         btree->capacity = new_capacity;
@@ -30,7 +30,7 @@ btree_realloc(struct cs_btree* btree, cs_btree_size new_capacity)
      */
     if (new_capacity >= btree->capacity)
     {
-        void* new_data = REALLOC(btree->data, new_capacity * BTREE_KV_SIZE(btree));
+        void* new_data = ALLOCATOR_REALLOC(btree->allocator, btree->data, new_capacity * BTREE_KV_SIZE(btree));
         if (!new_data)
             return BTREE_OOM;
         btree->data = new_data;
@@ -73,7 +73,7 @@ btree_realloc(struct cs_btree* btree, cs_btree_size new_capacity)
      */
     if (new_capacity < btree->capacity)
     {
-        void* new_data = REALLOC(btree->data, new_capacity * BTREE_KV_SIZE(btree));
+        void* new_data = ALLOCATOR_REALLOC(btree->allocator, btree->data, new_capacity * BTREE_KV_SIZE(btree));
         if (new_data)
             btree->data = new_data;
         else
@@ -105,12 +105,23 @@ btree_create(struct cs_btree** btree, uint32_t value_size)
 /* ------------------------------------------------------------------------- */
 void
 btree_init(struct cs_btree* btree, uint32_t value_size)
+{
+    btree_init_with_allocator(btree, value_size, &memory_default_allocator);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+btree_init_with_allocator(struct cs_btree* btree,
+                          uint32_t value_size,
+                          const struct cs_allocator* allocator)
 {
     assert(btree);
+    assert(allocator);
     btree->data = NULL;
     btree_count(btree) = 0;
     btree->capacity = 0;
     btree->value_size = value_size;
+    btree->allocator = allocator;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -476,7 +487,7 @@ btree_compact(struct cs_btree* btree)
 
     if (btree_count(btree) == 0)
     {
-        XFREE(btree->data);
+        ALLOCATOR_XFREE(btree->allocator, btree->data);
         btree->data = NULL;
         btree->capacity = 0;
     }
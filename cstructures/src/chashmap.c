@@ -0,0 +1,645 @@
+#include "cstructures/chashmap.h"
+#include "cstructures/hashmap_group.h"
+#include "cstructures/memory.h"
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   define YIELD() SwitchToThread()
+#else
+#   include <sched.h>
+#   define YIELD() sched_yield()
+#endif
+
+#if defined(CS_HM_USE_SSE2)
+#   define CPU_RELAX() _mm_pause()
+#else
+#   define CPU_RELAX()
+#endif
+
+#define CHM_READER_SLOTS   64
+#define CHM_MIGRATE_CHUNK  8   /* Groups a migrating thread claims at once */
+#define CHM_CACHE_LINE     64
+
+/* A tag that has been claimed by a writer but whose slot isn't filled in yet */
+#define CHM_CTRL_BUSY ((uint8_t)0xFF)
+
+/*
+ * Tables are allocated in one block: the chm_table header, followed by the
+ * same layout cs_hashmap uses:
+ *   [ctrl tags]           1 byte per slot
+ *   [hash | key] pairs    (sizeof(cs_hash32) + key_size) per slot
+ *   [values]              value_size per slot
+ */
+#define STORAGE(t)    ((uint8_t*)((t) + 1))
+#define CTRL(t, pos)  (((atomic_uchar*)STORAGE(t))[pos])
+#define SLOT(t, pos)  (*(cs_hash32*)(STORAGE(t) + (t)->table_count + (sizeof(cs_hash32) + (t)->key_size) * (pos)))
+#define KEY(t, pos)   ((void*)(STORAGE(t) + (t)->table_count + (sizeof(cs_hash32) + (t)->key_size) * (pos) + sizeof(cs_hash32)))
+#define VALUE(t, pos) ((void*)(STORAGE(t) + (1 + sizeof(cs_hash32) + (t)->key_size) * (t)->table_count + (t)->value_size * (pos)))
+
+#define GROUP_COUNT(t) ((t)->table_count / HM_GROUP_SIZE)
+#define GROUP_MASK(t)  (GROUP_COUNT(t) - 1)
+#define H2(hash) ((uint8_t)((hash) & 0x7F))
+
+/* The low 7 bits are the tag and the top bits select the home group */
+#define STRIPE(hash) (((hash) >> 7) & (CHM_STRIPES - 1))
+
+#define HM_INVALID_POS ((cs_hash32)-1)
+
+struct chm_table
+{
+    uint32_t table_count;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t rehash_limit;             /* Slots that may be used before the table is replaced */
+    atomic_uint used;                  /* Claimed slots, including erased ones */
+    atomic_uint migrate_next;          /* Next group to hand out to a migrating thread */
+    atomic_uint groups_migrated;
+    struct chm_table* _Atomic next;    /* Set once the table is being replaced */
+};
+
+struct chm_stripe
+{
+    atomic_flag lock;
+    atomic_uint count;                 /* Live entries whose hash maps to this stripe */
+    char padding[CHM_CACHE_LINE - sizeof(atomic_flag) - sizeof(atomic_uint)];
+};
+
+/*
+ * Threads announce that they are about to look at a table by incrementing a
+ * counter. Which of the two counters is used depends on the parity of the
+ * epoch, which is flipped whenever a table is retired. See retire_table().
+ */
+struct chm_readers
+{
+    atomic_uint active[2];
+    char padding[CHM_CACHE_LINE - 2 * sizeof(atomic_uint)];
+};
+
+struct cs_chashmap
+{
+    struct chm_table* _Atomic table;
+    hash32_func hash;
+    uint32_t key_size;
+    uint32_t value_size;
+    atomic_uint epoch;
+    atomic_flag resize_lock;           /* Held from allocating a new table until the old one is freed */
+    struct chm_stripe stripes[CHM_STRIPES];
+    struct chm_readers readers[CHM_READER_SLOTS];
+};
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Returns a bitmask with bit i set if the i'th tag in the group is equal to
+ * the specified tag. Writers update tags concurrently, so every tag is read
+ * with a relaxed atomic load. Unlike cs_hashmap there is no SSE2 version: a
+ * 16 byte vector load of the tags would be a data race. Tags only move
+ * forwards (empty, claimed, full, deleted), so a stale tag can only make a
+ * lookup miss an entry that was inserted concurrently, which it is allowed
+ * to. Matches are confirmed with an acquire load before the slot is read.
+ */
+static uint32_t
+group_match(const atomic_uchar* ctrl, uint8_t tag)
+{
+    uint32_t mask = 0;
+    int i;
+    for (i = 0; i != HM_GROUP_SIZE; ++i)
+        if (atomic_load_explicit(&ctrl[i], memory_order_relaxed) == tag)
+            mask |= (uint32_t)1 << i;
+    return mask;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+backoff(int* spins)
+{
+    if (++*spins < 64)
+        CPU_RELAX();
+    else
+        YIELD();
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+stripe_lock(struct chm_stripe* stripe)
+{
+    int spins = 0;
+    while (atomic_flag_test_and_set_explicit(&stripe->lock, memory_order_acquire))
+        backoff(&spins);
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+stripe_unlock(struct chm_stripe* stripe)
+{
+    atomic_flag_clear_explicit(&stripe->lock, memory_order_release);
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Every thread maps to a reader slot by its stack address, which spreads
+ * threads over the slots without needing thread local storage. Returns a
+ * token to pass to reader_exit().
+ */
+static uint32_t
+reader_enter(struct cs_chashmap* hm)
+{
+    uint32_t slot, parity;
+    uintptr_t stack = (uintptr_t)&slot;
+
+    slot = ((uint32_t)(stack >> 16) * 2654435769u) >> 26;
+    parity = atomic_load(&hm->epoch) & 1;
+    /* seq_cst, see retire_table() */
+    atomic_fetch_add(&hm->readers[slot].active[parity], 1);
+    return slot * 2 + parity;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+reader_exit(struct cs_chashmap* hm, uint32_t token)
+{
+    atomic_fetch_sub_explicit(&hm->readers[token / 2].active[token & 1], 1,
+                              memory_order_release);
+}
+
+/* ------------------------------------------------------------------------- */
+static cs_hash32
+home_group(const struct chm_table* t, cs_hash32 hash)
+{
+    cs_hash32 mixed = hash * 2654435769u;
+    return (cs_hash32)(((uint64_t)mixed * GROUP_COUNT(t)) >> 32);
+}
+
+/* ------------------------------------------------------------------------- */
+static struct chm_table*
+table_alloc(const struct cs_chashmap* hm, uint32_t table_count)
+{
+    struct chm_table* t;
+    uint32_t pos;
+
+    t = MALLOC(sizeof(*t) + (1 + sizeof(cs_hash32) + hm->key_size + hm->value_size) * table_count);
+    if (t == NULL)
+        return NULL;
+
+    t->table_count = table_count;
+    t->key_size = hm->key_size;
+    t->value_size = hm->value_size;
+    t->rehash_limit = (uint32_t)((uint64_t)table_count * HM_REHASH_AT_PERCENT / 100);
+    atomic_init(&t->used, 0);
+    atomic_init(&t->migrate_next, 0);
+    atomic_init(&t->groups_migrated, 0);
+    atomic_init(&t->next, NULL);
+    for (pos = 0; pos != table_count; ++pos)
+        atomic_init(&CTRL(t, pos), HM_CTRL_EMPTY);
+
+    return t;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * The probing sequence is the same as cs_hashmap's. Because a slot never
+ * becomes empty again, every slot before an entry in its probing sequence
+ * stays occupied, and stopping at the first group with an empty tag is safe.
+ */
+static cs_hash32
+table_find(const struct chm_table* t, const void* key, cs_hash32 hash)
+{
+    cs_hash32 group = home_group(t, hash);
+    cs_hash32 probe = 0;
+    uint8_t h2 = H2(hash);
+
+    for (;;)
+    {
+        const atomic_uchar* ctrl = &CTRL(t, group * HM_GROUP_SIZE);
+        uint32_t match = group_match(ctrl, h2);
+        while (match)
+        {
+            cs_hash32 pos = group * HM_GROUP_SIZE + (cs_hash32)cs_hm_ctz32(match);
+            if (atomic_load_explicit(&CTRL(t, pos), memory_order_acquire) == h2 &&
+                SLOT(t, pos) == hash &&
+                memcmp(KEY(t, pos), key, t->key_size) == 0)
+            {
+                return pos;
+            }
+            match &= match - 1;
+        }
+
+        if (group_match(ctrl, HM_CTRL_EMPTY))
+            return HM_INVALID_POS;
+
+        probe++;
+        group = (group + probe) & GROUP_MASK(t);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Claims the first empty slot in the probing sequence. Other writers (with
+ * other stripes) may be claiming slots in the same groups, so the tag is
+ * changed with a compare-and-swap. The caller has reserved the slot in
+ * t->used, so an empty slot exists.
+ */
+static cs_hash32
+claim_slot(struct chm_table* t, cs_hash32 hash, uint8_t tag)
+{
+    cs_hash32 group = home_group(t, hash);
+    cs_hash32 probe = 0;
+
+    for (;;)
+    {
+        uint32_t empty;
+        while ((empty = group_match(&CTRL(t, group * HM_GROUP_SIZE), HM_CTRL_EMPTY)) != 0)
+        {
+            cs_hash32 pos = group * HM_GROUP_SIZE + (cs_hash32)cs_hm_ctz32(empty);
+            unsigned char expected = HM_CTRL_EMPTY;
+            if (atomic_compare_exchange_strong(&CTRL(t, pos), &expected, tag))
+                return pos;
+        }
+
+        probe++;
+        group = (group + probe) & GROUP_MASK(t);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Copies every full slot of the group into the new table. The old table
+ * isn't written to during a migration, so its slots are read without
+ * synchronization. The new table is published as a whole when the migration
+ * completes, so its tags don't need release stores either.
+ */
+static void
+migrate_group(struct chm_table* t, struct chm_table* nt, cs_hash32 group)
+{
+    cs_hash32 pos;
+    for (pos = group * HM_GROUP_SIZE; pos != (group + 1) * HM_GROUP_SIZE; ++pos)
+    {
+        cs_hash32 hash, new_pos;
+        uint8_t tag = atomic_load_explicit(&CTRL(t, pos), memory_order_relaxed);
+        if (!HM_CTRL_IS_FULL(tag))
+            continue;
+
+        hash = SLOT(t, pos);
+        new_pos = claim_slot(nt, hash, tag);
+        memcpy(&SLOT(nt, new_pos), &SLOT(t, pos), sizeof(cs_hash32) + t->key_size);
+        memcpy(VALUE(nt, new_pos), VALUE(t, pos), t->value_size);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Allocates the table that replaces t and publishes it in t->next. Taking
+ * every stripe lock waits for the writers that are still working on t, and
+ * since writers check t->next after locking their stripe, none of them will
+ * touch t afterwards. The locks are only held while allocating, the
+ * migration itself happens in help_resize().
+ */
+static enum cs_hashmap_status
+start_resize(struct cs_chashmap* hm, struct chm_table* t)
+{
+    struct chm_table* nt;
+    uint32_t live, table_count, i;
+
+    if (atomic_flag_test_and_set_explicit(&hm->resize_lock, memory_order_acquire))
+        return HM_OK;  /* Another thread is resizing */
+
+    /* t was already replaced by the time this thread got here */
+    if (atomic_load_explicit(&hm->table, memory_order_acquire) != t)
+    {
+        atomic_flag_clear_explicit(&hm->resize_lock, memory_order_release);
+        return HM_OK;
+    }
+
+    for (i = 0; i != CHM_STRIPES; ++i)
+        stripe_lock(&hm->stripes[i]);
+
+    live = 0;
+    for (i = 0; i != CHM_STRIPES; ++i)
+        live += atomic_load_explicit(&hm->stripes[i].count, memory_order_relaxed);
+
+    /*
+     * The new size only depends on the live entries, so a table that is full
+     * of erased slots is rebuilt at the same size. Leave at least half of the
+     * usable slots free so the next resize isn't imminent.
+     */
+    table_count = HM_GROUP_SIZE;
+    while ((uint64_t)live * 200 >= (uint64_t)table_count * HM_REHASH_AT_PERCENT)
+        table_count *= HM_EXPAND_FACTOR;
+
+    nt = table_alloc(hm, table_count);
+    if (nt != NULL)
+    {
+        atomic_init(&nt->used, live);
+        atomic_store_explicit(&t->next, nt, memory_order_release);
+    }
+
+    for (i = 0; i != CHM_STRIPES; ++i)
+        stripe_unlock(&hm->stripes[i]);
+
+    if (nt == NULL)
+    {
+        atomic_flag_clear_explicit(&hm->resize_lock, memory_order_release);
+        return HM_OOM;
+    }
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Migrates chunks of groups from t to its replacement until there are none
+ * left to claim, then waits for the other migrating threads to finish. The
+ * thread that migrates the last chunk makes the new table current and
+ * returns 1, after which it must call retire_table() outside of its read
+ * section.
+ */
+static int
+help_resize(struct cs_chashmap* hm, struct chm_table* t)
+{
+    struct chm_table* nt = atomic_load_explicit(&t->next, memory_order_acquire);
+    uint32_t groups = GROUP_COUNT(t);
+    uint32_t first;
+    int spins = 0;
+
+    /* The resizing thread is still allocating the new table */
+    if (nt == NULL)
+    {
+        YIELD();
+        return 0;
+    }
+
+    while ((first = atomic_fetch_add(&t->migrate_next, CHM_MIGRATE_CHUNK)) < groups)
+    {
+        uint32_t last = first + CHM_MIGRATE_CHUNK < groups ? first + CHM_MIGRATE_CHUNK : groups;
+        uint32_t group;
+        for (group = first; group != last; ++group)
+            migrate_group(t, nt, group);
+
+        if (atomic_fetch_add(&t->groups_migrated, last - first) + (last - first) == groups)
+        {
+            /* seq_cst, see retire_table() */
+            atomic_store(&hm->table, nt);
+            return 1;
+        }
+    }
+
+    while (atomic_load_explicit(&hm->table, memory_order_acquire) == t)
+        backoff(&spins);
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Frees a table that was replaced. Threads that entered their read section
+ * before the replacement may still be looking at it. Flipping the epoch
+ * sends new readers to the other set of counters, so the counters of the old
+ * parity only drain, and once they are all zero nobody can see the old table.
+ *
+ * This relies on four accesses being seq_cst: the store of the new table in
+ * help_resize() followed by the counter loads here, and the counter increment
+ * in reader_enter() followed by the reader's load of the table. In their
+ * single total order, either the reader's increment comes first and is seen
+ * here, or the store comes first and the reader loads the new table. With
+ * release/acquire alone both sides could miss each other.
+ */
+static void
+retire_table(struct cs_chashmap* hm, struct chm_table* t)
+{
+    uint32_t parity = atomic_fetch_add(&hm->epoch, 1) & 1;
+    uint32_t slot;
+
+    for (slot = 0; slot != CHM_READER_SLOTS; ++slot)
+    {
+        int spins = 0;
+        while (atomic_load(&hm->readers[slot].active[parity]) != 0)
+            backoff(&spins);
+    }
+
+    FREE(t);
+    atomic_flag_clear_explicit(&hm->resize_lock, memory_order_release);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+chashmap_create(struct cs_chashmap** hm, uint32_t key_size, uint32_t value_size)
+{
+    return chashmap_create_with_options(hm, key_size, value_size,
+                                        HM_DEFAULT_TABLE_COUNT, HASH32_DEFAULT);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+chashmap_create_with_options(struct cs_chashmap** hm,
+                             uint32_t key_size,
+                             uint32_t value_size,
+                             uint32_t table_count,
+                             hash32_func hash_func)
+{
+    struct chm_table* t;
+    uint32_t i;
+
+    assert(hm);
+    assert(key_size > 0);
+    assert(table_count > 0);
+    assert(hash_func);
+
+    /* Probing works on whole groups of tags and requires a power of two */
+    i = HM_GROUP_SIZE;
+    while (i < table_count)
+        i *= 2;
+    table_count = i;
+
+    *hm = MALLOC(sizeof(**hm));
+    if (*hm == NULL)
+        return HM_OOM;
+
+    (*hm)->hash = hash_func;
+    (*hm)->key_size = key_size;
+    (*hm)->value_size = value_size;
+    atomic_init(&(*hm)->epoch, 0);
+    atomic_flag_clear(&(*hm)->resize_lock);
+    for (i = 0; i != CHM_STRIPES; ++i)
+    {
+        atomic_flag_clear(&(*hm)->stripes[i].lock);
+        atomic_init(&(*hm)->stripes[i].count, 0);
+    }
+    for (i = 0; i != CHM_READER_SLOTS; ++i)
+    {
+        atomic_init(&(*hm)->readers[i].active[0], 0);
+        atomic_init(&(*hm)->readers[i].active[1], 0);
+    }
+
+    t = table_alloc(*hm, table_count);
+    if (t == NULL)
+    {
+        FREE(*hm);
+        return HM_OOM;
+    }
+    atomic_init(&(*hm)->table, t);
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+chashmap_free(struct cs_chashmap* hm)
+{
+    struct chm_table* t = atomic_load(&hm->table);
+
+    /* Every resize is finished by the threads that run into it */
+    assert(atomic_load(&t->next) == NULL);
+
+    FREE(t);
+    FREE(hm);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+chashmap_insert(struct cs_chashmap* hm, const void* key, const void* value)
+{
+    cs_hash32 hash = hm->hash(key, hm->key_size);
+    struct chm_stripe* stripe = &hm->stripes[STRIPE(hash)];
+
+    for (;;)
+    {
+        uint32_t token = reader_enter(hm);
+        /* seq_cst, see retire_table() */
+        struct chm_table* t = atomic_load(&hm->table);
+
+        stripe_lock(stripe);
+        if (atomic_load_explicit(&t->next, memory_order_acquire) == NULL)
+        {
+            cs_hash32 pos;
+
+            if (table_find(t, key, hash) != HM_INVALID_POS)
+            {
+                stripe_unlock(stripe);
+                reader_exit(hm, token);
+                return HM_EXISTS;
+            }
+
+            if (atomic_fetch_add_explicit(&t->used, 1, memory_order_relaxed) < t->rehash_limit)
+            {
+                pos = claim_slot(t, hash, CHM_CTRL_BUSY);
+                SLOT(t, pos) = hash;
+                memcpy(KEY(t, pos), key, hm->key_size);
+                if (hm->value_size)
+                    memcpy(VALUE(t, pos), value, hm->value_size);
+                atomic_store_explicit(&CTRL(t, pos), H2(hash), memory_order_release);
+                atomic_fetch_add_explicit(&stripe->count, 1, memory_order_relaxed);
+
+                stripe_unlock(stripe);
+                reader_exit(hm, token);
+                return HM_OK;
+            }
+
+            atomic_fetch_sub_explicit(&t->used, 1, memory_order_relaxed);
+            stripe_unlock(stripe);
+            if (start_resize(hm, t) == HM_OOM)
+            {
+                reader_exit(hm, token);
+                return HM_OOM;
+            }
+        }
+        else
+            stripe_unlock(stripe);
+
+        if (help_resize(hm, t))
+        {
+            reader_exit(hm, token);
+            retire_table(hm, t);
+        }
+        else
+            reader_exit(hm, token);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+int
+chashmap_find(struct cs_chashmap* hm, const void* key, void* value)
+{
+    cs_hash32 hash = hm->hash(key, hm->key_size);
+
+    for (;;)
+    {
+        uint32_t token = reader_enter(hm);
+        /* seq_cst, see retire_table() */
+        struct chm_table* t = atomic_load(&hm->table);
+        cs_hash32 pos = table_find(t, key, hash);
+        if (pos != HM_INVALID_POS && value)
+            memcpy(value, VALUE(t, pos), hm->value_size);
+
+        /*
+         * Once a table is replaced, writers only modify the new one. The
+         * result is only valid if the table was still current after reading.
+         */
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&hm->table, memory_order_relaxed) == t)
+        {
+            reader_exit(hm, token);
+            return pos != HM_INVALID_POS;
+        }
+        reader_exit(hm, token);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+int
+chashmap_erase(struct cs_chashmap* hm, const void* key, void* value)
+{
+    cs_hash32 hash = hm->hash(key, hm->key_size);
+    struct chm_stripe* stripe = &hm->stripes[STRIPE(hash)];
+
+    for (;;)
+    {
+        uint32_t token = reader_enter(hm);
+        /* seq_cst, see retire_table() */
+        struct chm_table* t = atomic_load(&hm->table);
+
+        stripe_lock(stripe);
+        if (atomic_load_explicit(&t->next, memory_order_acquire) == NULL)
+        {
+            /*
+             * The slot keeps its key and value, so concurrent readers that
+             * already matched it copy a consistent entry. The slot stays
+             * used until the table is rebuilt.
+             */
+            cs_hash32 pos = table_find(t, key, hash);
+            if (pos != HM_INVALID_POS)
+            {
+                if (value)
+                    memcpy(value, VALUE(t, pos), hm->value_size);
+                atomic_store_explicit(&CTRL(t, pos), HM_CTRL_DELETED, memory_order_release);
+                atomic_fetch_sub_explicit(&stripe->count, 1, memory_order_relaxed);
+            }
+
+            stripe_unlock(stripe);
+            reader_exit(hm, token);
+            return pos != HM_INVALID_POS;
+        }
+        stripe_unlock(stripe);
+
+        if (help_resize(hm, t))
+        {
+            reader_exit(hm, token);
+            retire_table(hm, t);
+        }
+        else
+            reader_exit(hm, token);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+uint32_t
+chashmap_count(const struct cs_chashmap* hm)
+{
+    uint32_t count = 0;
+    int i;
+    for (i = 0; i != CHM_STRIPES; ++i)
+        count += atomic_load_explicit(&hm->stripes[i].count, memory_order_relaxed);
+    return count;
+}
@@ -0,0 +1,101 @@
+#include "cstructures/cpu.h"
+
+#if defined(CSTRUCTURES_CPU_DISPATCH)
+#   if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#       include <intrin.h>
+#       define CPU_X86
+#   elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#       include <cpuid.h>
+#       define CPU_X86
+#   endif
+#endif
+
+static uint32_t g_detected;
+static uint32_t g_disabled;
+
+#if defined(CPU_X86)
+/* ------------------------------------------------------------------------- */
+static void
+cpuid(uint32_t leaf, uint32_t regs[4])
+{
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, (int)leaf, 0);
+    regs[0] = (uint32_t)r[0]; regs[1] = (uint32_t)r[1];
+    regs[2] = (uint32_t)r[2]; regs[3] = (uint32_t)r[3];
+#else
+    __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+/* Returns the XCR0 register, which says which registers the OS saves */
+static uint64_t
+xgetbv0(void)
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+static uint32_t
+detect(void)
+{
+    uint32_t features = 0;
+    uint32_t regs[4];
+    uint32_t max_leaf;
+
+    cpuid(0, regs);
+    max_leaf = regs[0];
+    if (max_leaf < 1)
+        return 0;
+
+    cpuid(1, regs);
+    if (regs[3] & (1u << 26))
+        features |= CPU_SSE2;
+    if (regs[2] & (1u << 20))
+        features |= CPU_SSE42;
+
+    /* AVX2 needs OSXSAVE (ecx bit 27), and the OS saving XMM and YMM state */
+    if (max_leaf >= 7 && (regs[2] & (1u << 27)) && (xgetbv0() & 0x6) == 0x6)
+    {
+        cpuid(7, regs);
+        if (regs[1] & (1u << 5))
+            features |= CPU_AVX2;
+    }
+
+    return features;
+}
+#else
+static uint32_t
+detect(void)
+{
+    return 0;
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+void
+cpu_init(void)
+{
+    g_detected = detect();
+}
+
+/* ------------------------------------------------------------------------- */
+uint32_t
+cpu_features(void)
+{
+    return g_detected & ~g_disabled;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+cpu_disable_features(uint32_t features)
+{
+    g_disabled = features;
+}
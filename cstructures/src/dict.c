@@ -0,0 +1,329 @@
+#include "cstructures/dict.h"
+#include "cstructures/memory.h"
+#include <string.h>
+#include <assert.h>
+
+#define ALIGN8(x) (((x) + 7) & ~7u)
+
+#define ENTRY_HASH(d, n)   (((cs_hash32*)DICT_ENTRY(d, n))[0])
+#define ENTRY_ERASED(d, n) (((uint32_t*)DICT_ENTRY(d, n))[1])
+#define ENTRY_KEY(d, n)    ((void*)(DICT_ENTRY(d, n) + 8))
+#define ENTRY_VALUE(d, n)  ((void*)(DICT_ENTRY(d, n) + 8 + ALIGN8((d)->key_size)))
+
+#define SLOT_MASK(d) ((d)->table_count - 1)
+#define USABLE(table_count) ((uint32_t)((uint64_t)(table_count) * DICT_MAX_LOAD_PERCENT / 100))
+
+/* Compaction is only worth it once there's more than a handful of erased entries */
+#define DICT_MIN_COMPACT 8
+
+/* ------------------------------------------------------------------------- */
+/* Fibonacci hashing, as in hashmap.c */
+static cs_hash32
+home_slot(const struct cs_dict* d, cs_hash32 hash)
+{
+    cs_hash32 mixed = hash * 2654435769u;
+    return (cs_hash32)(((uint64_t)mixed * d->table_count) >> 32);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Smallest index whose usable part holds the specified number of entries */
+static uint32_t
+table_count_for(uint32_t element_count)
+{
+    uint32_t table_count = HM_GROUP_SIZE;
+    while (USABLE(table_count) < element_count)
+        table_count *= 2;
+    return table_count;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Returns the index slot referring to the key, or -1 if the key doesn't
+ * exist. If insert_pos is not NULL, the first empty or deleted index slot
+ * along the probing sequence is written to it.
+ */
+static int32_t
+find_slot(const struct cs_dict* d, const void* key, cs_hash32 hash, cs_hash32* insert_pos)
+{
+    cs_hash32 pos = home_slot(d, hash);
+    cs_hash32 first_free = (cs_hash32)-1;
+
+    /* The index is never full, so there is always an empty slot to stop at */
+    for (;; pos = (pos + 1) & SLOT_MASK(d))
+    {
+        int32_t n = d->index[pos];
+        if (n == DICT_INDEX_EMPTY)
+            break;
+        if (n == DICT_INDEX_DELETED)
+        {
+            if (first_free == (cs_hash32)-1)
+                first_free = pos;
+            continue;
+        }
+
+        if (ENTRY_HASH(d, n) == hash &&
+            memcmp(ENTRY_KEY(d, n), key, d->key_size) == 0)
+        {
+            return (int32_t)pos;
+        }
+    }
+
+    if (insert_pos)
+        *insert_pos = first_free == (cs_hash32)-1 ? pos : first_free;
+    return -1;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Rebuilds the dict with room for element_count entries: erased entries are
+ * dropped from the entry array (the order of the others is kept) and the
+ * index is rebuilt at the size that fits. On failure, the dict is unchanged.
+ */
+static enum cs_hashmap_status
+rebuild(struct cs_dict* d, uint32_t element_count)
+{
+    uint32_t table_count, capacity, n, live;
+    int32_t* index;
+
+    if (element_count < dict_count(d))
+        element_count = dict_count(d);
+    table_count = table_count_for(element_count);
+    capacity = USABLE(table_count);
+
+    index = MALLOC(sizeof(int32_t) * table_count);
+    if (index == NULL)
+        return HM_OOM;
+
+    if (capacity > d->entry_capacity)
+    {
+        void* entries = REALLOC(d->entries, (uintptr_t)d->entry_size * capacity);
+        if (entries == NULL)
+        {
+            FREE(index);
+            return HM_OOM;
+        }
+        d->entries = entries;
+    }
+
+    live = 0;
+    for (n = 0; n != d->entry_count; ++n)
+    {
+        if (ENTRY_ERASED(d, n))
+            continue;
+        if (live != n)
+            memcpy(DICT_ENTRY(d, live), DICT_ENTRY(d, n), d->entry_size);
+        live++;
+    }
+    d->entry_count = live;
+    d->erased = 0;
+    d->index_deleted = 0;
+
+    /* Shrinking the entry array may fail, in which case the larger one is kept */
+    if (capacity < d->entry_capacity)
+    {
+        void* entries = REALLOC(d->entries, (uintptr_t)d->entry_size * capacity);
+        if (entries != NULL)
+            d->entries = entries;
+    }
+    d->entry_capacity = capacity;
+
+    XFREE(d->index);
+    d->index = index;
+    d->table_count = table_count;
+    memset(index, 0xFF, sizeof(int32_t) * table_count);  /* DICT_INDEX_EMPTY */
+    for (n = 0; n != live; ++n)
+    {
+        cs_hash32 pos = home_slot(d, ENTRY_HASH(d, n));
+        while (index[pos] != DICT_INDEX_EMPTY)
+            pos = (pos + 1) & SLOT_MASK(d);
+        index[pos] = (int32_t)n;
+    }
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Called at the start of insert and erase, so pointers returned by
+ * dict_erase() stay valid until then.
+ */
+static enum cs_hashmap_status
+compact_if_necessary(struct cs_dict* d)
+{
+    if (d->erased >= DICT_MIN_COMPACT && d->erased > dict_count(d))
+        return rebuild(d, dict_count(d));
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+dict_create(struct cs_dict** d, uint32_t key_size, uint32_t value_size)
+{
+    return dict_create_with_options(d, key_size, value_size, 0, HASH32_DEFAULT);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+dict_create_with_options(struct cs_dict** d,
+                         uint32_t key_size,
+                         uint32_t value_size,
+                         uint32_t element_count,
+                         hash32_func hash_func)
+{
+    enum cs_hashmap_status status;
+
+    *d = MALLOC(sizeof(**d));
+    if (*d == NULL)
+        return HM_OOM;
+
+    status = dict_init_with_options(*d, key_size, value_size, element_count, hash_func);
+    if (status != HM_OK)
+        FREE(*d);
+    return status;
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+dict_init(struct cs_dict* d, uint32_t key_size, uint32_t value_size)
+{
+    return dict_init_with_options(d, key_size, value_size, 0, HASH32_DEFAULT);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+dict_init_with_options(struct cs_dict* d,
+                       uint32_t key_size,
+                       uint32_t value_size,
+                       uint32_t element_count,
+                       hash32_func hash_func)
+{
+    assert(d);
+    assert(key_size > 0);
+    assert(hash_func);
+
+    d->key_size = key_size;
+    d->value_size = value_size;
+    d->entry_size = 8 + ALIGN8(key_size) + ALIGN8(value_size);
+    d->entry_count = 0;
+    d->entry_capacity = 0;
+    d->erased = 0;
+    d->index_deleted = 0;
+    d->hash = hash_func;
+    d->index = NULL;
+    d->entries = NULL;
+
+    return rebuild(d, element_count);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+dict_deinit(struct cs_dict* d)
+{
+    FREE(d->index);
+    FREE(d->entries);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+dict_free(struct cs_dict* d)
+{
+    dict_deinit(d);
+    FREE(d);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+dict_reserve(struct cs_dict* d, uint32_t element_count)
+{
+    /* Erased keys keep their index slot and, unless popped, their entry */
+    if (element_count + d->index_deleted <= d->entry_capacity)
+        return HM_OK;
+    return rebuild(d, element_count);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+dict_insert(struct cs_dict* d, const void* key, const void* value)
+{
+    cs_hash32 hash = d->hash(key, d->key_size);
+    cs_hash32 pos = (cs_hash32)-1;
+    uint32_t n;
+
+    if (compact_if_necessary(d) != HM_OK)
+        return HM_OOM;
+
+    if (find_slot(d, key, hash, &pos) >= 0)
+        return HM_EXISTS;
+
+    /* Index slots of erased keys count as used until the next rebuild */
+    if (d->entry_count == d->entry_capacity ||
+        dict_count(d) + d->index_deleted == d->entry_capacity)
+    {
+        /*
+         * Only grow if the live entries fill more than half of the capacity,
+         * otherwise dropping the erased ones makes enough room. Rebuilding
+         * moves the index slots, so probe again.
+         */
+        uint32_t element_count = dict_count(d) + 1;
+        if (element_count * HM_EXPAND_FACTOR > d->entry_capacity)
+            element_count *= HM_EXPAND_FACTOR;
+        else
+            element_count = d->entry_capacity;
+        if (rebuild(d, element_count) != HM_OK)
+            return HM_OOM;
+        pos = (cs_hash32)-1;
+        find_slot(d, key, hash, &pos);
+        assert(pos != (cs_hash32)-1);
+    }
+
+    n = d->entry_count++;
+    ENTRY_HASH(d, n) = hash;
+    ENTRY_ERASED(d, n) = 0;
+    memcpy(ENTRY_KEY(d, n), key, d->key_size);
+    if (d->value_size)
+        memcpy(ENTRY_VALUE(d, n), value, d->value_size);
+    if (d->index[pos] == DICT_INDEX_DELETED)
+        d->index_deleted--;
+    d->index[pos] = (int32_t)n;
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+void*
+dict_erase(struct cs_dict* d, const void* key)
+{
+    cs_hash32 hash = d->hash(key, d->key_size);
+    int32_t pos;
+    uint32_t n;
+
+    /* If compaction fails, erasing without it is still fine */
+    compact_if_necessary(d);
+
+    pos = find_slot(d, key, hash, NULL);
+    if (pos < 0)
+        return NULL;
+
+    n = (uint32_t)d->index[pos];
+    d->index[pos] = DICT_INDEX_DELETED;
+    d->index_deleted++;
+    ENTRY_ERASED(d, n) = 1;
+
+    /* The last entry can be dropped right away */
+    if (n == d->entry_count - 1)
+        d->entry_count--;
+    else
+        d->erased++;
+
+    return ENTRY_VALUE(d, n);
+}
+
+/* ------------------------------------------------------------------------- */
+void*
+dict_find(const struct cs_dict* d, const void* key)
+{
+    int32_t pos = find_slot(d, key, d->hash(key, d->key_size), NULL);
+    if (pos < 0)
+        return NULL;
+    return ENTRY_VALUE(d, d->index[pos]);
+}
@@ -1,5 +1,152 @@
 #include "cstructures/hash.h"
+#include "cstructures/cpu.h"
 #include <assert.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#   include <intrin.h>
+#   pragma intrinsic(_umul128)
+#endif
+
+#if defined(CSTRUCTURES_CPU_DISPATCH)
+#   if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#       include <nmmintrin.h>
+#       define CRC32C_SSE42
+#       define TARGET_SSE42
+#   elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#       include <nmmintrin.h>
+#       define CRC32C_SSE42
+#       define TARGET_SSE42 __attribute__((target("sse4.2")))
+#   endif
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+static cs_hash32 crc32c_sw(const void* key, uintptr_t len);
+
+/* Slice-by-8 tables, filled in by hash_init() */
+static uint32_t g_crc32c_table[8][256];
+static int g_crc32c_table_ready;
+
+static hash32_func g_crc32c = crc32c_sw;
+
+/* ------------------------------------------------------------------------- */
+static void
+crc32c_init_table(void)
+{
+    uint32_t i, k;
+    for (i = 0; i != 256; ++i)
+    {
+        uint32_t crc = i;
+        for (k = 0; k != 8; ++k)
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+        g_crc32c_table[0][i] = crc;
+    }
+    for (k = 1; k != 8; ++k)
+        for (i = 0; i != 256; ++i)
+        {
+            uint32_t prev = g_crc32c_table[k - 1][i];
+            g_crc32c_table[k][i] = (prev >> 8) ^ g_crc32c_table[0][prev & 0xFF];
+        }
+    g_crc32c_table_ready = 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Used if the library wasn't initialized */
+static uint32_t
+crc32c_bitwise(uint32_t crc, const uint8_t* p, uintptr_t len)
+{
+    while (len--)
+    {
+        int k;
+        crc ^= *p++;
+        for (k = 0; k != 8; ++k)
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+    }
+    return crc;
+}
+
+/* ------------------------------------------------------------------------- */
+static cs_hash32
+crc32c_sw(const void* key, uintptr_t len)
+{
+    const uint8_t* p = (const uint8_t*)key;
+    uint32_t crc = 0xFFFFFFFF;
+
+    if (!g_crc32c_table_ready)
+        return ~crc32c_bitwise(crc, p, len);
+
+    /* Bytes are combined explicitly so the result doesn't depend on byte order */
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                             (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = g_crc32c_table[7][lo & 0xFF] ^
+              g_crc32c_table[6][(lo >> 8) & 0xFF] ^
+              g_crc32c_table[5][(lo >> 16) & 0xFF] ^
+              g_crc32c_table[4][lo >> 24] ^
+              g_crc32c_table[3][p[4]] ^
+              g_crc32c_table[2][p[5]] ^
+              g_crc32c_table[1][p[6]] ^
+              g_crc32c_table[0][p[7]];
+    }
+    while (len--)
+        crc = (crc >> 8) ^ g_crc32c_table[0][(crc ^ *p++) & 0xFF];
+
+    return ~crc;
+}
+
+#if defined(CRC32C_SSE42)
+/* ------------------------------------------------------------------------- */
+static TARGET_SSE42 cs_hash32
+crc32c_sse42(const void* key, uintptr_t len)
+{
+    const uint8_t* p = (const uint8_t*)key;
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc = 0xFFFFFFFF;
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = _mm_crc32_u64(crc, v);
+    }
+#else
+    uint32_t crc = 0xFFFFFFFF;
+#endif
+    for (; len >= 4; len -= 4, p += 4)
+    {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32((uint32_t)crc, v);
+    }
+    while (len--)
+        crc = _mm_crc32_u8((uint32_t)crc, *p++);
+
+    return ~(uint32_t)crc;
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+void
+hash_init(void)
+{
+    if (!g_crc32c_table_ready)
+        crc32c_init_table();
+
+    g_crc32c = crc32c_sw;
+#if defined(CRC32C_SSE42)
+    if (cpu_features() & CPU_SSE42)
+        g_crc32c = crc32c_sse42;
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+cs_hash32
+hash32_crc32c(const void* key, uintptr_t len)
+{
+    return g_crc32c(key, len);
+}
 
 /* ------------------------------------------------------------------------- */
 cs_hash32
@@ -18,6 +165,267 @@ hash32_jenkins_oaat(const void* key, uintptr_t len)
     return hash;
 }
 
+/* ------------------------------------------------------------------------- */
+/* The default secret of wyhash (https://github.com/wangyi-fudan/wyhash, public domain) */
+static const uint64_t wy_secret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+/* Multiplies a and b, returning the low half in a and the high half in b */
+static void
+wy_mum(uint64_t* a, uint64_t* b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t lo = t + (rm1 << 32);
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static uint64_t
+wy_mix(uint64_t a, uint64_t b)
+{
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+/* Unaligned reads. The result depends on the byte order of the machine. */
+static uint64_t wy_r8(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static uint64_t wy_r4(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static uint64_t wy_r3(const uint8_t* p, uintptr_t len)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+}
+
+/* ------------------------------------------------------------------------- */
+/* Keys of up to 16 bytes are read with at most 4 overlapping loads, no loop */
+static void
+wy_short(const uint8_t* p, uintptr_t len, uint64_t* a, uint64_t* b)
+{
+    if (len >= 4)
+    {
+        uintptr_t mid = (len >> 3) << 2;
+        *a = (wy_r4(p) << 32) | wy_r4(p + mid);
+        *b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - mid);
+    }
+    else if (len > 0)
+    {
+        *a = wy_r3(p, len);
+        *b = 0;
+    }
+    else
+        *a = *b = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Mixes 48 bytes into three independent lanes */
+static void
+wy_block(uint64_t lanes[3], const uint8_t* p)
+{
+    lanes[0] = wy_mix(wy_r8(p) ^ wy_secret[1], wy_r8(p + 8) ^ lanes[0]);
+    lanes[1] = wy_mix(wy_r8(p + 16) ^ wy_secret[2], wy_r8(p + 24) ^ lanes[1]);
+    lanes[2] = wy_mix(wy_r8(p + 32) ^ wy_secret[3], wy_r8(p + 40) ^ lanes[2]);
+}
+
+/*
+ * Mixes the remaining 1..48 bytes of a key longer than 16 bytes. The last
+ * 16 bytes are read from p + i - 16, which may overlap with bytes that were
+ * already hashed.
+ */
+static uint64_t
+wy_tail(uint64_t seed, const uint8_t* p, uintptr_t i, uint64_t* a, uint64_t* b)
+{
+    while (i > 16)
+    {
+        seed = wy_mix(wy_r8(p) ^ wy_secret[1], wy_r8(p + 8) ^ seed);
+        p += 16;
+        i -= 16;
+    }
+    *a = wy_r8(p + i - 16);
+    *b = wy_r8(p + i - 8);
+    return seed;
+}
+
+/* ------------------------------------------------------------------------- */
+static uint64_t
+wy_finish(uint64_t a, uint64_t b, uint64_t seed, uint64_t len)
+{
+    a ^= wy_secret[1];
+    b ^= seed;
+    wy_mum(&a, &b);
+    return wy_mix(a ^ wy_secret[0] ^ len, b ^ wy_secret[1]);
+}
+
+/* ------------------------------------------------------------------------- */
+static cs_hash32
+fold64(uint64_t h)
+{
+    return (cs_hash32)(h ^ (h >> 32));
+}
+
+/* ------------------------------------------------------------------------- */
+cs_hash32
+hash32_wyhash(const void* key, uintptr_t len)
+{
+    return fold64(hash64_wyhash(key, len));
+}
+
+/* ------------------------------------------------------------------------- */
+cs_hash64
+hash64_wyhash(const void* key, uintptr_t len)
+{
+    const uint8_t* p = (const uint8_t*)key;
+    uint64_t seed = wy_mix(wy_secret[0], wy_secret[1]);
+    uint64_t a, b;
+
+    if (len <= 16)
+        wy_short(p, len, &a, &b);
+    else
+    {
+        uintptr_t i = len;
+        if (i > 48)
+        {
+            uint64_t lanes[3];
+            lanes[0] = lanes[1] = lanes[2] = seed;
+            do
+            {
+                wy_block(lanes, p);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed = lanes[0] ^ lanes[1] ^ lanes[2];
+        }
+        seed = wy_tail(seed, p, i, &a, &b);
+    }
+
+    return wy_finish(a, b, seed, (uint64_t)len);
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * The one-shot function only mixes a 48 byte block if more bytes follow it,
+ * so the state holds back up to 48 bytes until it knows. The 16 bytes before
+ * them are kept as well, for the overlapping read in wy_tail().
+ */
+#define WY_HISTORY 16
+#define WY_PENDING(state) ((state)->buf + WY_HISTORY)
+
+void
+hash32_wyhash_init(struct cs_wyhash_state* state)
+{
+    state->lanes[0] = state->lanes[1] = state->lanes[2] =
+        wy_mix(wy_secret[0], wy_secret[1]);
+    state->length = 0;
+    state->pending = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+hash32_wyhash_update(struct cs_wyhash_state* state, const void* data, uintptr_t len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    state->length += len;
+
+    /* Fast path for the small fields of composite keys */
+    if (len <= 16 && state->pending + len <= 48)
+    {
+        uint8_t* dst = WY_PENDING(state) + state->pending;
+        state->pending += (uint32_t)len;
+        while (len--)
+            *dst++ = *p++;
+        return;
+    }
+
+    while (len)
+    {
+        uintptr_t n;
+
+        if (state->pending == 48)
+        {
+            wy_block(state->lanes, WY_PENDING(state));
+            memcpy(state->buf, WY_PENDING(state) + 48 - WY_HISTORY, WY_HISTORY);
+            state->pending = 0;
+        }
+
+        /* Large updates are mixed straight from the input */
+        if (state->pending == 0 && len > 48)
+        {
+            do
+            {
+                wy_block(state->lanes, p);
+                p += 48;
+                len -= 48;
+            } while (len > 48);
+            memcpy(state->buf, p - WY_HISTORY, WY_HISTORY);
+        }
+
+        n = 48 - state->pending;
+        if (n > len)
+            n = len;
+        memcpy(WY_PENDING(state) + state->pending, p, n);
+        state->pending += (uint32_t)n;
+        p += n;
+        len -= n;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+cs_hash32
+hash32_wyhash_final(const struct cs_wyhash_state* state)
+{
+    return fold64(hash64_wyhash_final(state));
+}
+
+/* ------------------------------------------------------------------------- */
+cs_hash64
+hash64_wyhash_final(const struct cs_wyhash_state* state)
+{
+    uint64_t seed = state->lanes[0];
+    uint64_t a, b;
+
+    if (state->length <= 16)
+        wy_short(WY_PENDING(state), state->pending, &a, &b);
+    else
+    {
+        if (state->length > state->pending)
+            seed ^= state->lanes[1] ^ state->lanes[2];
+        seed = wy_tail(seed, WY_PENDING(state), state->pending, &a, &b);
+    }
+
+    return wy_finish(a, b, seed, state->length);
+}
+
+/* ------------------------------------------------------------------------- */
+cs_hash32
+hash32_u32(const void* key, uintptr_t len)
+{
+    uint32_t k;
+    assert(len == sizeof(k));
+    memcpy(&k, key, sizeof(k));
+    return hash32_mix_u32(k);
+}
+
+/* ------------------------------------------------------------------------- */
+cs_hash32
+hash32_u64(const void* key, uintptr_t len)
+{
+    uint64_t k;
+    assert(len == sizeof(k));
+    memcpy(&k, key, sizeof(k));
+    return hash32_mix_u64(k);
+}
+
 /* ------------------------------------------------------------------------- */
 #if CSTRUCTURES_SIZEOF_VOID_P == 8
 cs_hash32
@@ -63,6 +471,26 @@ hash32_aligned_ptr(const void* ptr, uintptr_t len)
 }
 #endif
 
+/* ------------------------------------------------------------------------- */
+cs_hash32
+hash32_mixed_ptr(const void* ptr, uintptr_t len)
+{
+    assert(len == sizeof(void*));
+#if CSTRUCTURES_SIZEOF_VOID_P == 8
+    return hash32_mix_u64((uint64_t)*(const uintptr_t*)ptr);
+#else
+    return hash32_mix_u32((uint32_t)*(const uintptr_t*)ptr);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+cs_hash64
+hash64_ptr(const void* ptr, uintptr_t len)
+{
+    assert(len == sizeof(void*));
+    return hash64_mix_u64((uint64_t)*(const uintptr_t*)ptr);
+}
+
 /* ------------------------------------------------------------------------- */
 cs_hash32
 hash32_combine(cs_hash32 lhs, cs_hash32 rhs)
@@ -70,3 +498,11 @@ hash32_combine(cs_hash32 lhs, cs_hash32 rhs)
     lhs ^= rhs + 0x9e3779b9 + (lhs << 6) + (lhs >> 2);
     return lhs;
 }
+
+/* ------------------------------------------------------------------------- */
+cs_hash64
+hash64_combine(cs_hash64 lhs, cs_hash64 rhs)
+{
+    lhs ^= rhs + 0x9e3779b97f4a7c15ull + (lhs << 6) + (lhs >> 2);
+    return lhs;
+}
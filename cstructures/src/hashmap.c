@@ -1,11 +1,82 @@
 #include "cstructures/hashmap.h"
+#include "cstructures/hashmap_group.h"
 #include "cstructures/memory.h"
 #include <string.h>
 #include <assert.h>
 
-#define SLOT(hm, pos)  (*(cs_hash32*)((uint8_t*)hm->storage + (sizeof(cs_hash32) + hm->key_size) * pos))
-#define KEY(hm, pos)   ((void*)((uint8_t*)hm->storage + (sizeof(cs_hash32) + hm->key_size) * pos + sizeof(cs_hash32)))
-#define VALUE(hm, pos) ((void*)((uint8_t*)hm->storage + (sizeof(cs_hash32) + hm->key_size) * hm->table_count + hm->value_size * pos))
+#if defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   include <io.h>
+#   define write _write
+#   define lseek _lseek
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#   define PREFETCH(addr) __builtin_prefetch(addr)
+#elif defined(CS_HM_USE_SSE2)
+#   define PREFETCH(addr) _mm_prefetch((const char*)(addr), _MM_HINT_T0)
+#else
+#   define PREFETCH(addr)
+#endif
+
+/*
+ * The storage is laid out as:
+ *   [ctrl tags]           1 byte per slot
+ *   [hash | key] pairs    (sizeof(cs_hashmap_hash) + key_size) per slot
+ *   [values]              value_size per slot
+ * Probing only touches the ctrl tags until a tag matches, at which point the
+ * full hash and the key are compared. They share a cache line.
+ */
+#define CTRL(hm, pos)  (((uint8_t*)hm->storage)[pos])
+#define SLOT(hm, pos)  (*(cs_hashmap_hash*)((uint8_t*)hm->storage + hm->table_count + (sizeof(cs_hashmap_hash) + hm->key_size) * pos))
+#define KEY(hm, pos)   ((void*)((uint8_t*)hm->storage + hm->table_count + (sizeof(cs_hashmap_hash) + hm->key_size) * pos + sizeof(cs_hashmap_hash)))
+#define VALUE(hm, pos) ((void*)((uint8_t*)hm->storage + (1 + sizeof(cs_hashmap_hash) + hm->key_size) * hm->table_count + hm->value_size * pos))
+/* One extra value is allocated after the last slot to hold erased values,
+ * followed by one extra hash and key for swapping entries */
+#define SCRATCH_VALUE(hm) VALUE(hm, hm->table_count)
+#define SCRATCH_SLOT(hm)  ((void*)((uint8_t*)SCRATCH_VALUE(hm) + hm->value_size))
+
+/* Size of the storage block of a table with the specified number of slots, including the scratch slot */
+#define STORAGE_SIZE(hm, table_count) \
+    ((1 + sizeof(cs_hashmap_hash) + (uintptr_t)hm->key_size + hm->value_size) * ((uintptr_t)(table_count) + 1))
+
+#define GROUP_COUNT(hm) (hm->table_count / HM_GROUP_SIZE)
+#define GROUP_MASK(hm)  (GROUP_COUNT(hm) - 1)
+#define SLOT_MASK(hm)   (hm->table_count - 1)
+#define H2(hash) ((uint8_t)((hash) & 0x7F))
+
+/* Hashes a fixed size key */
+#define HASH_KEY(hm, key) \
+    ((hm)->key_hash ? (hm)->key_hash(key, (hm)->key_hash_user) : (hm)->hash(key, (hm)->key_size))
+
+#define HM_INVALID_POS ((cs_hashmap_size)-1)
+#if defined(CSTRUCTURES_HASHMAP_64BIT)
+#   define HM_MAX_TABLE_COUNT ((uint64_t)1 << 56)
+#else
+#   define HM_MAX_TABLE_COUNT ((uint64_t)1 << 31)
+#endif
+#define HM_MIN_KEY_ARENA 256
+
+/*
+ * With HM_VARIABLE_KEYS, each slot's key is a reference into the key arena,
+ * and the internal functions are passed a str_key instead of a key.
+ */
+struct key_ref
+{
+    uint32_t length;
+    uint32_t offset;
+};
+struct str_key
+{
+    const char* data;
+    uint32_t length;
+};
 
 #ifdef CSTRUCTURES_HASHMAP_STATS
 #   include <stdio.h>
@@ -17,9 +88,9 @@
             hm->stats.total_rehashes = 0; \
             hm->stats.total_insertion_probes = 0; \
             hm->stats.total_deletion_probes = 0; \
+            hm->stats.total_tag_collisions = 0; \
             hm->stats.max_slots_used = 0; \
-            hm->stats.max_slots_tombstoned = 0; \
-            hm->stats.current_tombstone_count = 0
+            hm->stats.max_slots_tombstoned = 0
 
 #   define STATS_INSERTION_PROBE(hm) \
             hm->stats.total_insertion_probes++
@@ -27,6 +98,9 @@
 #   define STATS_DELETION_PROBE(hm) \
             hm->stats.total_deletion_probes++
 
+#   define STATS_TAG_COLLISION(hm) \
+            hm->stats.total_tag_collisions++
+
 #   define STATS_INSERTED_IN_UNUSED(hm) do { \
             hm->stats.total_insertions++; \
             if (hm->slots_used > hm->stats.max_slots_used) \
@@ -40,18 +114,17 @@
                 hm->stats.max_slots_used = hm->slots_used; \
             } while (0)
 
-#   define STATS_DELETED(hm) do { \
-            hm->stats.total_deletions++; \
+#   define STATS_DELETED(hm) \
+            hm->stats.total_deletions++
+
+#   define STATS_TOMBSTONED(hm) do { \
             hm->stats.total_tombstones++; \
-            hm->stats.current_tombstone_count++; \
-            if (hm->stats.current_tombstone_count > hm->stats.max_slots_tombstoned) \
-                hm->stats.max_slots_tombstoned = hm->stats.current_tombstone_count; \
+            if (hm->tombstones > hm->stats.max_slots_tombstoned) \
+                hm->stats.max_slots_tombstoned = hm->tombstones; \
             } while (0)
 
-#   define STATS_REHASH(hm) do { \
-            hm->stats.total_rehashes++; \
-            hm->stats.current_tombstone_count = 0; \
-            } while (0)
+#   define STATS_REHASH(hm) \
+            hm->stats.total_rehashes++
 
 #   define STATS_REPORT(hm) do { \
             fprintf(stderr, \
@@ -63,6 +136,7 @@
                     "  total rehashes:          %lu\n" \
                     "  total insertion probes:  %lu\n" \
                     "  total deletion probes:   %lu\n" \
+                    "  total tag collisions:    %lu\n" \
                     "  max slots used:          %lu\n" \
                     "  max slots tombstoned:    %lu\n" \
                     , hm->key_size \
@@ -74,6 +148,7 @@
                     , hm->stats.total_rehashes \
                     , hm->stats.total_insertion_probes \
                     , hm->stats.total_deletion_probes \
+                    , hm->stats.total_tag_collisions \
                     , hm->stats.max_slots_used \
                     , hm->stats.max_slots_tombstoned); \
             } while (0)
@@ -82,276 +157,1781 @@
 #   define STATS_INIT(hm)
 #   define STATS_INSERTION_PROBE(hm)
 #   define STATS_DELETION_PROBE(hm)
+#   define STATS_TAG_COLLISION(hm)
 #   define STATS_INSERTED_IN_UNUSED(hm)
 #   define STATS_INSERTED_IN_TOMBSTONE(hm)
 #   define STATS_DELETED(hm)
+#   define STATS_TOMBSTONED(hm)
 #   define STATS_REHASH(hm)
 #   define STATS_REPORT(hm)
 #endif
 
+/* ------------------------------------------------------------------------- */
+static cs_hashmap_size
+next_power_of_two(cs_hashmap_size x)
+{
+    x--;
+    x |= x >> 1;
+    x |= x >> 2;
+    x |= x >> 4;
+    x |= x >> 8;
+    x |= x >> 16;
+#if defined(CSTRUCTURES_HASHMAP_64BIT)
+    x |= x >> 32;
+#endif
+    return x + 1;
+}
+
 /* ------------------------------------------------------------------------- */
 /*
- * Need to account for the possibility that our hash function will produce
- * reserved values. In this case, return a value that is not reserved in a
- * predictable way.
+ * Maps a hash to the first group of its probing sequence. Fibonacci hashing
+ * spreads the bits of weak hashes (e.g. pointers) before the top bits are
+ * taken, which avoids a modulo by the group count.
  */
-static cs_hash32
-hash_wrapper(const struct cs_hashmap* hm, const void* data, cs_hash32 len)
+#if defined(CSTRUCTURES_HASHMAP_64BIT)
+static cs_hashmap_size
+home_index(cs_hashmap_hash hash, cs_hashmap_size count)
+{
+    uint64_t mixed = hash * 0x9E3779B97F4A7C15ull;
+    /* count is a power of two, so taking the top log2(count) bits is a shift */
+    return (mixed >> 1) >> (63 - cs_hm_ctz64(count));
+}
+#else
+static cs_hashmap_size
+home_index(cs_hashmap_hash hash, cs_hashmap_size count)
 {
-    cs_hash32 hash = hm->hash(data, len);
-    if (hash == HM_SLOT_UNUSED || hash == HM_SLOT_RIP || hash == HM_SLOT_INVALID)
-        return 2;
-    return hash;
+    cs_hash32 mixed = hash * 2654435769u;
+    return (cs_hashmap_size)(((uint64_t)mixed * count) >> 32);
 }
+#endif
 
-/* ------------------------------------------------------------------------- */
-static void*
-malloc_and_init_storage(cs_hash32 key_size, cs_hash32 value_size, cs_hash32 table_count)
+static cs_hashmap_size
+home_group(const struct cs_hashmap* hm, cs_hashmap_hash hash)
 {
-    /* Store the hashes, keys and values in one contiguous chunk of memory */
-    void* storage = MALLOC((sizeof(cs_hash32) + key_size + value_size) * table_count);
-    if (storage == NULL)
-        return NULL;
+    return home_index(hash, GROUP_COUNT(hm));
+}
 
-    /* Initialize hash table -- NOTE: Only works if HM_SLOT_UNUSED is 0 */
-    memset(storage, 0, (sizeof(cs_hash32) + key_size) * table_count);
-    return storage;
+/* ------------------------------------------------------------------------- */
+/*
+ * Home slot for linear probing. This is consistent with home_group(), i.e.
+ * the home slot always lies within the home group.
+ */
+static cs_hashmap_size
+home_slot(const struct cs_hashmap* hm, cs_hashmap_hash hash)
+{
+    return home_index(hash, hm->table_count);
 }
 
 /* ------------------------------------------------------------------------- */
+/*
+ * Compares the key in the specified slot with a key being looked up. The
+ * caller has already compared the hashes. Variable length keys compare their
+ * lengths before the bytes.
+ */
 static int
-resize_rehash(struct cs_hashmap* hm, cs_hash32 new_table_count)
+keys_equal(const struct cs_hashmap* hm, cs_hashmap_size pos, const void* key)
 {
-    struct cs_hashmap new_hm;
-    cs_hash32 i;
-
-    STATS_REHASH(hm);
-
-    memcpy(&new_hm, hm, sizeof(struct cs_hashmap));
-    new_hm.table_count = new_table_count;
-    new_hm.slots_used = 0;
-    new_hm.storage = malloc_and_init_storage(hm->key_size, hm->value_size, new_table_count);
-    if (new_hm.storage == NULL)
-        return -1;
-
-    for (i = 0; i != hm->table_count; ++i)
+    if (hm->flags & HM_VARIABLE_KEYS)
     {
-        if (SLOT(hm, i) == HM_SLOT_UNUSED || SLOT(hm, i) == HM_SLOT_RIP)
-            continue;
-        if (hashmap_insert(&new_hm, KEY(hm, i), VALUE(hm, i)) != HM_OK)
-        {
-            FREE(new_hm.storage);
-            return -1;
-        }
+        const struct str_key* str = (const struct str_key*)key;
+        const struct key_ref* ref = (const struct key_ref*)KEY(hm, pos);
+        return ref->length == str->length &&
+            memcmp((uint8_t*)hm->key_arena + ref->offset, str->data, str->length) == 0;
     }
 
-    /* Swap storage and free old */
-    FREE(hm->storage);
-    hm->storage = new_hm.storage;
-    hm->table_count = new_table_count;
+    return memcmp(KEY(hm, pos), key, hm->key_size) == 0;
+}
 
-    return 0;
+/* ------------------------------------------------------------------------- */
+/*
+ * Robin Hood: Returns how far the entry in the specified slot is from its
+ * home slot. Also valid for tombstones, which keep their hash.
+ */
+static cs_hashmap_size
+rh_distance(const struct cs_hashmap* hm, cs_hashmap_size pos)
+{
+    return (pos - home_slot(hm, SLOT(hm, pos))) & SLOT_MASK(hm);
 }
 
 /* ------------------------------------------------------------------------- */
-enum cs_hashmap_status
-hashmap_create(struct cs_hashmap** hm, cs_hash32 key_size, cs_hash32 value_size)
+static void
+move_slot(struct cs_hashmap* hm, cs_hashmap_size dst, cs_hashmap_size src)
 {
-    return hashmap_create_with_options(hm, key_size, value_size,
-                                       HM_DEFAULT_TABLE_COUNT,
-                                       hash32_jenkins_oaat);
+    CTRL(hm, dst) = CTRL(hm, src);
+    memcpy(&SLOT(hm, dst), &SLOT(hm, src), sizeof(cs_hashmap_hash) + hm->key_size);
+    memcpy(VALUE(hm, dst), VALUE(hm, src), hm->value_size);
 }
 
 /* ------------------------------------------------------------------------- */
-CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
-hashmap_create_with_options(struct cs_hashmap** hm,
-                            uint32_t key_size,
-                            uint32_t value_size,
-                            uint32_t table_count,
-                            hash32_func hash_func)
+/* Swaps the hashes, keys and values of two slots. Tags are left alone. */
+static void
+swap_slots(struct cs_hashmap* hm, cs_hashmap_size a, cs_hashmap_size b)
 {
-    *hm = MALLOC(sizeof(**hm));
-    if (*hm == NULL)
-        return HM_OOM;
+    memcpy(SCRATCH_SLOT(hm), &SLOT(hm, a), sizeof(cs_hashmap_hash) + hm->key_size);
+    memcpy(SCRATCH_VALUE(hm), VALUE(hm, a), hm->value_size);
+    memcpy(&SLOT(hm, a), &SLOT(hm, b), sizeof(cs_hashmap_hash) + hm->key_size);
+    memcpy(VALUE(hm, a), VALUE(hm, b), hm->value_size);
+    memcpy(&SLOT(hm, b), SCRATCH_SLOT(hm), sizeof(cs_hashmap_hash) + hm->key_size);
+    memcpy(VALUE(hm, b), SCRATCH_VALUE(hm), hm->value_size);
+}
 
-    return hashmap_init_with_options(*hm, key_size, value_size,
-                                     table_count, hash_func);
+/* ------------------------------------------------------------------------- */
+static cs_hashmap_size
+rh_find_slot(const struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash)
+{
+    cs_hashmap_size pos = home_slot(hm, hash);
+    cs_hashmap_size dist = 0;
+    uint8_t h2 = H2(hash);
+
+    /* The table is never full, so there is always an empty slot to stop at */
+    while (CTRL(hm, pos) != HM_CTRL_EMPTY)
+    {
+        if (CTRL(hm, pos) == h2 && SLOT(hm, pos) == hash &&
+            keys_equal(hm, pos, key))
+            return pos;
+
+        /* If the key existed, it would have displaced this entry */
+        if (rh_distance(hm, pos) < dist)
+            break;
+
+        pos = (pos + 1) & SLOT_MASK(hm);
+        dist++;
+    }
+
+    return HM_INVALID_POS;
 }
 
 /* ------------------------------------------------------------------------- */
-enum cs_hashmap_status
-hashmap_init(struct cs_hashmap* hm, cs_hash32 key_size, cs_hash32 value_size)
+/*
+ * Robin Hood: Makes room for a new entry at pos. Because entries are ordered
+ * by home slot, displacing the remainder of the cluster is the same as
+ * shifting everything up to the next empty slot along by one.
+ */
+static void
+rh_make_room(struct cs_hashmap* hm, cs_hashmap_size pos)
 {
-    return hashmap_init_with_options(hm, key_size, value_size,
-                                     HM_DEFAULT_TABLE_COUNT, hash32_jenkins_oaat);
+    cs_hashmap_size end = pos;
+    while (CTRL(hm, end) != HM_CTRL_EMPTY)
+        end = (end + 1) & SLOT_MASK(hm);
+
+    while (end != pos)
+    {
+        cs_hashmap_size prev = (end - 1) & SLOT_MASK(hm);
+        move_slot(hm, end, prev);
+        end = prev;
+    }
 }
 
 /* ------------------------------------------------------------------------- */
-enum cs_hashmap_status
-hashmap_init_with_options(struct cs_hashmap* hm,
-                          uint32_t key_size,
-                          uint32_t value_size,
-                          uint32_t table_count,
-                          hash32_func hash_func)
+/*
+ * Robin Hood: Writes the slot at which a key with the specified hash should
+ * be inserted to "slot" and returns HM_OK. If the key already exists, its slot
+ * is written instead and HM_EXISTS is returned. If "key" is NULL, the key is
+ * known to be unique and no comparisons are made.
+ */
+static enum cs_hashmap_status
+rh_find_insert_slot(struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash, cs_hashmap_size* slot)
 {
-    assert(hm);
-    assert(key_size > 0);
-    assert(table_count > 0);
-    assert(hash_func);
+    cs_hashmap_size pos = home_slot(hm, hash);
+    cs_hashmap_size dist = 0;
+    uint8_t h2 = H2(hash);
 
-    hm->key_size = key_size;
-    hm->value_size = value_size;
-    hm->hash = hash_func;
-    hm->slots_used = 0;
-    hm->table_count = table_count;
-    hm->storage = malloc_and_init_storage(hm->key_size, hm->value_size, hm->table_count);
-    if (hm->storage == NULL)
-        return HM_OOM;
+    while (CTRL(hm, pos) != HM_CTRL_EMPTY)
+    {
+        if (key && CTRL(hm, pos) == h2)
+        {
+            if (SLOT(hm, pos) == hash && keys_equal(hm, pos, key))
+            {
+                *slot = pos;
+                return HM_EXISTS;
+            }
+            STATS_TAG_COLLISION(hm);
+        }
 
-    STATS_INIT(hm);
+        /* Take from the rich: this entry is closer to home than we are */
+        if (rh_distance(hm, pos) < dist)
+            break;
+
+        pos = (pos + 1) & SLOT_MASK(hm);
+        dist++;
+        STATS_INSERTION_PROBE(hm);
+    }
 
+    rh_make_room(hm, pos);
+    *slot = pos;
     return HM_OK;
 }
 
 /* ------------------------------------------------------------------------- */
-void
-hashmap_deinit(struct cs_hashmap* hm)
+/*
+ * Robin Hood: Removes the entry by shifting all following entries of the
+ * cluster back by one, until an empty slot or an entry in its home slot is
+ * reached. No tombstones are necessary. The value is moved to the scratch
+ * area so the returned pointer remains valid.
+ */
+static void*
+rh_erase_slot(struct cs_hashmap* hm, cs_hashmap_size pos)
 {
-    STATS_REPORT(hm);
-    FREE(hm->storage);
+    cs_hashmap_size next = (pos + 1) & SLOT_MASK(hm);
+
+    memcpy(SCRATCH_VALUE(hm), VALUE(hm, pos), hm->value_size);
+    while (CTRL(hm, next) != HM_CTRL_EMPTY && rh_distance(hm, next) != 0)
+    {
+        move_slot(hm, pos, next);
+        pos = next;
+        next = (next + 1) & SLOT_MASK(hm);
+    }
+    CTRL(hm, pos) = HM_CTRL_EMPTY;
+
+    return SCRATCH_VALUE(hm);
 }
 
 /* ------------------------------------------------------------------------- */
-void
-hashmap_free(struct cs_hashmap* hm)
+static void*
+malloc_and_init_storage(const struct cs_hashmap* hm, cs_hashmap_size table_count)
 {
-    hashmap_deinit(hm);
-    FREE(hm);
+    /* Store the tags, hashes, keys and values in one contiguous chunk of memory */
+    void* storage = ALLOCATOR_MALLOC(hm->allocator, STORAGE_SIZE(hm, table_count));
+    if (storage == NULL)
+        return NULL;
+
+    /* Only the tags need initializing, everything else is written on insert */
+    memset(storage, HM_CTRL_EMPTY, table_count);
+    return storage;
 }
 
 /* ------------------------------------------------------------------------- */
-enum cs_hashmap_status
-hashmap_insert(struct cs_hashmap* hm, const void* key, const void* value)
+/*
+ * Returns the slot holding the key, or HM_INVALID_POS if the key does not
+ * exist.
+ */
+static cs_hashmap_size
+find_slot(const struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash)
 {
-    cs_hash32 hash, pos, i, last_tombstone;
-
-    /* NOTE: Rehashing may change table count, make sure to compute hash after this */
-    if (hm->slots_used * 100 / hm->table_count >= HM_REHASH_AT_PERCENT)
-        if (resize_rehash(hm, hm->table_count * HM_EXPAND_FACTOR) != 0)
-            return HM_OOM;
+    cs_hashmap_size group = home_group(hm, hash);
+    uint8_t h2 = H2(hash);
+    cs_hashmap_size i;
 
-    /* Init values */
-    hash = hash_wrapper(hm, key, hm->key_size);
-    pos = hash % hm->table_count;
-    i = 0;
-    last_tombstone = HM_SLOT_INVALID;
+    if (hm->flags & HM_ROBIN_HOOD)
+        return rh_find_slot(hm, key, hash);
 
-    while (SLOT(hm, pos) != HM_SLOT_UNUSED)
+    for (i = 0; i != GROUP_COUNT(hm); ++i)
     {
-        /* If the same hash already exists in this slot, and this isn't the
-         * result of a hash collision (which we can verify by comparing the
-         * original keys), then we can conclude this key was already inserted */
-        if (SLOT(hm, pos) == hash)
+        const uint8_t* ctrl = &CTRL(hm, group * HM_GROUP_SIZE);
+        uint32_t match = cs_hm_group_match(ctrl, h2);
+        while (match)
         {
-            if (memcmp(KEY(hm, pos), key, hm->key_size) == 0)
-                return HM_EXISTS;
+            cs_hashmap_size pos = group * HM_GROUP_SIZE + (cs_hashmap_size)cs_hm_ctz32(match);
+            if (SLOT(hm, pos) == hash && keys_equal(hm, pos, key))
+                return pos;
+            match &= match - 1;
         }
-        else
-            if (SLOT(hm, pos) == HM_SLOT_RIP)
-                last_tombstone = pos;
-
-        /* Quadratic probing following p(K,i)=(i^2+i)/2. If the hash table
-         * size is a power of two, this will visit every slot */
-        i++;
-        pos += i;
-        pos = pos % hm->table_count;
-        STATS_INSERTION_PROBE(hm);
-    }
 
-    /* It's safe to insert new values at the end of a probing sequence */
-    if (last_tombstone != HM_SLOT_INVALID)
-    {
-        pos = last_tombstone;
-        STATS_INSERTED_IN_TOMBSTONE(hm);
+        /* An empty tag in the group means the probing sequence ends here */
+        if (cs_hm_group_match_empty(ctrl))
+            break;
+
+        /* Quadratic probing over groups following p(K,i)=(i^2+i)/2. The
+         * group count is a power of two, so this will visit every group */
+        group = (group + i + 1) & GROUP_MASK(hm);
     }
-    else
+
+    return HM_INVALID_POS;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Places an entry into a table that contains no entry with the same key,
+ * i.e. the new table during a rehash. The entry's
+ * stored hash is reused, so no hashing or key comparisons are necessary. The
+ * hash and key are adjacent in memory and are moved with a single copy.
+ */
+static void
+place_rehashed(struct cs_hashmap* hm, const void* slot, cs_hashmap_hash hash, const void* value)
+{
+    cs_hashmap_size group = home_group(hm, hash);
+    cs_hashmap_size i, pos;
+    uint32_t empty;
+
+    if (hm->flags & HM_ROBIN_HOOD)
     {
-        STATS_INSERTED_IN_UNUSED(hm);
+        rh_find_insert_slot(hm, NULL, hash, &pos);
+        CTRL(hm, pos) = H2(hash);
+        memcpy(&SLOT(hm, pos), slot, sizeof(cs_hashmap_hash) + hm->key_size);
+        memcpy(VALUE(hm, pos), value, hm->value_size);
+        return;
     }
 
-    /* Store hash, key and value */
-    SLOT(hm, pos) = hash;
-    memcpy(KEY(hm, pos), key, hm->key_size);
-    if (value)  /* value may be NULL, and memcpy() with a NULL source is undefined, even if len is 0 */
-        memcpy(VALUE(hm, pos), value, hm->value_size);
+    for (i = 0; (empty = cs_hm_group_match_empty(&CTRL(hm, group * HM_GROUP_SIZE))) == 0; ++i)
+        group = (group + i + 1) & GROUP_MASK(hm);
 
-    hm->slots_used++;
+    pos = group * HM_GROUP_SIZE + (cs_hashmap_size)cs_hm_ctz32(empty);
+    CTRL(hm, pos) = H2(hash);
+    memcpy(&SLOT(hm, pos), slot, sizeof(cs_hashmap_hash) + hm->key_size);
+    memcpy(VALUE(hm, pos), value, hm->value_size);
+}
 
-    return HM_OK;
+/* ------------------------------------------------------------------------- */
+/*
+ * Group probing: Returns the first empty or deleted slot along the probing
+ * sequence of the specified hash.
+ */
+static cs_hashmap_size
+find_first_non_full(const struct cs_hashmap* hm, cs_hashmap_hash hash)
+{
+    cs_hashmap_size group = home_group(hm, hash);
+    cs_hashmap_size i;
+    uint32_t available;
+
+    for (i = 0; (available = cs_hm_group_match_empty_or_deleted(&CTRL(hm, group * HM_GROUP_SIZE))) == 0; ++i)
+        group = (group + i + 1) & GROUP_MASK(hm);
+
+    return group * HM_GROUP_SIZE + (cs_hashmap_size)cs_hm_ctz32(available);
 }
 
 /* ------------------------------------------------------------------------- */
-void*
-hashmap_erase(struct cs_hashmap* hm, const void* key)
+/*
+ * Group probing: Purges all tombstones by re-placing every entry within the
+ * same table. No memory is allocated.
+ *
+ * All tombstones are turned into empty slots and all entries are marked as
+ * deleted, which here means "not yet placed". Each unplaced entry then either
+ * stays where it is, if it already sits in the first group of its probing
+ * sequence that has room, or moves forward along its sequence into an empty
+ * slot, or swaps with an unplaced entry, which is then processed in turn.
+ */
+static void
+rehash_in_place(struct cs_hashmap* hm)
 {
-    cs_hash32 hash = hash_wrapper(hm, key, hm->key_size);
-    cs_hash32 pos = hash % hm->table_count;
-    cs_hash32 i = 0;
+    cs_hashmap_size pos;
+
+    assert(!(hm->flags & HM_ROBIN_HOOD));
+    assert(hm->old_storage == NULL);
+
+    STATS_REHASH(hm);
+
+    for (pos = 0; pos != hm->table_count; ++pos)
+        CTRL(hm, pos) = HM_CTRL_IS_FULL(CTRL(hm, pos)) ? HM_CTRL_DELETED : HM_CTRL_EMPTY;
 
-    while (1)
+    pos = 0;
+    while (pos != hm->table_count)
     {
-        if (SLOT(hm, pos) == hash)
+        cs_hashmap_hash hash, target;
+
+        if (CTRL(hm, pos) != HM_CTRL_DELETED)
+        {
+            pos++;
+            continue;
+        }
+
+        hash = SLOT(hm, pos);
+        target = find_first_non_full(hm, hash);
+
+        if (target / HM_GROUP_SIZE == pos / HM_GROUP_SIZE)
         {
-            if (memcmp(KEY(hm, pos), key, hm->key_size) == 0)
-                break;
+            CTRL(hm, pos) = H2(hash);
+            pos++;
+        }
+        else if (CTRL(hm, target) == HM_CTRL_EMPTY)
+        {
+            move_slot(hm, target, pos);
+            CTRL(hm, target) = H2(hash);
+            CTRL(hm, pos) = HM_CTRL_EMPTY;
+            pos++;
         }
         else
         {
-            if (SLOT(hm, pos) == HM_SLOT_UNUSED)
-                return NULL;
+            /* Target holds another unplaced entry, which ends up in pos and
+             * is processed next */
+            swap_slots(hm, pos, target);
+            CTRL(hm, target) = H2(hash);
         }
-
-        /* Quadratic probing following p(K,i)=(i^2+i)/2. If the hash table
-         * size is a power of two, this will visit every slot */
-        i++;
-        pos += i;
-        pos = pos % hm->table_count;
-        STATS_DELETION_PROBE(hm);
     }
 
-    hm->slots_used--;
-    STATS_DELETED(hm);
+    hm->tombstones = 0;
+}
 
-    SLOT(hm, pos) = HM_SLOT_RIP;
-    return VALUE(hm, pos);
+/* ------------------------------------------------------------------------- */
+/*
+ * While an incremental rehash is in progress, this returns a hashmap that
+ * refers to the old table so the usual macros and probing functions can be
+ * used on it.
+ */
+static void
+old_table_view(const struct cs_hashmap* hm, struct cs_hashmap* old)
+{
+    memcpy(old, hm, sizeof(struct cs_hashmap));
+    old->storage = hm->old_storage;
+    old->table_count = hm->old_table_count;
 }
 
 /* ------------------------------------------------------------------------- */
-void*
-hashmap_find(const struct cs_hashmap* hm, const void* key)
+/*
+ * Looks up a key in the old table of an incremental rehash. Migrated groups
+ * are left untouched so the probing sequences of the remaining entries stay
+ * intact, which means a match in a migrated group is stale.
+ */
+static cs_hashmap_size
+find_old_slot(const struct cs_hashmap* hm, struct cs_hashmap* old, const void* key, cs_hashmap_hash hash)
+{
+    cs_hashmap_size pos;
+    old_table_view(hm, old);
+    pos = find_slot(old, key, hash);
+    if (pos != HM_INVALID_POS && pos / HM_GROUP_SIZE < hm->old_groups_migrated)
+        return HM_INVALID_POS;
+    return pos;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Moves the next "groups" groups of the old table into the current table.
+ * Frees the old table once all groups have been migrated.
+ */
+static void
+migrate_groups(struct cs_hashmap* hm, cs_hashmap_size groups)
 {
-    cs_hash32 hash = hash_wrapper(hm, key, hm->key_size);
-    cs_hash32 pos = hash % hm->table_count;
-    cs_hash32 i = 0;
-    while (1)
+    struct cs_hashmap old_view;
+    struct cs_hashmap* old = &old_view;
+    cs_hashmap_size group, end;
+
+    old_table_view(hm, old);
+    end = GROUP_COUNT(old) - hm->old_groups_migrated < groups ?
+        GROUP_COUNT(old) : hm->old_groups_migrated + groups;
+
+    for (group = hm->old_groups_migrated; group != end; ++group)
     {
-        if (SLOT(hm, pos) == hash)
-        {
-            if (memcmp(KEY(hm, pos), key, hm->key_size) == 0)
-                break;
-        }
-        else
+        /* Skip over empty groups in one go */
+        uint32_t full = ~cs_hm_group_match_empty_or_deleted(&CTRL(old, group * HM_GROUP_SIZE)) & 0xFFFF;
+        while (full)
         {
-            if (SLOT(hm, pos) == HM_SLOT_UNUSED)
-                return NULL;
+            cs_hashmap_size pos = group * HM_GROUP_SIZE + (cs_hashmap_size)cs_hm_ctz32(full);
+            place_rehashed(hm, &SLOT(old, pos), SLOT(old, pos), VALUE(old, pos));
+            full &= full - 1;
         }
+    }
 
-        /* Quadratic probing following p(K,i)=(i^2+i)/2. If the hash table
-         * size is a power of two, this will visit every slot */
-        i++;
-        pos += i;
-        pos = pos % hm->table_count;
+    hm->old_groups_migrated = end;
+    if (end == GROUP_COUNT(old))
+    {
+        ALLOCATOR_FREE(hm->allocator, hm->old_storage);
+        hm->old_storage = NULL;
     }
+}
 
-    return VALUE(hm, pos);
+/* ------------------------------------------------------------------------- */
+static int
+resize_rehash(struct cs_hashmap* hm, cs_hashmap_size new_table_count)
+{
+    void* new_storage;
+
+    /* Only one old table can exist at a time */
+    hashmap_finish_rehash(hm);
+    assert((uint64_t)hm->slots_used * 100 / new_table_count < HM_REHASH_AT_PERCENT);
+
+    STATS_REHASH(hm);
+
+    new_storage = malloc_and_init_storage(hm, new_table_count);
+    if (new_storage == NULL)
+        return -1;
+
+    /* The current table becomes the old table */
+    hm->old_storage = hm->storage;
+    hm->old_table_count = hm->table_count;
+    hm->old_groups_migrated = 0;
+    hm->storage = new_storage;
+    hm->table_count = new_table_count;
+    hm->tombstones = 0;
+
+    if (!(hm->flags & HM_INCREMENTAL_REHASH))
+        hashmap_finish_rehash(hm);
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Grows the table by HM_EXPAND_FACTOR. Fails like an allocation failure if
+ * the new slot count would exceed HM_MAX_TABLE_COUNT, where it would no
+ * longer fit in cs_hashmap_size.
+ */
+static int
+grow(struct cs_hashmap* hm)
+{
+    if ((uint64_t)hm->table_count * HM_EXPAND_FACTOR > HM_MAX_TABLE_COUNT)
+        return -1;
+    return resize_rehash(hm, hm->table_count * HM_EXPAND_FACTOR);
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Copies the live keys into a new arena, dropping the bytes of erased keys.
+ * The references in every slot are updated accordingly.
+ */
+static int
+compact_key_arena(struct cs_hashmap* hm, uint32_t capacity)
+{
+    uint8_t* arena;
+    uint32_t size = 0;
+    cs_hashmap_size pos;
+
+    /* Otherwise the old table would have to be updated as well */
+    hashmap_finish_rehash(hm);
+
+    arena = ALLOCATOR_MALLOC(hm->allocator, capacity);
+    if (arena == NULL)
+        return -1;
+
+    for (pos = 0; pos != hm->table_count; ++pos)
+    {
+        struct key_ref* ref;
+        if (!HM_CTRL_IS_FULL(CTRL(hm, pos)))
+            continue;
+        ref = (struct key_ref*)KEY(hm, pos);
+        memcpy(arena + size, (uint8_t*)hm->key_arena + ref->offset, ref->length);
+        ref->offset = size;
+        size += ref->length;
+    }
+
+    ALLOCATOR_XFREE(hm->allocator, hm->key_arena);
+    hm->key_arena = arena;
+    hm->key_arena_size = size;
+    hm->key_arena_capacity = capacity;
+    hm->key_arena_garbage = 0;
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Makes sure the key arena has room for another "length" bytes. If at least
+ * half of the arena is taken up by erased keys, it is compacted instead of
+ * grown.
+ */
+static int
+reserve_key_arena(struct cs_hashmap* hm, uint32_t length)
+{
+    uint64_t needed = (uint64_t)hm->key_arena_size + length;
+    uint64_t capacity;
+    void* arena;
+
+    if (needed <= hm->key_arena_capacity)
+        return 0;
+
+    if (hm->key_arena_garbage >= hm->key_arena_size / 2)
+    {
+        uint64_t live = hm->key_arena_size - hm->key_arena_garbage + length;
+        capacity = live * 2 > HM_MIN_KEY_ARENA ? live * 2 : HM_MIN_KEY_ARENA;
+        if (capacity > (uint32_t)-1)
+            capacity = (uint32_t)-1;
+        return compact_key_arena(hm, (uint32_t)capacity);
+    }
+
+    capacity = (uint64_t)hm->key_arena_capacity * 2;
+    if (capacity < needed)
+        capacity = needed;
+    if (capacity < HM_MIN_KEY_ARENA)
+        capacity = HM_MIN_KEY_ARENA;
+    if (capacity > (uint32_t)-1)
+    {
+        if (needed > (uint32_t)-1)
+            return -1;
+        capacity = (uint32_t)-1;
+    }
+
+    /* Keys are referred to by offset, so the arena can move */
+    arena = ALLOCATOR_REALLOC(hm->allocator, hm->key_arena, (uintptr_t)capacity);
+    if (arena == NULL)
+        return -1;
+    hm->key_arena = arena;
+    hm->key_arena_capacity = (uint32_t)capacity;
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+store_key(struct cs_hashmap* hm, cs_hashmap_size pos, const void* key)
+{
+    if (hm->flags & HM_VARIABLE_KEYS)
+    {
+        const struct str_key* str = (const struct str_key*)key;
+        struct key_ref* ref = (struct key_ref*)KEY(hm, pos);
+        assert(hm->key_arena_size + str->length <= hm->key_arena_capacity);
+        ref->length = str->length;
+        ref->offset = hm->key_arena_size;
+        memcpy((uint8_t*)hm->key_arena + hm->key_arena_size, str->data, str->length);
+        hm->key_arena_size += str->length;
+    }
+    else
+        memcpy(KEY(hm, pos), key, hm->key_size);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Called when erasing a slot. The key's bytes remain until compaction. */
+static void
+release_key(struct cs_hashmap* hm, const void* slot_key)
+{
+    if (hm->flags & HM_VARIABLE_KEYS)
+        hm->key_arena_garbage += ((const struct key_ref*)slot_key)->length;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Files written by hashmap_save() start with this header, followed by the
+ * storage block and, with HM_VARIABLE_KEYS, the key arena. The header size
+ * is a multiple of 16 so the storage keeps the alignment of the mapping.
+ */
+#define HM_FILE_MAGIC   "CSHM"
+#define HM_FILE_VERSION 2
+#define HM_FILE_ENDIAN  0x01020304u
+#define HM_FILE_FLAGS   (HM_INCREMENTAL_REHASH | HM_ROBIN_HOOD | HM_SHRINK | HM_VARIABLE_KEYS)
+
+struct hm_file_header
+{
+    char     magic[4];
+    uint32_t version;
+    uint32_t endian;          /* HM_FILE_ENDIAN as written by the saving machine */
+    uint32_t group_size;      /* HM_GROUP_SIZE, which determines the probing sequence */
+    uint32_t hash_bits;       /* 32, or 64 with CSTRUCTURES_HASHMAP_64BIT */
+    uint32_t hash_id;         /* Index into g_file_hash_funcs */
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t flags;
+    uint32_t key_arena_size;
+    uint64_t table_count;
+    uint64_t slots_used;
+    uint64_t tombstones;
+    uint64_t storage_size;
+    uint64_t reserved;
+};
+
+/*
+ * Hash functions can't be saved, so files refer to them by their index in
+ * this table. Entries may only be appended. Pointer hashes are missing on
+ * purpose, as pointers don't survive a restart.
+ */
+#if defined(CSTRUCTURES_HASHMAP_64BIT)
+static const hashmap_hash_func g_file_hash_funcs[] = {
+    NULL,
+    hash64_wyhash
+};
+#else
+static const hashmap_hash_func g_file_hash_funcs[] = {
+    NULL,
+    hash32_jenkins_oaat,
+    hash32_wyhash,
+    hash32_crc32c,
+    hash32_u32,
+    hash32_u64
+};
+#endif
+
+/* ------------------------------------------------------------------------- */
+static uint32_t
+file_hash_id(hashmap_hash_func hash)
+{
+    uint32_t id;
+    for (id = 1; id != sizeof(g_file_hash_funcs) / sizeof(*g_file_hash_funcs); ++id)
+        if (g_file_hash_funcs[id] == hash)
+            return id;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static int
+write_all(int fd, const void* data, uint64_t size)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    while (size)
+    {
+        /* Some platforms limit a single write to less than 2 GB */
+        unsigned chunk = size > (1u << 30) ? (1u << 30) : (unsigned)size;
+        int written = (int)write(fd, p, chunk);
+        if (written <= 0)
+            return -1;
+        p += written;
+        size -= (unsigned)written;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Batches the many small writes of hashmap_save(). A NULL data pointer
+ * writes zeros.
+ */
+struct file_writer
+{
+    int fd;
+    int error;
+    uint32_t used;
+    uint8_t buf[4096];
+};
+
+static void
+file_writer_flush(struct file_writer* w)
+{
+    if (w->used && !w->error)
+        w->error = write_all(w->fd, w->buf, w->used);
+    w->used = 0;
+}
+
+static void
+file_writer_put(struct file_writer* w, const void* data, uint64_t size)
+{
+    if (data && size >= sizeof(w->buf))
+    {
+        file_writer_flush(w);
+        if (!w->error)
+            w->error = write_all(w->fd, data, size);
+        return;
+    }
+
+    while (size)
+    {
+        uint32_t chunk = (uint32_t)sizeof(w->buf) - w->used;
+        if (chunk > size)
+            chunk = (uint32_t)size;
+        if (data)
+        {
+            memcpy(w->buf + w->used, data, chunk);
+            data = (const uint8_t*)data + chunk;
+        }
+        else
+            memset(w->buf + w->used, 0, chunk);
+        w->used += chunk;
+        size -= chunk;
+        if (w->used == sizeof(w->buf))
+            file_writer_flush(w);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+unmap_file(struct cs_hashmap* hm)
+{
+    uint8_t* base = (uint8_t*)hm->storage - sizeof(struct hm_file_header);
+#if defined(_WIN32)
+    UnmapViewOfFile(base);
+#else
+    munmap(base, (size_t)hm->mapped_size);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_create(struct cs_hashmap** hm, uint32_t key_size, uint32_t value_size)
+{
+    return hashmap_create_with_options(hm, key_size, value_size,
+                                       HM_DEFAULT_TABLE_COUNT,
+                                       HM_DEFAULT_HASH, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+CSTRUCTURES_PRIVATE_API enum cs_hashmap_status
+hashmap_create_with_options(struct cs_hashmap** hm,
+                            uint32_t key_size,
+                            uint32_t value_size,
+                            cs_hashmap_size table_count,
+                            hashmap_hash_func hash_func,
+                            uint32_t flags)
+{
+    *hm = MALLOC(sizeof(**hm));
+    if (*hm == NULL)
+        return HM_OOM;
+
+    return hashmap_init_with_options(*hm, key_size, value_size,
+                                     table_count, hash_func, flags);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_init(struct cs_hashmap* hm, uint32_t key_size, uint32_t value_size)
+{
+    return hashmap_init_with_options(hm, key_size, value_size,
+                                     HM_DEFAULT_TABLE_COUNT, HM_DEFAULT_HASH, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_init_with_options(struct cs_hashmap* hm,
+                          uint32_t key_size,
+                          uint32_t value_size,
+                          cs_hashmap_size table_count,
+                          hashmap_hash_func hash_func,
+                          uint32_t flags)
+{
+    return hashmap_init_with_allocator(hm, key_size, value_size, table_count,
+                                       hash_func, flags, &memory_default_allocator);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_init_with_allocator(struct cs_hashmap* hm,
+                            uint32_t key_size,
+                            uint32_t value_size,
+                            cs_hashmap_size table_count,
+                            hashmap_hash_func hash_func,
+                            uint32_t flags,
+                            const struct cs_allocator* allocator)
+{
+    assert(hm);
+    assert(allocator);
+    assert(key_size > 0 || (flags & HM_VARIABLE_KEYS));
+    assert(table_count > 0);
+    assert(hash_func);
+
+    /* Probing works on whole groups of tags and requires a power of two */
+    if (table_count < HM_GROUP_SIZE)
+        table_count = HM_GROUP_SIZE;
+    table_count = next_power_of_two(table_count);
+
+    /* The slots only hold a reference into the key arena */
+    if (flags & HM_VARIABLE_KEYS)
+        key_size = sizeof(struct key_ref);
+
+    hm->key_size = key_size;
+    hm->value_size = value_size;
+    hm->hash = hash_func;
+    hm->key_hash = NULL;
+    hm->key_hash_user = NULL;
+    hm->allocator = allocator;
+    hm->flags = flags;
+    hm->slots_used = 0;
+    hm->tombstones = 0;
+    hm->table_count = table_count;
+    hm->old_storage = NULL;
+    hm->old_table_count = 0;
+    hm->old_groups_migrated = 0;
+    hm->key_arena = NULL;
+    hm->key_arena_size = 0;
+    hm->key_arena_capacity = 0;
+    hm->key_arena_garbage = 0;
+    hm->mapped_size = 0;
+    hm->storage = malloc_and_init_storage(hm, hm->table_count);
+    if (hm->storage == NULL)
+        return HM_OOM;
+
+    STATS_INIT(hm);
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+hashmap_deinit(struct cs_hashmap* hm)
+{
+    STATS_REPORT(hm);
+    if (hm->flags & HM_MAPPED)
+    {
+        unmap_file(hm);
+        return;
+    }
+    ALLOCATOR_XFREE(hm->allocator, hm->key_arena);
+    ALLOCATOR_XFREE(hm->allocator, hm->old_storage);
+    ALLOCATOR_FREE(hm->allocator, hm->storage);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+hashmap_free(struct cs_hashmap* hm)
+{
+    hashmap_deinit(hm);
+    FREE(hm);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+hashmap_set_key_hash(struct cs_hashmap* hm,
+                     hashmap_key_hash_func key_hash,
+                     void* user)
+{
+    /* Existing entries would have to be rehashed */
+    assert(hm->slots_used == 0);
+    assert(!(hm->flags & (HM_VARIABLE_KEYS | HM_MAPPED)));
+
+    hm->key_hash = key_hash;
+    hm->key_hash_user = user;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+hashmap_finish_rehash(struct cs_hashmap* hm)
+{
+    if (hm->old_storage)
+        migrate_groups(hm, hm->old_table_count / HM_GROUP_SIZE);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_reserve(struct cs_hashmap* hm, cs_hashmap_size element_count)
+{
+    uint64_t table_count;
+    assert(!(hm->flags & HM_MAPPED));
+    if ((uint64_t)element_count > HM_MAX_TABLE_COUNT)
+        return HM_OOM;
+
+    /* Insertion rehashes once slots_used reaches HM_REHASH_AT_PERCENT */
+    table_count = (uint64_t)element_count * 100 / HM_REHASH_AT_PERCENT + 1;
+    if (table_count > HM_MAX_TABLE_COUNT)
+        return HM_OOM;
+
+    table_count = next_power_of_two((cs_hashmap_size)table_count);
+    if (table_count <= hm->table_count)
+        return HM_OK;
+
+    if (resize_rehash(hm, (cs_hashmap_size)table_count) != 0)
+        return HM_OOM;
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_shrink_to_fit(struct cs_hashmap* hm)
+{
+    cs_hashmap_size table_count = next_power_of_two(
+        (cs_hashmap_size)((uint64_t)hm->slots_used * 100 / HM_REHASH_AT_PERCENT + 1));
+    assert(!(hm->flags & HM_MAPPED));
+    if (table_count < HM_GROUP_SIZE)
+        table_count = HM_GROUP_SIZE;
+
+    if (table_count < hm->table_count)
+    {
+        if (resize_rehash(hm, table_count) != 0)
+            return HM_OOM;
+        hashmap_finish_rehash(hm);
+    }
+    else
+    {
+        hashmap_finish_rehash(hm);
+        if (hm->tombstones)
+            rehash_in_place(hm);
+    }
+
+    if (hm->key_arena_capacity > hm->key_arena_size - hm->key_arena_garbage)
+    {
+        uint32_t live = hm->key_arena_size - hm->key_arena_garbage;
+        if (live == 0)
+        {
+            ALLOCATOR_XFREE(hm->allocator, hm->key_arena);
+            hm->key_arena = NULL;
+            hm->key_arena_size = 0;
+            hm->key_arena_capacity = 0;
+            hm->key_arena_garbage = 0;
+        }
+        else if (compact_key_arena(hm, live) != 0)
+            return HM_OOM;
+    }
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Tombstones lengthen every probing sequence that passes through them, and
+ * count towards the load just like entries do as far as probing is
+ * concerned. Purges them once there are too many.
+ */
+static void
+purge_tombstones_if_necessary(struct cs_hashmap* hm)
+{
+    if (hm->tombstones == 0)
+        return;
+
+    if ((uint64_t)hm->tombstones * 100 / hm->table_count >= CSTRUCTURES_HASHMAP_TOMBSTONE_PERCENT ||
+        (uint64_t)(hm->slots_used + hm->tombstones) * 100 / hm->table_count >= HM_REHASH_AT_PERCENT)
+    {
+        hashmap_finish_rehash(hm);
+        rehash_in_place(hm);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Halves the table for as long as the load stays below half of
+ * HM_REHASH_AT_PERCENT, which leaves it between a quarter and half of
+ * HM_REHASH_AT_PERCENT, unless the table reaches the minimum size first.
+ * Called before erasing, so pointers returned by hashmap_erase() stay valid.
+ * Failing to allocate the smaller table is not an error.
+ */
+static void
+shrink_if_necessary(struct cs_hashmap* hm)
+{
+    cs_hashmap_size table_count = hm->table_count;
+
+    if (hm->table_count == HM_GROUP_SIZE ||
+        (uint64_t)hm->slots_used * 100 / hm->table_count >= CSTRUCTURES_HASHMAP_SHRINK_AT_PERCENT)
+        return;
+
+    while (table_count > HM_GROUP_SIZE &&
+           (uint64_t)hm->slots_used * 100 / (table_count / 2) < HM_REHASH_AT_PERCENT / 2)
+    {
+        table_count /= 2;
+    }
+
+    if (table_count < hm->table_count)
+        resize_rehash(hm, table_count);
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Group probing: Finds the slot at which a new key should be inserted. Grows
+ * the table if the probing sequence has no free slot. If the key already
+ * exists, its slot is written to "slot" and HM_EXISTS is returned.
+ */
+static enum cs_hashmap_status
+group_find_insert_slot(struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash, cs_hashmap_size* slot)
+{
+    cs_hashmap_size group = home_group(hm, hash);
+    cs_hashmap_size pos = HM_INVALID_POS;
+    uint8_t h2 = H2(hash);
+    cs_hashmap_size i;
+
+    for (i = 0; i != GROUP_COUNT(hm); ++i)
+    {
+        const uint8_t* ctrl = &CTRL(hm, group * HM_GROUP_SIZE);
+        uint32_t match = cs_hm_group_match(ctrl, h2);
+
+        /* If the same hash already exists in this group, and this isn't the
+         * result of a hash collision (which we can verify by comparing the
+         * original keys), then we can conclude this key was already inserted */
+        while (match)
+        {
+            cs_hashmap_size candidate = group * HM_GROUP_SIZE + (cs_hashmap_size)cs_hm_ctz32(match);
+            if (SLOT(hm, candidate) == hash && keys_equal(hm, candidate, key))
+            {
+                *slot = candidate;
+                return HM_EXISTS;
+            }
+            STATS_TAG_COLLISION(hm);
+            match &= match - 1;
+        }
+
+        /* Remember the first free slot along the probing sequence. It's safe
+         * to insert here once we know the key doesn't exist further on */
+        if (pos == HM_INVALID_POS)
+        {
+            uint32_t available = cs_hm_group_match_empty_or_deleted(ctrl);
+            if (available)
+                pos = group * HM_GROUP_SIZE + (cs_hashmap_size)cs_hm_ctz32(available);
+        }
+
+        if (cs_hm_group_match_empty(ctrl))
+            break;
+
+        group = (group + i + 1) & GROUP_MASK(hm);
+        STATS_INSERTION_PROBE(hm);
+    }
+
+    /* Every group is either full or tombstoned. Grow and try again */
+    if (pos == HM_INVALID_POS)
+    {
+        if (grow(hm) != 0)
+            return HM_OOM;
+        return group_find_insert_slot(hm, key, hash, slot);
+    }
+
+    *slot = pos;
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Looks up or creates the slot of a key for which the hash has already been
+ * computed, and points "value" at the slot's value. New slots get their tag,
+ * hash and key, but the value is left for the caller to fill in. The caller is
+ * responsible for checking the load factor.
+ */
+static enum cs_hashmap_status
+emplace_hashed(struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash, void** value)
+{
+    enum cs_hashmap_status status;
+    cs_hashmap_size pos;
+
+    /* Make room for the key's bytes up front, so failing to do so doesn't
+     * leave a half inserted slot behind */
+    if (hm->flags & HM_VARIABLE_KEYS)
+        if (reserve_key_arena(hm, ((const struct str_key*)key)->length) != 0)
+            return HM_OOM;
+
+    /* Keys that haven't been migrated yet still count */
+    if (hm->old_storage)
+    {
+        struct cs_hashmap old;
+        pos = find_old_slot(hm, &old, key, hash);
+        if (pos != HM_INVALID_POS)
+        {
+            *value = VALUE((&old), pos);
+            return HM_EXISTS;
+        }
+    }
+
+    if (hm->flags & HM_ROBIN_HOOD)
+        status = rh_find_insert_slot(hm, key, hash, &pos);
+    else
+        status = group_find_insert_slot(hm, key, hash, &pos);
+    if (status == HM_OOM)
+        return HM_OOM;
+
+    *value = VALUE(hm, pos);
+    if (status == HM_EXISTS)
+        return HM_EXISTS;
+
+    hm->slots_used++;
+    if (CTRL(hm, pos) == HM_CTRL_DELETED)
+    {
+        hm->tombstones--;
+        STATS_INSERTED_IN_TOMBSTONE(hm);
+    }
+    else
+    {
+        STATS_INSERTED_IN_UNUSED(hm);
+    }
+
+    /* Store tag, hash and key */
+    CTRL(hm, pos) = H2(hash);
+    SLOT(hm, pos) = hash;
+    store_key(hm, pos, key);
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+static enum cs_hashmap_status
+insert_hashed(struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash, const void* value)
+{
+    void* slot_value;
+    enum cs_hashmap_status status = emplace_hashed(hm, key, hash, &slot_value);
+
+    /* value may be NULL, and memcpy() with a NULL source is undefined, even if len is 0 */
+    if (status == HM_OK && value)
+        memcpy(slot_value, value, hm->value_size);
+
+    return status;
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_prepare_insert(struct cs_hashmap* hm)
+{
+    assert(!(hm->flags & HM_MAPPED));
+    if (hm->old_storage)
+        migrate_groups(hm, HM_INCREMENTAL_REHASH_STEP);
+
+    /* Same as slots_used * 100 / table_count >= HM_REHASH_AT_PERCENT, but
+     * this runs on every insertion and a division is comparatively slow */
+    if ((uint64_t)hm->slots_used * 100 >= (uint64_t)hm->table_count * HM_REHASH_AT_PERCENT)
+    {
+        if (grow(hm) != 0)
+            return HM_OOM;
+    }
+    else
+        purge_tombstones_if_necessary(hm);
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_insert(struct cs_hashmap* hm, const void* key, const void* value)
+{
+    return hashmap_insert_with_hash(hm, key, HASH_KEY(hm, key), value);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_insert_with_hash(struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash, const void* value)
+{
+    assert(!(hm->flags & HM_VARIABLE_KEYS));
+
+    if (hashmap_prepare_insert(hm) != HM_OK)
+        return HM_OOM;
+
+    return insert_hashed(hm, key, hash, value);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_find_or_emplace(struct cs_hashmap* hm, const void* key, void** value)
+{
+    return hashmap_find_or_emplace_with_hash(hm, key, HASH_KEY(hm, key), value);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_find_or_emplace_with_hash(struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash, void** value)
+{
+    assert(value);
+    assert(!(hm->flags & HM_VARIABLE_KEYS));
+
+    if (hashmap_prepare_insert(hm) != HM_OK)
+        return HM_OOM;
+
+    return emplace_hashed(hm, key, hash, value);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_insert_batch(struct cs_hashmap* hm,
+                     const void* keys,
+                     const void* values,
+                     uint32_t count,
+                     enum cs_hashmap_status* statuses)
+{
+    cs_hashmap_hash hashes[HM_BATCH_SIZE];
+    uint32_t batch, i;
+
+    assert(!(hm->flags & HM_VARIABLE_KEYS));
+
+    /* One allocation for everything. Duplicate keys may cause this to
+     * over-reserve, which is preferable to rehashing halfway through */
+    if ((uint64_t)hm->slots_used + count > HM_MAX_TABLE_COUNT)
+        return HM_OOM;
+    if (hashmap_reserve(hm, (cs_hashmap_size)(hm->slots_used + count)) != HM_OK)
+        return HM_OOM;
+    purge_tombstones_if_necessary(hm);
+
+    for (batch = 0; batch < count; batch += HM_BATCH_SIZE)
+    {
+        uint32_t batch_count = count - batch < HM_BATCH_SIZE ? count - batch : HM_BATCH_SIZE;
+
+        /* Hash the whole window and request the home groups, so the cache
+         * misses overlap with each other and with the hashing */
+        for (i = 0; i != batch_count; ++i)
+        {
+            const uint8_t* key = (const uint8_t*)keys + (uintptr_t)(batch + i) * hm->key_size;
+            cs_hashmap_size group;
+            hashes[i] = HASH_KEY(hm, key);
+            group = home_group(hm, hashes[i]);
+            PREFETCH(&CTRL(hm, group * HM_GROUP_SIZE));
+            PREFETCH(&SLOT(hm, group * HM_GROUP_SIZE));
+        }
+
+        for (i = 0; i != batch_count; ++i)
+        {
+            const uint8_t* key = (const uint8_t*)keys + (uintptr_t)(batch + i) * hm->key_size;
+            const uint8_t* value = values ? (const uint8_t*)values + (uintptr_t)(batch + i) * hm->value_size : NULL;
+            enum cs_hashmap_status status = insert_hashed(hm, key, hashes[i], value);
+            if (statuses)
+                statuses[batch + i] = status;
+            if (status == HM_OOM)
+                return HM_OOM;
+        }
+    }
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Frees the slot for reuse and returns a pointer to its value, which stays
+ * valid until the next modification of the hashmap.
+ */
+static void*
+erase_slot(struct cs_hashmap* hm, cs_hashmap_size pos)
+{
+    STATS_DELETED(hm);
+
+    if (hm->flags & HM_ROBIN_HOOD)
+        return rh_erase_slot(hm, pos);
+
+    /* If the group still has an empty slot, then no probing sequence ever
+     * continued past this group and the slot can be marked empty again.
+     * Otherwise a tombstone is required to keep later slots reachable */
+    if (cs_hm_group_match_empty(&CTRL(hm, pos / HM_GROUP_SIZE * HM_GROUP_SIZE)))
+        CTRL(hm, pos) = HM_CTRL_EMPTY;
+    else
+    {
+        CTRL(hm, pos) = HM_CTRL_DELETED;
+        hm->tombstones++;
+        STATS_TOMBSTONED(hm);
+    }
+
+    return VALUE(hm, pos);
+}
+
+/* ------------------------------------------------------------------------- */
+static void*
+erase_hashed(struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash)
+{
+    cs_hashmap_size pos;
+    assert(!(hm->flags & HM_MAPPED));
+
+    if (hm->flags & HM_SHRINK)
+        shrink_if_necessary(hm);
+    if (hm->old_storage)
+        migrate_groups(hm, HM_INCREMENTAL_REHASH_STEP);
+
+    pos = find_slot(hm, key, hash);
+    if (pos != HM_INVALID_POS)
+    {
+        hm->slots_used--;
+        release_key(hm, KEY(hm, pos));
+        return erase_slot(hm, pos);
+    }
+
+    if (hm->old_storage)
+    {
+        struct cs_hashmap old;
+        pos = find_old_slot(hm, &old, key, hash);
+        if (pos != HM_INVALID_POS)
+        {
+            /* Shifting entries around in the old table could move them into
+             * groups that were already migrated, so use a tombstone. These
+             * are dropped when the old table is freed */
+            hm->slots_used--;
+            release_key(hm, KEY((&old), pos));
+            STATS_DELETED(hm);
+            CTRL((&old), pos) = HM_CTRL_DELETED;
+            return VALUE((&old), pos);
+        }
+    }
+
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+void*
+hashmap_erase(struct cs_hashmap* hm, const void* key)
+{
+    return hashmap_erase_with_hash(hm, key, HASH_KEY(hm, key));
+}
+
+/* ------------------------------------------------------------------------- */
+void*
+hashmap_erase_with_hash(struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash)
+{
+    assert(!(hm->flags & HM_VARIABLE_KEYS));
+    return erase_hashed(hm, key, hash);
+}
+
+/* ------------------------------------------------------------------------- */
+static void*
+find_hashed(const struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash)
+{
+    cs_hashmap_size pos = find_slot(hm, key, hash);
+    if (pos != HM_INVALID_POS)
+        return VALUE(hm, pos);
+
+    if (hm->old_storage)
+    {
+        struct cs_hashmap old;
+        pos = find_old_slot(hm, &old, key, hash);
+        if (pos != HM_INVALID_POS)
+            return VALUE((&old), pos);
+    }
+
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+void*
+hashmap_find(const struct cs_hashmap* hm, const void* key)
+{
+    return hashmap_find_with_hash(hm, key, HASH_KEY(hm, key));
+}
+
+/* ------------------------------------------------------------------------- */
+void*
+hashmap_find_with_hash(const struct cs_hashmap* hm, const void* key, cs_hashmap_hash hash)
+{
+    assert(!(hm->flags & HM_VARIABLE_KEYS));
+    return find_hashed(hm, key, hash);
+}
+
+/* ------------------------------------------------------------------------- */
+uint32_t
+hashmap_find_many(const struct cs_hashmap* hm,
+                  const void* keys,
+                  uint32_t count,
+                  void** values)
+{
+    cs_hashmap_hash hashes[HM_BATCH_SIZE];
+    uint32_t batch, i, found = 0;
+
+    assert(!(hm->flags & HM_VARIABLE_KEYS));
+
+    for (batch = 0; batch < count; batch += HM_BATCH_SIZE)
+    {
+        uint32_t batch_count = count - batch < HM_BATCH_SIZE ? count - batch : HM_BATCH_SIZE;
+
+        /* Stage 1: Hash the whole window and request the home tags */
+        for (i = 0; i != batch_count; ++i)
+        {
+            const uint8_t* key = (const uint8_t*)keys + (uintptr_t)(batch + i) * hm->key_size;
+            hashes[i] = HASH_KEY(hm, key);
+            if (hm->flags & HM_ROBIN_HOOD)
+                PREFETCH(&CTRL(hm, home_slot(hm, hashes[i])));
+            else
+                PREFETCH(&CTRL(hm, home_group(hm, hashes[i]) * HM_GROUP_SIZE));
+        }
+
+        /* Stage 2: The tags have arrived (or are on their way). Request the
+         * hash and key of the first candidate slot */
+        for (i = 0; i != batch_count; ++i)
+        {
+            if (hm->flags & HM_ROBIN_HOOD)
+                PREFETCH(&SLOT(hm, home_slot(hm, hashes[i])));
+            else
+            {
+                cs_hashmap_size group = home_group(hm, hashes[i]);
+                uint32_t match = cs_hm_group_match(&CTRL(hm, group * HM_GROUP_SIZE), H2(hashes[i]));
+                if (match)
+                    PREFETCH(&SLOT(hm, group * HM_GROUP_SIZE + (cs_hashmap_size)cs_hm_ctz32(match)));
+            }
+        }
+
+        /* Stage 3: Resolve the probes, which should mostly hit the cache now */
+        for (i = 0; i != batch_count; ++i)
+        {
+            const uint8_t* key = (const uint8_t*)keys + (uintptr_t)(batch + i) * hm->key_size;
+            values[batch + i] = find_hashed(hm, key, hashes[i]);
+            if (values[batch + i])
+                found++;
+        }
+    }
+
+    return found;
+}
+
+/* ------------------------------------------------------------------------- */
+cs_hashmap_hash
+hashmap_hash_key(const struct cs_hashmap* hm, const void* key)
+{
+    assert(!(hm->flags & HM_VARIABLE_KEYS));
+    return HASH_KEY(hm, key);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_init_str(struct cs_hashmap* hm, uint32_t value_size)
+{
+    return hashmap_init_with_options(hm, sizeof(struct key_ref), value_size,
+                                     HM_DEFAULT_TABLE_COUNT, HM_DEFAULT_HASH,
+                                     HM_VARIABLE_KEYS);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_create_str(struct cs_hashmap** hm, uint32_t value_size)
+{
+    *hm = MALLOC(sizeof(**hm));
+    if (*hm == NULL)
+        return HM_OOM;
+
+    return hashmap_init_str(*hm, value_size);
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+make_str_key(struct str_key* str, const char* key)
+{
+    uintptr_t length = strlen(key);
+    assert(length <= (uint32_t)-1);
+    str->data = key;
+    str->length = (uint32_t)length;
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_insert_str(struct cs_hashmap* hm, const char* key, const void* value)
+{
+    struct str_key str;
+    assert(hm->flags & HM_VARIABLE_KEYS);
+
+    make_str_key(&str, key);
+    if (hashmap_prepare_insert(hm) != HM_OK)
+        return HM_OOM;
+
+    return insert_hashed(hm, &str, hm->hash(str.data, str.length), value);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashmap_find_or_emplace_str(struct cs_hashmap* hm, const char* key, void** value)
+{
+    struct str_key str;
+    assert(value);
+    assert(hm->flags & HM_VARIABLE_KEYS);
+
+    make_str_key(&str, key);
+    if (hashmap_prepare_insert(hm) != HM_OK)
+        return HM_OOM;
+
+    return emplace_hashed(hm, &str, hm->hash(str.data, str.length), value);
+}
+
+/* ------------------------------------------------------------------------- */
+void*
+hashmap_erase_str(struct cs_hashmap* hm, const char* key)
+{
+    struct str_key str;
+    assert(hm->flags & HM_VARIABLE_KEYS);
+
+    make_str_key(&str, key);
+    return erase_hashed(hm, &str, hm->hash(str.data, str.length));
+}
+
+/* ------------------------------------------------------------------------- */
+void*
+hashmap_find_str(const struct cs_hashmap* hm, const char* key)
+{
+    struct str_key str;
+    assert(hm->flags & HM_VARIABLE_KEYS);
+
+    make_str_key(&str, key);
+    return find_hashed(hm, &str, hm->hash(str.data, str.length));
+}
+
+/* ------------------------------------------------------------------------- */
+const char*
+hashmap_key_str(const struct cs_hashmap* hm, const void* slot_key, uint32_t* length)
+{
+    const struct key_ref* ref = (const struct key_ref*)slot_key;
+    assert(hm->flags & HM_VARIABLE_KEYS);
+
+    if (length)
+        *length = ref->length;
+    return (const char*)hm->key_arena + ref->offset;
+}
+
+/* ------------------------------------------------------------------------- */
+int
+hashmap_save(struct cs_hashmap* hm, int fd)
+{
+    struct hm_file_header header;
+    struct file_writer writer;
+    cs_hashmap_size pos;
+
+    memset(&header, 0, sizeof(header));
+    header.hash_id = file_hash_id(hm->hash);
+    if (header.hash_id == 0 || hm->key_hash)
+        return -1;
+
+    /* Only the current table is written */
+    hashmap_finish_rehash(hm);
+
+    memcpy(header.magic, HM_FILE_MAGIC, sizeof(header.magic));
+    header.version = HM_FILE_VERSION;
+    header.endian = HM_FILE_ENDIAN;
+    header.group_size = HM_GROUP_SIZE;
+    header.hash_bits = (uint32_t)sizeof(cs_hashmap_hash) * 8;
+    header.key_size = hm->key_size;
+    header.value_size = hm->value_size;
+    header.table_count = hm->table_count;
+    header.slots_used = hm->slots_used;
+    header.tombstones = hm->tombstones;
+    header.flags = hm->flags & ~(uint32_t)HM_MAPPED;
+    header.key_arena_size = hm->key_arena_size;
+    header.storage_size = STORAGE_SIZE(hm, hm->table_count);
+
+    /* hashmap_open_mmap() maps from the start of the file */
+    if (lseek(fd, 0, SEEK_SET) != 0)
+        return -1;
+
+    /*
+     * The hashes, keys and values of empty and deleted slots, as well as the
+     * scratch slot, were never initialized. Write zeros in their place so no
+     * stale heap contents end up in the file.
+     */
+    writer.fd = fd;
+    writer.error = 0;
+    writer.used = 0;
+
+    file_writer_put(&writer, &header, sizeof(header));
+    file_writer_put(&writer, &CTRL(hm, 0), hm->table_count);
+    for (pos = 0; pos != hm->table_count; ++pos)
+        file_writer_put(&writer, HM_CTRL_IS_FULL(CTRL(hm, pos)) ? &SLOT(hm, pos) : NULL,
+                        sizeof(cs_hashmap_hash) + hm->key_size);
+    for (pos = 0; pos != hm->table_count; ++pos)
+        file_writer_put(&writer, HM_CTRL_IS_FULL(CTRL(hm, pos)) ? VALUE(hm, pos) : NULL,
+                        hm->value_size);
+    /* The scratch slot and the padding up to the end of the storage block */
+    file_writer_put(&writer, NULL, header.storage_size - STORAGE_SIZE(hm, hm->table_count - 1));
+    file_writer_put(&writer, hm->key_arena, header.key_arena_size);
+    file_writer_flush(&writer);
+
+    return writer.error ? -1 : 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Maps the whole file read-only. Returns NULL on failure. */
+static void*
+map_file(const char* path, uint64_t* size)
+{
+#if defined(_WIN32)
+    HANDLE file, mapping;
+    LARGE_INTEGER file_size;
+    void* base = NULL;
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+    {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL)
+        {
+            base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        *size = (uint64_t)file_size.QuadPart;
+    }
+
+    CloseHandle(file);
+    return base;
+#else
+    struct stat st;
+    void* base = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+            base = NULL;
+        *size = (uint64_t)st.st_size;
+    }
+
+    /* The mapping stays valid after closing the file */
+    close(fd);
+    return base;
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+/* Sets *result to a * b. Returns 0 if the product doesn't fit in 64 bits. */
+static int
+checked_mul(uint64_t a, uint64_t b, uint64_t* result)
+{
+    if (a != 0 && b > (uint64_t)-1 / a)
+        return 0;
+    *result = a * b;
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * The file may be corrupted or crafted, so every size that is later used to
+ * address the mapping is checked without trusting any arithmetic on it to
+ * not overflow.
+ */
+static int
+header_is_valid(const struct hm_file_header* header, uint64_t file_size)
+{
+    uint64_t storage_size;
+
+    if (file_size < sizeof(*header))
+        return 0;
+    if (memcmp(header->magic, HM_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != HM_FILE_VERSION ||
+        header->endian != HM_FILE_ENDIAN ||
+        header->group_size != HM_GROUP_SIZE ||
+        header->hash_bits != sizeof(cs_hashmap_hash) * 8)
+    {
+        return 0;
+    }
+    if (header->hash_id == 0 ||
+        header->hash_id >= sizeof(g_file_hash_funcs) / sizeof(*g_file_hash_funcs))
+    {
+        return 0;
+    }
+    if ((header->flags & ~(uint32_t)HM_FILE_FLAGS) != 0 ||
+        ((header->flags & HM_VARIABLE_KEYS) && header->key_size != sizeof(struct key_ref)))
+    {
+        return 0;
+    }
+    if (header->table_count < HM_GROUP_SIZE ||
+        header->table_count > HM_MAX_TABLE_COUNT ||
+        (header->table_count & (header->table_count - 1)) != 0 ||
+        header->slots_used > header->table_count ||
+        header->tombstones > header->table_count - header->slots_used)
+    {
+        return 0;
+    }
+    if (!checked_mul(1 + sizeof(cs_hashmap_hash) + (uint64_t)header->key_size + header->value_size,
+                     header->table_count + 1, &storage_size) ||
+        header->storage_size != storage_size)
+    {
+        return 0;
+    }
+
+    file_size -= sizeof(*header);
+    return file_size >= header->storage_size &&
+           file_size - header->storage_size >= header->key_arena_size;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Every key of a HM_VARIABLE_KEYS map must lie within its key arena */
+static int
+key_refs_are_valid(const struct cs_hashmap* hm)
+{
+    cs_hashmap_size pos;
+    for (pos = 0; pos != hm->table_count; ++pos)
+    {
+        const struct key_ref* ref;
+        if (!HM_CTRL_IS_FULL(CTRL(hm, pos)))
+            continue;
+        ref = (const struct key_ref*)KEY(hm, pos);
+        if ((uint64_t)ref->offset + ref->length > hm->key_arena_size)
+            return 0;
+    }
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+int
+hashmap_open_mmap(struct cs_hashmap* hm, const char* path)
+{
+    const struct hm_file_header* header;
+    uint64_t file_size = 0;
+    uint8_t* base = (uint8_t*)map_file(path, &file_size);
+    if (base == NULL)
+        return -1;
+
+    header = (const struct hm_file_header*)base;
+    if (!header_is_valid(header, file_size))
+    {
+#if defined(_WIN32)
+        UnmapViewOfFile(base);
+#else
+        munmap(base, (size_t)file_size);
+#endif
+        return -1;
+    }
+
+    hm->table_count = (cs_hashmap_size)header->table_count;
+    hm->key_size = header->key_size;
+    hm->value_size = header->value_size;
+    hm->slots_used = (cs_hashmap_size)header->slots_used;
+    hm->tombstones = (cs_hashmap_size)header->tombstones;
+    hm->flags = header->flags | HM_MAPPED;
+    hm->old_table_count = 0;
+    hm->old_groups_migrated = 0;
+    hm->hash = g_file_hash_funcs[header->hash_id];
+    hm->key_hash = NULL;
+    hm->key_hash_user = NULL;
+    hm->allocator = &memory_default_allocator;
+    hm->storage = base + sizeof(*header);
+    hm->old_storage = NULL;
+    hm->key_arena = header->key_arena_size ? base + sizeof(*header) + header->storage_size : NULL;
+    hm->key_arena_size = header->key_arena_size;
+    hm->key_arena_capacity = header->key_arena_size;
+    hm->key_arena_garbage = 0;
+    hm->mapped_size = file_size;
+
+    if ((hm->flags & HM_VARIABLE_KEYS) && !key_refs_are_valid(hm))
+    {
+        unmap_file(hm);
+        return -1;
+    }
+
+    STATS_INIT(hm);
+
+    return 0;
 }
@@ -0,0 +1,421 @@
+#include "cstructures/hashset.h"
+#include "cstructures/hashmap_group.h"
+#include "cstructures/memory.h"
+#include <string.h>
+#include <assert.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#   define PREFETCH(addr) __builtin_prefetch(addr)
+#elif defined(CS_HM_USE_SSE2)
+#   define PREFETCH(addr) _mm_prefetch((const char*)(addr), _MM_HINT_T0)
+#else
+#   define PREFETCH(addr)
+#endif
+
+#define CTRL(hs, pos) (((uint8_t*)(hs)->storage)[pos])
+#define KEY(hs, pos)  ((void*)((uint8_t*)(hs)->storage + (hs)->table_count + (uintptr_t)(hs)->key_size * (pos)))
+
+#define GROUP_COUNT(hs) ((hs)->table_count / HM_GROUP_SIZE)
+#define GROUP_MASK(hs)  (GROUP_COUNT(hs) - 1)
+#define H2(hash) ((uint8_t)((hash) & 0x7F))
+
+#define HM_INVALID_POS ((cs_hash32)-1)
+
+/* ------------------------------------------------------------------------- */
+static cs_hash32
+home_group(const struct cs_hashset* hs, cs_hash32 hash)
+{
+    cs_hash32 mixed = hash * 2654435769u;
+    return (cs_hash32)(((uint64_t)mixed * GROUP_COUNT(hs)) >> 32);
+}
+
+/* ------------------------------------------------------------------------- */
+static void*
+malloc_and_init_storage(uint32_t key_size, uint32_t table_count)
+{
+    void* storage = MALLOC((1 + (uintptr_t)key_size) * table_count);
+    if (storage == NULL)
+        return NULL;
+
+    memset(storage, HM_CTRL_EMPTY, table_count);
+    return storage;
+}
+
+/* ------------------------------------------------------------------------- */
+static cs_hash32
+find_slot(const struct cs_hashset* hs, const void* key, cs_hash32 hash)
+{
+    cs_hash32 group = home_group(hs, hash);
+    uint8_t h2 = H2(hash);
+    cs_hash32 i;
+
+    for (i = 0; i != GROUP_COUNT(hs); ++i)
+    {
+        const uint8_t* ctrl = &CTRL(hs, group * HM_GROUP_SIZE);
+        uint32_t match = cs_hm_group_match(ctrl, h2);
+        while (match)
+        {
+            cs_hash32 pos = group * HM_GROUP_SIZE + (cs_hash32)cs_hm_ctz32(match);
+            if (memcmp(KEY(hs, pos), key, hs->key_size) == 0)
+                return pos;
+            match &= match - 1;
+        }
+
+        if (cs_hm_group_match_empty(ctrl))
+            break;
+
+        group = (group + i + 1) & GROUP_MASK(hs);
+    }
+
+    return HM_INVALID_POS;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Places a key that is known not to exist in a table without tombstones */
+static void
+place_rehashed(struct cs_hashset* hs, const void* key, cs_hash32 hash)
+{
+    cs_hash32 group = home_group(hs, hash);
+    cs_hash32 i;
+
+    for (i = 0; ; ++i)
+    {
+        uint32_t empty = cs_hm_group_match_empty(&CTRL(hs, group * HM_GROUP_SIZE));
+        if (empty)
+        {
+            cs_hash32 pos = group * HM_GROUP_SIZE + (cs_hash32)cs_hm_ctz32(empty);
+            CTRL(hs, pos) = H2(hash);
+            memcpy(KEY(hs, pos), key, hs->key_size);
+            return;
+        }
+        group = (group + i + 1) & GROUP_MASK(hs);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Moves every key into a new table of the specified size. Since hashes
+ * aren't stored, every key is hashed again. This also drops all tombstones.
+ */
+static enum cs_hashmap_status
+rehash(struct cs_hashset* hs, uint32_t new_table_count)
+{
+    struct cs_hashset old = *hs;
+    cs_hash32 pos;
+
+    hs->storage = malloc_and_init_storage(hs->key_size, new_table_count);
+    if (hs->storage == NULL)
+    {
+        hs->storage = old.storage;
+        return HM_OOM;
+    }
+    hs->table_count = new_table_count;
+    hs->tombstones = 0;
+
+    for (pos = 0; pos != old.table_count; ++pos)
+    {
+        if (!HM_CTRL_IS_FULL(CTRL((&old), pos)))
+            continue;
+        place_rehashed(hs, KEY((&old), pos), hs->hash(KEY((&old), pos), hs->key_size));
+    }
+
+    FREE(old.storage);
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Makes sure there's room for one more key. When the table is full of
+ * tombstones rather than keys, it is rebuilt at the same size instead of
+ * growing.
+ */
+static enum cs_hashmap_status
+prepare_insert(struct cs_hashset* hs)
+{
+    if ((uint64_t)(hs->slots_used + hs->tombstones + 1) * 100 <
+        (uint64_t)hs->table_count * HM_REHASH_AT_PERCENT)
+    {
+        return HM_OK;
+    }
+
+    if ((uint64_t)(hs->slots_used + 1) * 100 * 2 < (uint64_t)hs->table_count * HM_REHASH_AT_PERCENT)
+        return rehash(hs, hs->table_count);
+    return rehash(hs, hs->table_count * HM_EXPAND_FACTOR);
+}
+
+/* ------------------------------------------------------------------------- */
+static enum cs_hashmap_status
+insert_hashed(struct cs_hashset* hs, const void* key, cs_hash32 hash)
+{
+    cs_hash32 group, pos = HM_INVALID_POS;
+    uint8_t h2 = H2(hash);
+    cs_hash32 i;
+
+    if (prepare_insert(hs) != HM_OK)
+        return HM_OOM;
+
+    group = home_group(hs, hash);
+    for (i = 0; i != GROUP_COUNT(hs); ++i)
+    {
+        const uint8_t* ctrl = &CTRL(hs, group * HM_GROUP_SIZE);
+        uint32_t match = cs_hm_group_match(ctrl, h2);
+        while (match)
+        {
+            cs_hash32 candidate = group * HM_GROUP_SIZE + (cs_hash32)cs_hm_ctz32(match);
+            if (memcmp(KEY(hs, candidate), key, hs->key_size) == 0)
+                return HM_EXISTS;
+            match &= match - 1;
+        }
+
+        /* Remember the first free slot, it's used once we know the key
+         * doesn't exist further on */
+        if (pos == HM_INVALID_POS)
+        {
+            uint32_t available = cs_hm_group_match_empty_or_deleted(ctrl);
+            if (available)
+                pos = group * HM_GROUP_SIZE + (cs_hash32)cs_hm_ctz32(available);
+        }
+
+        if (cs_hm_group_match_empty(ctrl))
+            break;
+
+        group = (group + i + 1) & GROUP_MASK(hs);
+    }
+
+    /* prepare_insert() guarantees there is a free slot */
+    assert(pos != HM_INVALID_POS);
+    if (CTRL(hs, pos) == HM_CTRL_DELETED)
+        hs->tombstones--;
+    CTRL(hs, pos) = h2;
+    memcpy(KEY(hs, pos), key, hs->key_size);
+    hs->slots_used++;
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Hashes a batch of keys and prefetches their home groups in hs. The keys
+ * are resolved by the caller, by which time the tags and keys should be in
+ * the cache.
+ */
+static void
+hash_and_prefetch_batch(const struct cs_hashset* hs,
+                        const void* const* keys,
+                        uint32_t count,
+                        cs_hash32* hashes)
+{
+    uint32_t i;
+    for (i = 0; i != count; ++i)
+    {
+        cs_hash32 group;
+        hashes[i] = hs->hash(keys[i], hs->key_size);
+        group = home_group(hs, hashes[i]);
+        PREFETCH(&CTRL(hs, group * HM_GROUP_SIZE));
+        PREFETCH(KEY(hs, group * HM_GROUP_SIZE));
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashset_create(struct cs_hashset** hs, uint32_t key_size)
+{
+    return hashset_create_with_options(hs, key_size, HM_DEFAULT_TABLE_COUNT, HASH32_DEFAULT);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashset_create_with_options(struct cs_hashset** hs,
+                            uint32_t key_size,
+                            uint32_t table_count,
+                            hash32_func hash_func)
+{
+    *hs = MALLOC(sizeof(**hs));
+    if (*hs == NULL)
+        return HM_OOM;
+
+    if (hashset_init_with_options(*hs, key_size, table_count, hash_func) != HM_OK)
+    {
+        FREE(*hs);
+        return HM_OOM;
+    }
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashset_init(struct cs_hashset* hs, uint32_t key_size)
+{
+    return hashset_init_with_options(hs, key_size, HM_DEFAULT_TABLE_COUNT, HASH32_DEFAULT);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashset_init_with_options(struct cs_hashset* hs,
+                          uint32_t key_size,
+                          uint32_t table_count,
+                          hash32_func hash_func)
+{
+    uint32_t count = HM_GROUP_SIZE;
+
+    assert(hs);
+    assert(key_size > 0);
+    assert(hash_func);
+
+    while (count < table_count)
+        count *= 2;
+
+    hs->table_count = count;
+    hs->key_size = key_size;
+    hs->slots_used = 0;
+    hs->tombstones = 0;
+    hs->hash = hash_func;
+    hs->storage = malloc_and_init_storage(key_size, count);
+    if (hs->storage == NULL)
+        return HM_OOM;
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+hashset_deinit(struct cs_hashset* hs)
+{
+    FREE(hs->storage);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+hashset_free(struct cs_hashset* hs)
+{
+    hashset_deinit(hs);
+    FREE(hs);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashset_reserve(struct cs_hashset* hs, uint32_t element_count)
+{
+    uint32_t table_count = hs->table_count;
+    while ((uint64_t)element_count * 100 >= (uint64_t)table_count * HM_REHASH_AT_PERCENT)
+        table_count *= 2;
+
+    if (table_count == hs->table_count)
+        return HM_OK;
+    return rehash(hs, table_count);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashset_insert(struct cs_hashset* hs, const void* key)
+{
+    return insert_hashed(hs, key, hs->hash(key, hs->key_size));
+}
+
+/* ------------------------------------------------------------------------- */
+int
+hashset_contains(const struct cs_hashset* hs, const void* key)
+{
+    return find_slot(hs, key, hs->hash(key, hs->key_size)) != HM_INVALID_POS;
+}
+
+/* ------------------------------------------------------------------------- */
+int
+hashset_erase(struct cs_hashset* hs, const void* key)
+{
+    cs_hash32 pos = find_slot(hs, key, hs->hash(key, hs->key_size));
+    if (pos == HM_INVALID_POS)
+        return 0;
+
+    /* See erase_slot() in hashmap.c */
+    if (cs_hm_group_match_empty(&CTRL(hs, pos / HM_GROUP_SIZE * HM_GROUP_SIZE)))
+        CTRL(hs, pos) = HM_CTRL_EMPTY;
+    else
+    {
+        CTRL(hs, pos) = HM_CTRL_DELETED;
+        hs->tombstones++;
+    }
+    hs->slots_used--;
+
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashset_union(struct cs_hashset* dst, const struct cs_hashset* src)
+{
+    const void* keys[HM_BATCH_SIZE];
+    cs_hash32 hashes[HM_BATCH_SIZE];
+    uint32_t pos, batch_count = 0, i;
+
+    assert(dst->key_size == src->key_size);
+    assert(dst->hash == src->hash);
+
+    /* Nothing to add, and inserting could reallocate the storage being read */
+    if (dst == src)
+        return HM_OK;
+
+    /* The union is at least as large as the larger of the two */
+    if (hashset_reserve(dst, src->slots_used > dst->slots_used ? src->slots_used : dst->slots_used) != HM_OK)
+        return HM_OOM;
+
+    for (pos = 0; pos != src->table_count; ++pos)
+    {
+        if (HM_CTRL_IS_FULL(CTRL(src, pos)))
+            keys[batch_count++] = KEY(src, pos);
+        if (batch_count != HM_BATCH_SIZE && pos != src->table_count - 1)
+            continue;
+
+        hash_and_prefetch_batch(dst, keys, batch_count, hashes);
+        for (i = 0; i != batch_count; ++i)
+            if (insert_hashed(dst, keys[i], hashes[i]) == HM_OOM)
+                return HM_OOM;
+        batch_count = 0;
+    }
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+hashset_intersection(struct cs_hashset* dst,
+                     const struct cs_hashset* a,
+                     const struct cs_hashset* b)
+{
+    const void* keys[HM_BATCH_SIZE];
+    cs_hash32 hashes[HM_BATCH_SIZE];
+    uint32_t pos, batch_count = 0, i;
+
+    assert(dst != a && dst != b);
+    assert(a->key_size == b->key_size && dst->key_size == a->key_size);
+    assert(a->hash == b->hash && dst->hash == a->hash);
+
+    /* Iterate the smaller set, probe the larger one */
+    if (a->slots_used > b->slots_used)
+    {
+        const struct cs_hashset* tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    for (pos = 0; pos != a->table_count; ++pos)
+    {
+        if (HM_CTRL_IS_FULL(CTRL(a, pos)))
+            keys[batch_count++] = KEY(a, pos);
+        if (batch_count != HM_BATCH_SIZE && pos != a->table_count - 1)
+            continue;
+
+        hash_and_prefetch_batch(b, keys, batch_count, hashes);
+        for (i = 0; i != batch_count; ++i)
+        {
+            if (find_slot(b, keys[i], hashes[i]) == HM_INVALID_POS)
+                continue;
+            if (insert_hashed(dst, keys[i], hashes[i]) == HM_OOM)
+                return HM_OOM;
+        }
+        batch_count = 0;
+    }
+
+    return HM_OK;
+}
@@ -1,10 +1,14 @@
 #include "cstructures/init.h"
+#include "cstructures/cpu.h"
+#include "cstructures/hash.h"
 #include "cstructures/memory.h"
 
 /* ------------------------------------------------------------------------- */
 int
 cstructures_init(void)
 {
+    cpu_init();
+    hash_init();
     return memory_init();
 }
 
@@ -37,17 +37,21 @@ memory_init(void)
     g_bytes_in_use_peak = 0;
 
     /*
-     * Hashmap will call malloc during init, need to ignore this to avoid
-     * crashing.
+     * The report's own allocations bypass the tracking, otherwise recording
+     * an allocation would recurse.
      */
-    g_ignore_hm_malloc = 1;
-        if (hashmap_init_with_options(&g_report,
-                                      sizeof(void*),
-                                      sizeof(report_info_t),
-                                      4096,
-                                      hash32_ptr) != HM_OK)
-            return -1;
-    g_ignore_hm_malloc = 0;
+    if (hashmap_init_with_allocator(&g_report,
+                                    sizeof(void*),
+                                    sizeof(report_info_t),
+                                    4096,
+#if defined(CSTRUCTURES_HASHMAP_64BIT)
+                                    hash64_ptr,
+#else
+                                    hash32_mixed_ptr,
+#endif
+                                    0,
+                                    &memory_system_allocator) != HM_OK)
+        return -1;
 
     return 0;
 }
@@ -256,8 +260,6 @@ memory_deinit(void)
 {
     uintptr_t leaks;
 
-    --g_allocations; /* this is the single allocation still held by the report hashmap */
-
     fprintf(stderr, "=========================================\n");
     fprintf(stderr, "Memory Report\n");
     fprintf(stderr, "=========================================\n");
@@ -294,10 +296,7 @@ memory_deinit(void)
     fprintf(stderr, "peak memory usage: %lu bytes\n", g_bytes_in_use_peak);
     fprintf(stderr, "=========================================\n");
 
-    ++g_allocations; /* this is the single allocation still held by the report hashmap */
-    g_ignore_hm_malloc = 1;
-        hashmap_deinit(&g_report);
-    g_ignore_hm_malloc = 0;
+    hashmap_deinit(&g_report);
 
     return leaks;
 }
@@ -316,6 +315,55 @@ memory_get_memory_usage(void)
     return g_bytes_in_use;
 }
 
+/* ------------------------------------------------------------------------- */
+void
+memory_track_alloc(void* p, uintptr_t size)
+{
+    report_info_t info = {0};
+
+    ++g_allocations;
+    g_bytes_in_use += size;
+    if (g_bytes_in_use_peak < g_bytes_in_use)
+        g_bytes_in_use_peak = g_bytes_in_use;
+
+    info.location = p;
+    info.size = size;
+#   if defined(CSTRUCTURES_MEMORY_BACKTRACE)
+    if (!(info.backtrace = get_backtrace(&info.backtrace_size)))
+        fprintf(stderr, "[memory] WARNING: Failed to generate backtrace\n");
+#   endif
+
+    if (hashmap_insert(&g_report, &p, &info) != HM_OK)
+        fprintf(stderr, "[memory] Hashmap insert failed\n");
+}
+
+/* ------------------------------------------------------------------------- */
+void
+memory_track_free(void* p)
+{
+    report_info_t* info = (report_info_t*)hashmap_erase(&g_report, &p);
+    if (info == NULL)
+    {
+        fprintf(stderr, "  WARNING: Releasing something that was never allocated\n");
+        return;
+    }
+
+    ++d_deallocations;
+    g_bytes_in_use -= info->size;
+#   if defined(CSTRUCTURES_MEMORY_BACKTRACE)
+    free(info->backtrace);
+#   endif
+}
+
+/* ------------------------------------------------------------------------- */
+static void* debug_alloc(void* user, uintptr_t size)                { (void)user; return cstructures_malloc(size); }
+static void* debug_realloc(void* user, void* p, uintptr_t new_size) { (void)user; return cstructures_realloc(p, new_size); }
+static void  debug_free(void* user, void* p)                        { (void)user; cstructures_free(p); }
+
+const struct cs_allocator memory_debug_allocator = {
+    debug_alloc, debug_realloc, debug_free, NULL
+};
+
 #else /* CSTRUCTURES_MEMORY_DEBUGGING */
 
 int memory_init(void)                   { return 0; }
@@ -325,6 +373,25 @@ uintptr_t memory_get_memory_usage(void) { return 0; }
 
 #endif /* CSTRUCTURES_MEMORY_DEBUGGING */
 
+/* ------------------------------------------------------------------------- */
+static void* system_alloc(void* user, uintptr_t size)                { (void)user; return malloc(size); }
+static void* system_realloc(void* user, void* p, uintptr_t new_size) { (void)user; return realloc(p, new_size); }
+static void  system_free(void* user, void* p)                        { (void)user; free(p); }
+
+const struct cs_allocator memory_system_allocator = {
+    system_alloc, system_realloc, system_free, NULL
+};
+
+#if defined(CSTRUCTURES_MEMORY_DEBUGGING)
+const struct cs_allocator memory_default_allocator = {
+    debug_alloc, debug_realloc, debug_free, NULL
+};
+#else
+const struct cs_allocator memory_default_allocator = {
+    system_alloc, system_realloc, system_free, NULL
+};
+#endif
+
 /* ------------------------------------------------------------------------- */
 void
 mutated_string_and_hex_dump(const void* data, uintptr_t length_in_bytes)
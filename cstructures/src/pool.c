@@ -0,0 +1,501 @@
+#include "cstructures/pool.h"
+#include "cstructures/memory.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <assert.h>
+
+#if defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   define YIELD() SwitchToThread()
+#else
+#   include <pthread.h>
+#   include <sched.h>
+#   define YIELD() sched_yield()
+#endif
+
+#if defined(_MSC_VER)
+#   define THREAD_LOCAL __declspec(thread)
+#else
+#   define THREAD_LOCAL _Thread_local
+#endif
+
+#define POOL_CACHE_LINE 64
+
+/* Slab headers are padded so objects that are a multiple of 16 bytes stay 16 byte aligned */
+#define SLAB_HEADER_SIZE 16
+
+/* Free objects are linked through their first word */
+#define NEXT(object) (*(void**)(object))
+
+struct slab
+{
+    struct slab* next;
+};
+
+/*
+ * A thread's cache of free objects of one pool. Only the owning thread
+ * touches it, so it needs no lock. The cache is identified by the pool's id
+ * rather than its address, because a freed pool's address can be reused.
+ */
+struct thread_cache
+{
+    uint64_t pool_id;   /* 0 if unused */
+    uint32_t count;
+    void* head;
+};
+
+struct cs_pool
+{
+    /* Constant after pool_create_with_options() */
+    uint32_t object_size;
+    uint32_t slab_size;
+    uint32_t cache_size;
+    uint64_t id;
+    void* allocation;     /* What MALLOC() returned, before aligning */
+
+    /* Links of the list of live pools, protected by g_registry_lock */
+    struct cs_pool* prev_pool;
+    struct cs_pool* next_pool;
+
+    /*
+     * The depot, protected by lock. It starts a new cache line so threads
+     * taking the lock don't keep evicting the constant fields above from
+     * the caches of other cores.
+     */
+    _Alignas(POOL_CACHE_LINE) atomic_flag lock;
+    void* free_list;
+    struct slab* slabs;
+    uint8_t* carve_ptr;   /* Unused part of the most recent slab */
+    uint8_t* carve_end;
+
+#if defined(CSTRUCTURES_MEMORY_DEBUGGING)
+    atomic_uint outstanding;
+#endif
+};
+
+/*
+ * Live pools. A thread that finds a cache of some other pool (when evicting
+ * it, or when exiting) looks the pool up here to return the objects. If the
+ * pool has been freed in the meantime, its objects are gone with its slabs
+ * and the cache is simply dropped.
+ */
+static atomic_flag g_registry_lock = ATOMIC_FLAG_INIT;
+static struct cs_pool* g_pools;
+static uint64_t g_last_pool_id;
+
+static THREAD_LOCAL struct thread_cache g_thread_caches[POOL_THREAD_CACHES];
+static THREAD_LOCAL int g_thread_exit_registered;
+
+#if defined(CSTRUCTURES_MEMORY_DEBUGGING)
+/* memory.c isn't thread safe, so calls into it from pools are serialized */
+static atomic_flag g_track_lock = ATOMIC_FLAG_INIT;
+#endif
+
+/* ------------------------------------------------------------------------- */
+static void
+spin_lock(atomic_flag* lock)
+{
+    int spins = 0;
+    while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire))
+        if (++spins >= 64)
+            YIELD();
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+spin_unlock(atomic_flag* lock)
+{
+    atomic_flag_clear_explicit(lock, memory_order_release);
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Moves up to count objects from the depot into a list. Objects are taken
+ * from the free list first, then carved out of the current slab, then out of
+ * a new slab. Must be called with the depot lock held. Returns the number of
+ * objects, which is only less than count if a slab couldn't be allocated.
+ */
+static uint32_t
+depot_take(struct cs_pool* pool, uint32_t count, void** list)
+{
+    uint32_t taken = 0;
+    void* head = NULL;
+
+    while (taken != count && pool->free_list)
+    {
+        void* object = pool->free_list;
+        pool->free_list = NEXT(object);
+        NEXT(object) = head;
+        head = object;
+        taken++;
+    }
+
+    while (taken != count)
+    {
+        if (pool->carve_ptr == pool->carve_end)
+        {
+            /*
+             * Slabs bypass the memory tracking. The objects carved out of
+             * them are tracked instead.
+             */
+            struct slab* slab = ALLOCATOR_MALLOC(&memory_system_allocator, pool->slab_size);
+            if (slab == NULL)
+                break;
+            slab->next = pool->slabs;
+            pool->slabs = slab;
+            pool->carve_ptr = (uint8_t*)slab + SLAB_HEADER_SIZE;
+            pool->carve_end = pool->carve_ptr +
+                (pool->slab_size - SLAB_HEADER_SIZE) / pool->object_size * pool->object_size;
+        }
+
+        NEXT(pool->carve_ptr) = head;
+        head = pool->carve_ptr;
+        pool->carve_ptr += pool->object_size;
+        taken++;
+    }
+
+    *list = head;
+    return taken;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Must be called with the depot lock held */
+static void
+depot_put(struct cs_pool* pool, void* head, void* tail)
+{
+    NEXT(tail) = pool->free_list;
+    pool->free_list = head;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Returns the objects of a cache to the depot of their pool, if that pool
+ * still exists, and marks the cache as unused.
+ */
+static void
+flush_cache(struct thread_cache* cache)
+{
+    struct cs_pool* pool;
+
+    if (cache->count)
+    {
+        spin_lock(&g_registry_lock);
+        for (pool = g_pools; pool; pool = pool->next_pool)
+            if (pool->id == cache->pool_id)
+            {
+                void* tail = cache->head;
+                while (NEXT(tail))
+                    tail = NEXT(tail);
+                spin_lock(&pool->lock);
+                depot_put(pool, cache->head, tail);
+                spin_unlock(&pool->lock);
+                break;
+            }
+        spin_unlock(&g_registry_lock);
+    }
+
+    cache->pool_id = 0;
+    cache->count = 0;
+    cache->head = NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Objects cached by a thread go back to their depots when the thread exits */
+#if defined(_WIN32)
+static INIT_ONCE g_thread_exit_once = INIT_ONCE_STATIC_INIT;
+static DWORD g_thread_exit_key = FLS_OUT_OF_INDEXES;
+
+static VOID WINAPI
+thread_exit(PVOID unused)
+{
+    int i;
+    (void)unused;
+    for (i = 0; i != POOL_THREAD_CACHES; ++i)
+        flush_cache(&g_thread_caches[i]);
+}
+
+static BOOL CALLBACK
+create_thread_exit_key(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+    (void)once; (void)param; (void)context;
+    g_thread_exit_key = FlsAlloc(thread_exit);
+    return TRUE;
+}
+
+static void
+register_thread_exit(void)
+{
+    InitOnceExecuteOnce(&g_thread_exit_once, create_thread_exit_key, NULL, NULL);
+    if (g_thread_exit_key != FLS_OUT_OF_INDEXES)
+        FlsSetValue(g_thread_exit_key, (PVOID)1);
+}
+#else
+static pthread_once_t g_thread_exit_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_thread_exit_key;
+static int g_thread_exit_key_valid;
+
+static void
+thread_exit(void* unused)
+{
+    int i;
+    (void)unused;
+    for (i = 0; i != POOL_THREAD_CACHES; ++i)
+        flush_cache(&g_thread_caches[i]);
+}
+
+static void
+create_thread_exit_key(void)
+{
+    g_thread_exit_key_valid = pthread_key_create(&g_thread_exit_key, thread_exit) == 0;
+}
+
+static void
+register_thread_exit(void)
+{
+    pthread_once(&g_thread_exit_once, create_thread_exit_key);
+    if (g_thread_exit_key_valid)
+        pthread_setspecific(g_thread_exit_key, (void*)1);
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Returns the calling thread's cache for the pool. A thread has
+ * POOL_THREAD_CACHES caches and every pool maps to one of them by its id.
+ * If another pool is using it, that pool's objects are flushed first.
+ */
+static struct thread_cache*
+thread_cache(struct cs_pool* pool)
+{
+    struct thread_cache* cache = &g_thread_caches[pool->id & (POOL_THREAD_CACHES - 1)];
+    if (cache->pool_id != pool->id)
+    {
+        if (cache->pool_id != 0)
+            flush_cache(cache);
+        if (!g_thread_exit_registered)
+        {
+            register_thread_exit();
+            g_thread_exit_registered = 1;
+        }
+        cache->pool_id = pool->id;
+    }
+    return cache;
+}
+
+/* ------------------------------------------------------------------------- */
+static void*
+take_object(struct cs_pool* pool)
+{
+    struct thread_cache* cache;
+    void* object;
+
+    if (pool->cache_size == 0)
+    {
+        spin_lock(&pool->lock);
+        if (depot_take(pool, 1, &object) == 0)
+            object = NULL;
+        spin_unlock(&pool->lock);
+        return object;
+    }
+
+    cache = thread_cache(pool);
+    if (cache->count == 0)
+    {
+        spin_lock(&pool->lock);
+        cache->count = depot_take(pool, pool->cache_size, &cache->head);
+        spin_unlock(&pool->lock);
+        if (cache->count == 0)
+            return NULL;
+    }
+
+    object = cache->head;
+    cache->head = NEXT(object);
+    cache->count--;
+
+    return object;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+give_object(struct cs_pool* pool, void* object)
+{
+    struct thread_cache* cache;
+
+    if (pool->cache_size == 0)
+    {
+        spin_lock(&pool->lock);
+        depot_put(pool, object, object);
+        spin_unlock(&pool->lock);
+        return;
+    }
+
+    cache = thread_cache(pool);
+    NEXT(object) = cache->head;
+    cache->head = object;
+    cache->count++;
+
+    /* A full cache returns the most recently released half to the depot */
+    if (cache->count == pool->cache_size * 2)
+    {
+        void* head = cache->head;
+        void* tail = head;
+        uint32_t i;
+        for (i = 1; i != pool->cache_size; ++i)
+            tail = NEXT(tail);
+        cache->head = NEXT(tail);
+        cache->count -= pool->cache_size;
+
+        spin_lock(&pool->lock);
+        depot_put(pool, head, tail);
+        spin_unlock(&pool->lock);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+struct cs_pool*
+pool_create(uint32_t object_size)
+{
+    return pool_create_with_options(object_size, 0, POOL_DEFAULT_CACHE_SIZE);
+}
+
+/* ------------------------------------------------------------------------- */
+struct cs_pool*
+pool_create_with_options(uint32_t object_size,
+                         uint32_t slab_size,
+                         uint32_t cache_size)
+{
+    struct cs_pool* pool;
+    void* allocation;
+
+    assert(object_size > 0);
+
+    object_size = (object_size + (uint32_t)sizeof(void*) - 1) / (uint32_t)sizeof(void*) * (uint32_t)sizeof(void*);
+    if (slab_size == 0)
+        slab_size = POOL_DEFAULT_SLAB_SIZE;
+    while (slab_size < SLAB_HEADER_SIZE + POOL_MIN_OBJECTS_PER_SLAB * object_size)
+        slab_size *= 2;
+
+    /* MALLOC() doesn't know about the alignment of the depot */
+    allocation = MALLOC(sizeof *pool + POOL_CACHE_LINE - 1);
+    if (allocation == NULL)
+        return NULL;
+    pool = (struct cs_pool*)(((uintptr_t)allocation + POOL_CACHE_LINE - 1) & ~(uintptr_t)(POOL_CACHE_LINE - 1));
+    pool->allocation = allocation;
+
+    pool->object_size = object_size;
+    pool->slab_size = slab_size;
+    pool->cache_size = cache_size;
+    atomic_flag_clear(&pool->lock);
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pool->carve_ptr = NULL;
+    pool->carve_end = NULL;
+#if defined(CSTRUCTURES_MEMORY_DEBUGGING)
+    atomic_init(&pool->outstanding, 0);
+#endif
+
+    spin_lock(&g_registry_lock);
+    pool->id = ++g_last_pool_id;
+    pool->prev_pool = NULL;
+    pool->next_pool = g_pools;
+    if (g_pools)
+        g_pools->prev_pool = pool;
+    g_pools = pool;
+    spin_unlock(&g_registry_lock);
+
+    return pool;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+pool_free(struct cs_pool* pool)
+{
+    struct slab* slab = pool->slabs;
+    struct thread_cache* cache = &g_thread_caches[pool->id & (POOL_THREAD_CACHES - 1)];
+
+    /*
+     * Caches of other threads are dropped when they next see them, as the
+     * pool won't be found in the registry anymore.
+     */
+    spin_lock(&g_registry_lock);
+    if (pool->prev_pool)
+        pool->prev_pool->next_pool = pool->next_pool;
+    else
+        g_pools = pool->next_pool;
+    if (pool->next_pool)
+        pool->next_pool->prev_pool = pool->prev_pool;
+    spin_unlock(&g_registry_lock);
+
+    if (cache->pool_id == pool->id)
+    {
+        cache->pool_id = 0;
+        cache->count = 0;
+        cache->head = NULL;
+    }
+
+#if defined(CSTRUCTURES_MEMORY_DEBUGGING)
+    /*
+     * The memory report dumps the contents of leaked objects, so their slabs
+     * have to stay around.
+     */
+    if (atomic_load(&pool->outstanding) != 0)
+    {
+        fprintf(stderr, "[memory] WARNING: pool_free(): %u objects were never "
+            "released, keeping their slabs for the memory report\n",
+            atomic_load(&pool->outstanding));
+        slab = NULL;
+    }
+#endif
+
+    while (slab)
+    {
+        struct slab* next = slab->next;
+        ALLOCATOR_FREE(&memory_system_allocator, slab);
+        slab = next;
+    }
+
+    FREE(pool->allocation);
+}
+
+/* ------------------------------------------------------------------------- */
+void*
+pool_alloc(struct cs_pool* pool)
+{
+    void* object = take_object(pool);
+
+#if defined(CSTRUCTURES_MEMORY_DEBUGGING)
+    if (object)
+    {
+        atomic_fetch_add(&pool->outstanding, 1);
+        spin_lock(&g_track_lock);
+        memory_track_alloc(object, pool->object_size);
+        spin_unlock(&g_track_lock);
+    }
+#endif
+
+    return object;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+pool_release(struct cs_pool* pool, void* object)
+{
+    assert(object);
+
+#if defined(CSTRUCTURES_MEMORY_DEBUGGING)
+    atomic_fetch_sub(&pool->outstanding, 1);
+    spin_lock(&g_track_lock);
+    memory_track_free(object);
+    spin_unlock(&g_track_lock);
+#endif
+
+    give_object(pool, object);
+}
+
+/* ------------------------------------------------------------------------- */
+uint32_t
+pool_object_size(const struct cs_pool* pool)
+{
+    return pool->object_size;
+}
@@ -0,0 +1,274 @@
+#include "cstructures/shardmap.h"
+#include "cstructures/memory.h"
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   define YIELD() SwitchToThread()
+#else
+#   include <sched.h>
+#   define YIELD() sched_yield()
+#endif
+
+#define SHM_CACHE_LINE 64
+
+struct shm_shard
+{
+    struct cs_hashmap hm;
+    atomic_flag lock;
+};
+
+/* Shards are rounded up to whole cache lines so their locks don't share one */
+#define SHARD_STRIDE \
+    ((sizeof(struct shm_shard) + SHM_CACHE_LINE - 1) / SHM_CACHE_LINE * SHM_CACHE_LINE)
+#define SHARD(sm, idx) \
+    ((struct shm_shard*)((uint8_t*)(sm)->shards + SHARD_STRIDE * (idx)))
+
+struct cs_shardmap
+{
+    uint32_t shard_bits;
+    uint32_t key_size;
+    uint32_t value_size;
+    hashmap_hash_func hash;
+    void* shards;
+};
+
+/* ------------------------------------------------------------------------- */
+static void
+shard_lock(struct shm_shard* shard)
+{
+    int spins = 0;
+    while (atomic_flag_test_and_set_explicit(&shard->lock, memory_order_acquire))
+        if (++spins >= 64)
+            YIELD();
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+shard_unlock(struct shm_shard* shard)
+{
+    atomic_flag_clear_explicit(&shard->lock, memory_order_release);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+shardmap_create(struct cs_shardmap** sm,
+                uint32_t shard_bits,
+                uint32_t key_size,
+                uint32_t value_size)
+{
+    return shardmap_create_with_options(sm, shard_bits, key_size, value_size,
+                                        HM_DEFAULT_TABLE_COUNT, HM_DEFAULT_HASH, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+shardmap_create_with_options(struct cs_shardmap** sm,
+                             uint32_t shard_bits,
+                             uint32_t key_size,
+                             uint32_t value_size,
+                             uint32_t table_count,
+                             hashmap_hash_func hash_func,
+                             uint32_t flags)
+{
+    uint32_t i;
+
+    assert(sm);
+    assert(shard_bits <= SHM_MAX_SHARD_BITS);
+    assert(!(flags & HM_VARIABLE_KEYS));
+
+    *sm = MALLOC(sizeof(**sm));
+    if (*sm == NULL)
+        return HM_OOM;
+
+    (*sm)->shard_bits = shard_bits;
+    (*sm)->key_size = key_size;
+    (*sm)->value_size = value_size;
+    (*sm)->hash = hash_func;
+    (*sm)->shards = MALLOC(SHARD_STRIDE << shard_bits);
+    if ((*sm)->shards == NULL)
+    {
+        FREE(*sm);
+        return HM_OOM;
+    }
+
+    for (i = 0; i != (uint32_t)1 << shard_bits; ++i)
+    {
+        atomic_flag_clear(&SHARD(*sm, i)->lock);
+        if (hashmap_init_with_options(&SHARD(*sm, i)->hm, key_size, value_size,
+                                      table_count, hash_func, flags) != HM_OK)
+        {
+            while (i--)
+                hashmap_deinit(&SHARD(*sm, i)->hm);
+            FREE((*sm)->shards);
+            FREE(*sm);
+            return HM_OOM;
+        }
+    }
+
+    return HM_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+shardmap_free(struct cs_shardmap* sm)
+{
+    uint32_t i;
+    for (i = 0; i != shardmap_shard_count(sm); ++i)
+        hashmap_deinit(&SHARD(sm, i)->hm);
+    FREE(sm->shards);
+    FREE(sm);
+}
+
+/* ------------------------------------------------------------------------- */
+uint32_t
+shardmap_shard_count(const struct cs_shardmap* sm)
+{
+    return (uint32_t)1 << sm->shard_bits;
+}
+
+/* ------------------------------------------------------------------------- */
+cs_hashmap_hash
+shardmap_hash_key(const struct cs_shardmap* sm, const void* key)
+{
+    return sm->hash(key, sm->key_size);
+}
+
+/* ------------------------------------------------------------------------- */
+uint32_t
+shardmap_shard_index(const struct cs_shardmap* sm, cs_hashmap_hash hash)
+{
+    /*
+     * The top bits select the shard. Within a shard, the hashmap mixes all
+     * bits of the hash before picking a group, so the entries of a shard
+     * still spread over the whole table.
+     */
+    if (sm->shard_bits == 0)
+        return 0;
+    return (uint32_t)(hash >> (sizeof(cs_hashmap_hash) * 8 - sm->shard_bits));
+}
+
+/* ------------------------------------------------------------------------- */
+struct cs_hashmap*
+shardmap_shard(struct cs_shardmap* sm, uint32_t shard_index)
+{
+    assert(shard_index < shardmap_shard_count(sm));
+    return &SHARD(sm, shard_index)->hm;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+shardmap_lock(struct cs_shardmap* sm, uint32_t shard_index)
+{
+    assert(shard_index < shardmap_shard_count(sm));
+    shard_lock(SHARD(sm, shard_index));
+}
+
+/* ------------------------------------------------------------------------- */
+void
+shardmap_unlock(struct cs_shardmap* sm, uint32_t shard_index)
+{
+    assert(shard_index < shardmap_shard_count(sm));
+    shard_unlock(SHARD(sm, shard_index));
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+shardmap_reserve(struct cs_shardmap* sm, uint32_t shard_index, uint32_t element_count)
+{
+    struct shm_shard* shard;
+    enum cs_hashmap_status status;
+
+    assert(shard_index < shardmap_shard_count(sm));
+    shard = SHARD(sm, shard_index);
+    shard_lock(shard);
+    status = hashmap_reserve(&shard->hm, element_count);
+    shard_unlock(shard);
+    return status;
+}
+
+/* ------------------------------------------------------------------------- */
+enum cs_hashmap_status
+shardmap_insert(struct cs_shardmap* sm, const void* key, const void* value)
+{
+    cs_hashmap_hash hash = shardmap_hash_key(sm, key);
+    struct shm_shard* shard = SHARD(sm, shardmap_shard_index(sm, hash));
+    enum cs_hashmap_status status;
+
+    shard_lock(shard);
+    status = hashmap_insert_with_hash(&shard->hm, key, hash, value);
+    shard_unlock(shard);
+    return status;
+}
+
+/* ------------------------------------------------------------------------- */
+int
+shardmap_find(struct cs_shardmap* sm, const void* key, void* value)
+{
+    cs_hashmap_hash hash = shardmap_hash_key(sm, key);
+    struct shm_shard* shard = SHARD(sm, shardmap_shard_index(sm, hash));
+    void* found;
+
+    /* The value is copied out since it may move once the lock is released */
+    shard_lock(shard);
+    found = hashmap_find_with_hash(&shard->hm, key, hash);
+    if (found && value)
+        memcpy(value, found, sm->value_size);
+    shard_unlock(shard);
+    return found != NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+int
+shardmap_erase(struct cs_shardmap* sm, const void* key, void* value)
+{
+    cs_hashmap_hash hash = shardmap_hash_key(sm, key);
+    struct shm_shard* shard = SHARD(sm, shardmap_shard_index(sm, hash));
+    void* erased;
+
+    shard_lock(shard);
+    erased = hashmap_erase_with_hash(&shard->hm, key, hash);
+    if (erased && value)
+        memcpy(value, erased, sm->value_size);
+    shard_unlock(shard);
+    return erased != NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+cs_hashmap_size
+shardmap_count(struct cs_shardmap* sm)
+{
+    cs_hashmap_size count = 0;
+    uint32_t i;
+    for (i = 0; i != shardmap_shard_count(sm); ++i)
+    {
+        shard_lock(SHARD(sm, i));
+        count += hashmap_count(&SHARD(sm, i)->hm);
+        shard_unlock(SHARD(sm, i));
+    }
+    return count;
+}
+
+/* ------------------------------------------------------------------------- */
+void
+shardmap_for_each_shard(struct cs_shardmap* sm,
+                        uint32_t worker,
+                        uint32_t worker_count,
+                        shardmap_shard_func func,
+                        void* user_data)
+{
+    uint32_t i;
+
+    assert(worker_count > 0);
+    assert(worker < worker_count);
+
+    for (i = worker; i < shardmap_shard_count(sm); i += worker_count)
+    {
+        shard_lock(SHARD(sm, i));
+        func(&SHARD(sm, i)->hm, i, user_data);
+        shard_unlock(SHARD(sm, i));
+    }
+}
@@ -23,6 +23,14 @@ string_init(struct cs_string* str)
     vector_init(&str->buf, sizeof(char));
 }
 
+/* ------------------------------------------------------------------------- */
+void
+string_init_with_allocator(struct cs_string* str,
+                           const struct cs_allocator* allocator)
+{
+    vector_init_with_allocator(&str->buf, sizeof(char), allocator);
+}
+
 /* ------------------------------------------------------------------------- */
 void
 string_deinit(struct cs_string* str)
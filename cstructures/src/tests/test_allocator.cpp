@@ -0,0 +1,136 @@
+#include <gmock/gmock.h>
+#include "cstructures/btree.h"
+#include "cstructures/hashmap.h"
+#include "cstructures/memory.h"
+#include "cstructures/vector.h"
+#include <cstdlib>
+
+#define NAME allocator
+
+using namespace testing;
+
+namespace {
+struct counts
+{
+    int allocs;
+    int reallocs;
+    int frees;
+    int live;
+};
+
+void* counting_alloc(void* user, uintptr_t size)
+{
+    counts* c = (counts*)user;
+    c->allocs++;
+    c->live++;
+    return malloc(size);
+}
+
+void* counting_realloc(void* user, void* p, uintptr_t new_size)
+{
+    counts* c = (counts*)user;
+    c->reallocs++;
+    if (p == NULL)
+        c->live++;
+    return realloc(p, new_size);
+}
+
+void counting_free(void* user, void* p)
+{
+    counts* c = (counts*)user;
+    EXPECT_THAT(p, NotNull());
+    c->frees++;
+    c->live--;
+    free(p);
+}
+}
+
+class NAME : public Test
+{
+public:
+    virtual void SetUp()
+    {
+        c.allocs = c.reallocs = c.frees = c.live = 0;
+        a.alloc = counting_alloc;
+        a.realloc = counting_realloc;
+        a.free = counting_free;
+        a.user = &c;
+    }
+
+    counts c;
+    struct cs_allocator a;
+};
+
+TEST_F(NAME, hashmap_allocates_through_allocator)
+{
+    struct cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_with_allocator(&hm, sizeof(uint32_t), sizeof(uint32_t),
+                                            HM_DEFAULT_TABLE_COUNT, HM_DEFAULT_HASH,
+                                            0, &a), Eq(HM_OK));
+    EXPECT_THAT(c.allocs, Eq(1));
+
+    for (uint32_t key = 0; key != 10000; ++key)
+        ASSERT_THAT(hashmap_insert(&hm, &key, &key), Eq(HM_OK));
+    EXPECT_THAT(c.allocs, Gt(1));
+    EXPECT_THAT(c.live, Eq(1));
+
+    hashmap_deinit(&hm);
+    EXPECT_THAT(c.live, Eq(0));
+}
+
+TEST_F(NAME, incremental_and_variable_key_hashmap_allocates_through_allocator)
+{
+    struct cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_with_allocator(&hm, 0, sizeof(uint32_t),
+                                            HM_DEFAULT_TABLE_COUNT, HM_DEFAULT_HASH,
+                                            HM_INCREMENTAL_REHASH | HM_VARIABLE_KEYS, &a), Eq(HM_OK));
+
+    char key[16];
+    for (uint32_t i = 0; i != 2000; ++i)
+    {
+        sprintf(key, "key%u", i);
+        ASSERT_THAT(hashmap_insert_str(&hm, key, &i), Eq(HM_OK));
+    }
+    EXPECT_THAT(c.reallocs, Gt(0));
+
+    hashmap_deinit(&hm);
+    EXPECT_THAT(c.live, Eq(0));
+}
+
+TEST_F(NAME, vector_allocates_through_allocator)
+{
+    struct cs_vector vec;
+    vector_init_with_allocator(&vec, sizeof(int), &a);
+    EXPECT_THAT(c.allocs, Eq(0));
+
+    for (int i = 0; i != 1000; ++i)
+        ASSERT_THAT(vector_push(&vec, &i), Eq(0));
+    EXPECT_THAT(c.allocs, Eq(1));
+    EXPECT_THAT(c.reallocs, Gt(0));
+
+    vector_clear_compact(&vec);
+    EXPECT_THAT(c.live, Eq(0));
+    vector_deinit(&vec);
+}
+
+TEST_F(NAME, btree_allocates_through_allocator)
+{
+    struct cs_btree btree;
+    btree_init_with_allocator(&btree, sizeof(int), &a);
+
+    for (int i = 0; i != 1000; ++i)
+        ASSERT_THAT(btree_insert_new(&btree, (cs_btree_key)i, &i), Eq(BTREE_OK));
+    EXPECT_THAT(c.allocs, Eq(1));
+    EXPECT_THAT(c.reallocs, Gt(0));
+
+    btree_deinit(&btree);
+    EXPECT_THAT(c.live, Eq(0));
+}
+
+TEST_F(NAME, default_allocator_is_used_without_one)
+{
+    struct cs_vector vec;
+    vector_init(&vec, sizeof(int));
+    EXPECT_THAT(vec.allocator, Eq(&memory_default_allocator));
+    vector_deinit(&vec);
+}
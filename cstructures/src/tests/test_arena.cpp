@@ -0,0 +1,133 @@
+#include <gmock/gmock.h>
+#include "cstructures/arena.h"
+#include "cstructures/btree.h"
+#include "cstructures/hashmap.h"
+#include "cstructures/string.h"
+#include "cstructures/vector.h"
+
+#define NAME arena
+
+using namespace testing;
+
+class NAME : public Test
+{
+public:
+    virtual void SetUp()
+    {
+        arena_init(&a, 1024, 0);
+    }
+
+    virtual void TearDown()
+    {
+        arena_deinit(&a);
+    }
+
+    struct cs_arena a;
+};
+
+TEST_F(NAME, allocations_are_aligned_and_distinct)
+{
+    uint8_t* p1 = (uint8_t*)arena_alloc(&a, 3);
+    uint8_t* p2 = (uint8_t*)arena_alloc(&a, 5);
+    uint8_t* p3 = (uint8_t*)arena_alloc_aligned(&a, 8, 256);
+    ASSERT_THAT(p1, NotNull());
+    ASSERT_THAT(p2, NotNull());
+    ASSERT_THAT(p3, NotNull());
+    EXPECT_THAT((uintptr_t)p1 % ARENA_DEFAULT_ALIGNMENT, Eq(0u));
+    EXPECT_THAT((uintptr_t)p2 % ARENA_DEFAULT_ALIGNMENT, Eq(0u));
+    EXPECT_THAT((uintptr_t)p3 % 256, Eq(0u));
+    EXPECT_THAT(p2, Ge(p1 + 3));
+    EXPECT_THAT(p3, Ge(p2 + 5));
+}
+
+TEST_F(NAME, large_allocations_get_their_own_chunk)
+{
+    uint8_t* small = (uint8_t*)arena_alloc(&a, 16);
+    uint8_t* large = (uint8_t*)arena_alloc(&a, 10000);
+    ASSERT_THAT(small, NotNull());
+    ASSERT_THAT(large, NotNull());
+    memset(large, 0xAA, 10000);
+    *small = 1;
+    EXPECT_THAT(large[9999], Eq(0xAA));
+}
+
+TEST_F(NAME, rewind_releases_everything_after_mark)
+{
+    arena_alloc(&a, 100);
+    struct cs_arena_mark mark = arena_mark(&a);
+    void* p = arena_alloc(&a, 100);
+    for (int i = 0; i != 100; ++i)
+        arena_alloc(&a, 100);
+
+    arena_rewind(&a, mark);
+    EXPECT_THAT(arena_alloc(&a, 100), Eq(p));
+}
+
+TEST_F(NAME, reset_reuses_chunks)
+{
+    arena_alloc(&a, 100);
+    for (int i = 0; i != 100; ++i)
+        arena_alloc(&a, 100);
+    struct cs_arena_chunk* chunks = a.chunks;
+
+    arena_reset(&a);
+    EXPECT_THAT(a.chunks, IsNull());
+    EXPECT_THAT(a.free_chunks, Eq(chunks));
+
+    /* The most recent chunk is reused first, no new chunks are allocated */
+    for (int i = 0; i != 101; ++i)
+        ASSERT_THAT(arena_alloc(&a, 100), NotNull());
+    EXPECT_THAT(a.free_chunks, IsNull());
+    EXPECT_THAT(a.first, Eq(chunks));
+}
+
+TEST_F(NAME, containers_can_be_released_by_reset)
+{
+    for (int round = 0; round != 3; ++round)
+    {
+        struct cs_vector vec;
+        struct cs_hashmap hm;
+        struct cs_btree btree;
+        struct cs_string str;
+
+        vector_init_with_allocator(&vec, sizeof(int), &a.allocator);
+        ASSERT_THAT(hashmap_init_with_allocator(&hm, sizeof(int), sizeof(int), 16,
+                                                HM_DEFAULT_HASH, 0, &a.allocator), Eq(HM_OK));
+        btree_init_with_allocator(&btree, sizeof(int), &a.allocator);
+        string_init_with_allocator(&str, &a.allocator);
+
+        for (int i = 0; i != 1000; ++i)
+        {
+            char c = 'a' + i % 26;
+            ASSERT_THAT(vector_push(&vec, &i), Eq(0));
+            ASSERT_THAT(hashmap_insert(&hm, &i, &i), Eq(HM_OK));
+            ASSERT_THAT(btree_insert_new(&btree, (cs_btree_key)i, &i), Eq(BTREE_OK));
+            ASSERT_THAT(vector_push(&str.buf, &c), Eq(0));
+        }
+
+        for (int i = 0; i != 1000; ++i)
+        {
+            ASSERT_THAT(*(int*)vector_get_element(&vec, i), Eq(i));
+            ASSERT_THAT(hashmap_find(&hm, &i), NotNull());
+            EXPECT_THAT(*(int*)hashmap_find(&hm, &i), Eq(i));
+            ASSERT_THAT(btree_find(&btree, (cs_btree_key)i), NotNull());
+            EXPECT_THAT(*(int*)btree_find(&btree, (cs_btree_key)i), Eq(i));
+            EXPECT_THAT(((char*)vector_data(&str.buf))[i], Eq('a' + i % 26));
+        }
+
+        /* No deinit */
+        arena_reset(&a);
+    }
+}
+
+TEST_F(NAME, freeing_the_last_allocation_gives_it_back)
+{
+    struct cs_vector vec;
+    vector_init_with_allocator(&vec, sizeof(int), &a.allocator);
+    for (int i = 0; i != 10; ++i)
+        ASSERT_THAT(vector_push(&vec, &i), Eq(0));
+
+    uint8_t* ptr = a.ptr;
+    vector_deinit(&vec);
+    EXPECT_THAT(a.ptr, Lt(ptr));
+}
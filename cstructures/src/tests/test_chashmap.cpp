@@ -0,0 +1,173 @@
+#include <gmock/gmock.h>
+#include "cstructures/chashmap.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define NAME chashmap
+
+using namespace testing;
+
+static const int thread_count = 4;
+
+class NAME : public Test
+{
+public:
+    virtual void SetUp()
+    {
+        ASSERT_THAT(chashmap_create(&hm, sizeof(uint32_t), sizeof(uint64_t)), Eq(HM_OK));
+    }
+
+    virtual void TearDown()
+    {
+        chashmap_free(hm);
+    }
+
+    static uint64_t valueOf(uint32_t key) { return (uint64_t)key * 0x9E3779B97F4A7C15ull; }
+
+    struct cs_chashmap* hm;
+};
+
+TEST_F(NAME, insert_find_erase)
+{
+    uint32_t key = 5;
+    uint64_t value = 50;
+    EXPECT_THAT(chashmap_insert(hm, &key, &value), Eq(HM_OK));
+    value = 60;
+    EXPECT_THAT(chashmap_insert(hm, &key, &value), Eq(HM_EXISTS));
+    EXPECT_THAT(chashmap_count(hm), Eq(1u));
+
+    value = 0;
+    EXPECT_THAT(chashmap_find(hm, &key, &value), Eq(1));
+    EXPECT_THAT(value, Eq(50u));
+    key = 6;
+    EXPECT_THAT(chashmap_find(hm, &key, &value), Eq(0));
+    EXPECT_THAT(chashmap_erase(hm, &key, NULL), Eq(0));
+
+    key = 5;
+    value = 0;
+    EXPECT_THAT(chashmap_erase(hm, &key, &value), Eq(1));
+    EXPECT_THAT(value, Eq(50u));
+    EXPECT_THAT(chashmap_find(hm, &key, NULL), Eq(0));
+    EXPECT_THAT(chashmap_count(hm), Eq(0u));
+}
+
+TEST_F(NAME, grows_and_keeps_entries)
+{
+    for (uint32_t key = 0; key != 20000; ++key)
+    {
+        uint64_t value = valueOf(key);
+        ASSERT_THAT(chashmap_insert(hm, &key, &value), Eq(HM_OK));
+    }
+    EXPECT_THAT(chashmap_count(hm), Eq(20000u));
+
+    for (uint32_t key = 0; key != 20000; ++key)
+    {
+        uint64_t value;
+        ASSERT_THAT(chashmap_find(hm, &key, &value), Eq(1));
+        ASSERT_THAT(value, Eq(valueOf(key)));
+    }
+}
+
+TEST_F(NAME, churn_rebuilds_erased_slots)
+{
+    /* Erased slots aren't reused, so this rebuilds the table many times */
+    for (uint32_t i = 0; i != 50000; ++i)
+    {
+        uint32_t key = i;
+        uint64_t value = valueOf(key);
+        ASSERT_THAT(chashmap_insert(hm, &key, &value), Eq(HM_OK));
+        if (i >= 100)
+        {
+            key = i - 100;
+            ASSERT_THAT(chashmap_erase(hm, &key, NULL), Eq(1));
+        }
+    }
+    EXPECT_THAT(chashmap_count(hm), Eq(100u));
+    for (uint32_t key = 49900; key != 50000; ++key)
+        ASSERT_THAT(chashmap_find(hm, &key, NULL), Eq(1));
+}
+
+TEST_F(NAME, concurrent_inserts_of_disjoint_keys)
+{
+    const uint32_t per_thread = 20000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t != thread_count; ++t)
+        threads.emplace_back([this, t, per_thread]() {
+            for (uint32_t i = 0; i != per_thread; ++i)
+            {
+                uint32_t key = i * thread_count + (uint32_t)t;
+                uint64_t value = valueOf(key);
+                EXPECT_THAT(chashmap_insert(hm, &key, &value), Eq(HM_OK));
+            }
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    EXPECT_THAT(chashmap_count(hm), Eq(per_thread * thread_count));
+    for (uint32_t key = 0; key != per_thread * thread_count; ++key)
+    {
+        uint64_t value;
+        ASSERT_THAT(chashmap_find(hm, &key, &value), Eq(1));
+        ASSERT_THAT(value, Eq(valueOf(key)));
+    }
+}
+
+TEST_F(NAME, concurrent_inserts_of_same_keys_succeed_once)
+{
+    const uint32_t key_count = 20000;
+    std::atomic<uint32_t> inserted(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t != thread_count; ++t)
+        threads.emplace_back([this, &inserted, key_count]() {
+            for (uint32_t key = 0; key != key_count; ++key)
+            {
+                uint64_t value = valueOf(key);
+                if (chashmap_insert(hm, &key, &value) == HM_OK)
+                    inserted++;
+            }
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    EXPECT_THAT(inserted.load(), Eq(key_count));
+    EXPECT_THAT(chashmap_count(hm), Eq(key_count));
+}
+
+TEST_F(NAME, readers_see_consistent_values_during_churn)
+{
+    /* Keys below 1000 are never erased, the rest come and go */
+    for (uint32_t key = 0; key != 1000; ++key)
+    {
+        uint64_t value = valueOf(key);
+        ASSERT_THAT(chashmap_insert(hm, &key, &value), Eq(HM_OK));
+    }
+
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t != thread_count - 1; ++t)
+        threads.emplace_back([this, &stop]() {
+            uint32_t i = 0;
+            while (!stop.load())
+            {
+                uint32_t key = i++ % 3000;
+                uint64_t value;
+                int found = chashmap_find(hm, &key, &value);
+                if (key < 1000)
+                    EXPECT_THAT(found, Eq(1));
+                if (found)
+                    EXPECT_THAT(value, Eq(valueOf(key)));
+            }
+        });
+
+    for (uint32_t i = 0; i != 100000; ++i)
+    {
+        uint32_t key = 1000 + i % 2000;
+        uint64_t value = valueOf(key);
+        if (chashmap_insert(hm, &key, &value) == HM_EXISTS)
+            ASSERT_THAT(chashmap_erase(hm, &key, NULL), Eq(1));
+    }
+    stop = true;
+    for (auto& thread : threads)
+        thread.join();
+}
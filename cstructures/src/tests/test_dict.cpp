@@ -0,0 +1,164 @@
+#include <gmock/gmock.h>
+#include "cstructures/dict.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#define NAME dict
+
+using namespace testing;
+
+class NAME : public Test
+{
+public:
+    virtual void SetUp()
+    {
+        ASSERT_THAT(dict_init(&d, sizeof(uint32_t), sizeof(uint64_t)), Eq(HM_OK));
+    }
+
+    virtual void TearDown()
+    {
+        dict_deinit(&d);
+    }
+
+    std::vector<uint32_t> keysInOrder()
+    {
+        std::vector<uint32_t> keys;
+        DICT_FOR_EACH(&d, uint32_t, uint64_t, key, value)
+            EXPECT_THAT(*value, Eq((uint64_t)*key * 10));
+            keys.push_back(*key);
+        DICT_END_EACH
+        return keys;
+    }
+
+    void insert(uint32_t key)
+    {
+        uint64_t value = (uint64_t)key * 10;
+        ASSERT_THAT(dict_insert(&d, &key, &value), Eq(HM_OK));
+    }
+
+    void erase(uint32_t key)
+    {
+        ASSERT_THAT(dict_erase(&d, &key), NotNull());
+    }
+
+    struct cs_dict d;
+};
+
+TEST_F(NAME, insert_find_erase)
+{
+    uint32_t key = 3;
+    uint64_t value = 30;
+    EXPECT_THAT(dict_insert(&d, &key, &value), Eq(HM_OK));
+    value = 40;
+    EXPECT_THAT(dict_insert(&d, &key, &value), Eq(HM_EXISTS));
+    EXPECT_THAT(dict_count(&d), Eq(1u));
+
+    ASSERT_THAT(dict_find(&d, &key), NotNull());
+    EXPECT_THAT(*(uint64_t*)dict_find(&d, &key), Eq(30u));
+
+    uint64_t* erased = (uint64_t*)dict_erase(&d, &key);
+    ASSERT_THAT(erased, NotNull());
+    EXPECT_THAT(*erased, Eq(30u));
+    EXPECT_THAT(dict_find(&d, &key), IsNull());
+    EXPECT_THAT(dict_erase(&d, &key), IsNull());
+    EXPECT_THAT(dict_count(&d), Eq(0u));
+}
+
+TEST_F(NAME, iterates_in_insertion_order)
+{
+    std::vector<uint32_t> expected;
+    for (uint32_t i = 0; i != 1000; ++i)
+    {
+        uint32_t key = (i * 7919) % 1000;
+        insert(key);
+        expected.push_back(key);
+    }
+    EXPECT_THAT(keysInOrder(), ElementsAreArray(expected));
+
+    for (uint32_t i = 0; i < expected.size(); i += 3)
+        erase(expected[i]);
+    std::vector<uint32_t> remaining;
+    for (uint32_t i = 0; i != expected.size(); ++i)
+        if (i % 3)
+            remaining.push_back(expected[i]);
+    EXPECT_THAT(dict_count(&d), Eq(remaining.size()));
+    EXPECT_THAT(keysInOrder(), ElementsAreArray(remaining));
+
+    /* Re-inserted keys go to the end */
+    insert(expected[0]);
+    remaining.push_back(expected[0]);
+    EXPECT_THAT(keysInOrder(), ElementsAreArray(remaining));
+}
+
+TEST_F(NAME, erasing_most_keys_shrinks_and_keeps_order)
+{
+    for (uint32_t key = 0; key != 100000; ++key)
+        insert(key);
+    uint32_t large = d.table_count;
+
+    for (uint32_t key = 0; key != 100000; ++key)
+        if (key % 1000)
+            erase(key);
+    EXPECT_THAT(dict_count(&d), Eq(100u));
+    EXPECT_THAT(d.table_count, Lt(large / 64));
+    EXPECT_THAT(d.entry_count, Lt(200u));
+
+    std::vector<uint32_t> keys = keysInOrder();
+    ASSERT_THAT(keys.size(), Eq(100u));
+    for (uint32_t i = 0; i != 100; ++i)
+        EXPECT_THAT(keys[i], Eq(i * 1000));
+}
+
+TEST_F(NAME, reserve_prevents_rebuilds)
+{
+    ASSERT_THAT(dict_reserve(&d, 5000), Eq(HM_OK));
+    int32_t* index = d.index;
+    for (uint32_t key = 0; key != 5000; ++key)
+        insert(key);
+    EXPECT_THAT(d.index, Eq(index));
+}
+
+TEST_F(NAME, churn_at_the_end_does_not_grow)
+{
+    /* Fewer than half of the smallest index's capacity */
+    for (uint32_t key = 0; key != 4; ++key)
+        insert(key);
+    uint32_t table_count = d.table_count;
+    for (uint32_t key = 4; key != 100000; ++key)
+    {
+        insert(key);
+        erase(key);
+    }
+    EXPECT_THAT(d.table_count, Eq(table_count));
+    EXPECT_THAT(dict_count(&d), Eq(4u));
+}
+
+TEST_F(NAME, random_operations_match_reference)
+{
+    std::mt19937 rng(1234);
+    std::vector<uint32_t> reference;  /* Keys in insertion order */
+    for (int i = 0; i != 50000; ++i)
+    {
+        uint32_t key = rng() % 2000;
+        auto it = std::find(reference.begin(), reference.end(), key);
+        if (rng() % 2)
+        {
+            uint64_t value = (uint64_t)key * 10;
+            ASSERT_THAT(dict_insert(&d, &key, &value), Eq(it == reference.end() ? HM_OK : HM_EXISTS));
+            if (it == reference.end())
+                reference.push_back(key);
+        }
+        else
+        {
+            if (it == reference.end())
+                ASSERT_THAT(dict_erase(&d, &key), IsNull());
+            else
+            {
+                ASSERT_THAT(dict_erase(&d, &key), NotNull());
+                reference.erase(it);
+            }
+        }
+    }
+    EXPECT_THAT(keysInOrder(), ElementsAreArray(reference));
+}
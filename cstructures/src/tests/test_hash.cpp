@@ -0,0 +1,242 @@
+#include <gmock/gmock.h>
+#include "cstructures/cpu.h"
+#include "cstructures/hash.h"
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+
+#define NAME hash
+
+using namespace testing;
+
+class NAME : public TestWithParam<hash32_func>
+{
+};
+
+TEST_P(NAME, every_length_and_offset_gives_a_different_hash)
+{
+    hash32_func hash = GetParam();
+    uint8_t buf[300];
+    std::set<cs_hash32> hashes;
+    memset(buf, 'a', sizeof(buf));
+    for (uintptr_t len = 0; len != 256; ++len)
+        hashes.insert(hash(buf, len));
+    EXPECT_THAT(hashes.size(), Eq(256u));
+
+    /* Unaligned reads give the same result */
+    for (int i = 0; i != 300; ++i)
+        buf[i] = (uint8_t)(i * 7);
+    for (uintptr_t len = 0; len != 100; ++len)
+    {
+        uint8_t copy[128];
+        memcpy(copy + 3, buf, len);
+        ASSERT_THAT(hash(copy + 3, len), Eq(hash(buf, len)));
+    }
+}
+
+TEST_P(NAME, sequential_integers_spread_over_low_bits)
+{
+    /* The hashmap indexes its table with the low bits */
+    hash32_func hash = GetParam();
+    const uint32_t buckets = 1024, keys = buckets * 64;
+    std::vector<uint32_t> counts(buckets);
+    for (uint32_t i = 0; i != keys; ++i)
+        counts[hash(&i, sizeof(i)) % buckets]++;
+
+    double chi2 = 0;
+    for (uint32_t c : counts)
+        chi2 += (c - 64.0) * (c - 64.0) / 64.0;
+    /* 1023 degrees of freedom, the 99.99th percentile is about 1200 */
+    EXPECT_THAT(chi2, Lt(1200.0));
+}
+
+INSTANTIATE_TEST_SUITE_P(, NAME, Values(hash32_jenkins_oaat, hash32_wyhash, hash32_crc32c));
+
+/* hash32_jenkins_oaat fails this, mostly in the low bits of short keys */
+TEST(hash_wyhash, flipping_an_input_bit_flips_half_the_output_bits)
+{
+    hash32_func hash = hash32_wyhash;
+    std::mt19937 rng(1);
+    /* Single bytes are left out, 256 keys are too few to measure the bias */
+    for (uintptr_t len : {2u, 3u, 4u, 8u, 15u, 16u, 17u, 32u, 64u, 100u})
+    {
+        const int trials = 500;
+        std::vector<int> flips(len * 8 * 32);
+        for (int t = 0; t != trials; ++t)
+        {
+            uint8_t key[100];
+            for (uintptr_t i = 0; i != len; ++i)
+                key[i] = (uint8_t)rng();
+            cs_hash32 h = hash(key, len);
+            for (uintptr_t bit = 0; bit != len * 8; ++bit)
+            {
+                key[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+                cs_hash32 diff = h ^ hash(key, len);
+                key[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+                for (int out = 0; out != 32; ++out)
+                    flips[bit * 32 + out] += (diff >> out) & 1;
+            }
+        }
+
+        /* 500 trials: a fair coin stays within 0.5 +/- 0.12 with overwhelming probability */
+        for (size_t i = 0; i != flips.size(); ++i)
+        {
+            double p = (double)flips[i] / trials;
+            ASSERT_THAT(p, AllOf(Gt(0.38), Lt(0.62)))
+                << "len " << len << ", input bit " << i / 32 << ", output bit " << i % 32;
+        }
+    }
+}
+
+TEST(hash_default, is_wyhash_regardless_of_the_cpu)
+{
+    /* hash32_crc32c doesn't avalanche, so it is opt-in only */
+    hash32_func hash = HASH32_DEFAULT;
+    EXPECT_THAT(hash, Eq(&hash32_wyhash));
+    cpu_disable_features(CPU_SSE42);
+    hash_init();
+    hash = HASH32_DEFAULT;
+    EXPECT_THAT(hash, Eq(&hash32_wyhash));
+    cpu_disable_features(0);
+    hash_init();
+}
+
+class hash_crc32c : public Test
+{
+public:
+    virtual void TearDown()
+    {
+        cpu_disable_features(0);
+        hash_init();
+    }
+};
+
+TEST_F(hash_crc32c, check_value)
+{
+    /* Check value of the CRC-32C catalogue entry, on every kernel */
+    EXPECT_THAT(hash32_crc32c("123456789", 9), Eq(0xE3069283u));
+    cpu_disable_features(CPU_SSE42);
+    hash_init();
+    EXPECT_THAT(hash32_crc32c("123456789", 9), Eq(0xE3069283u));
+    EXPECT_THAT(hash32_crc32c("", 0), Eq(0u));
+}
+
+TEST_F(hash_crc32c, all_kernels_give_the_same_result)
+{
+    std::mt19937 rng(2);
+    uint8_t buf[1100];
+    for (size_t i = 0; i != sizeof(buf); ++i)
+        buf[i] = (uint8_t)rng();
+
+    std::vector<cs_hash32> expected;
+    for (uintptr_t len = 0; len < 1024; len += 1 + len / 16)
+        for (int offset = 0; offset != 8; ++offset)
+            expected.push_back(hash32_crc32c(buf + offset, len));
+
+    cpu_disable_features(CPU_SSE42);
+    hash_init();
+    size_t i = 0;
+    for (uintptr_t len = 0; len < 1024; len += 1 + len / 16)
+        for (int offset = 0; offset != 8; ++offset)
+            ASSERT_THAT(hash32_crc32c(buf + offset, len), Eq(expected[i++]))
+                << "len " << len << ", offset " << offset;
+}
+
+TEST(hash_wyhash, streaming_matches_one_shot)
+{
+    std::mt19937 rng(3);
+    uint8_t buf[400];
+    for (size_t i = 0; i != sizeof(buf); ++i)
+        buf[i] = (uint8_t)rng();
+
+    /* Every length, split into random pieces (including empty ones) */
+    for (uintptr_t len = 0; len != sizeof(buf); ++len)
+        for (uint32_t max_piece : {4u, 20u, 60u, 200u})
+        {
+            struct cs_wyhash_state state;
+            hash32_wyhash_init(&state);
+            for (uintptr_t offset = 0; offset != len;)
+            {
+                uintptr_t n = std::min<uintptr_t>(rng() % max_piece, len - offset);
+                hash32_wyhash_update(&state, buf + offset, n);
+                offset += n;
+            }
+            ASSERT_THAT(hash32_wyhash_final(&state), Eq(hash32_wyhash(buf, len)))
+                << "len " << len << ", pieces up to " << max_piece;
+        }
+}
+
+TEST(hash_wyhash, hash32_is_folded_hash64)
+{
+    std::mt19937 rng(4);
+    uint8_t buf[200];
+    for (size_t i = 0; i != sizeof(buf); ++i)
+        buf[i] = (uint8_t)rng();
+
+    for (uintptr_t len = 0; len != sizeof(buf); ++len)
+    {
+        cs_hash64 h = hash64_wyhash(buf, len);
+        ASSERT_THAT(hash32_wyhash(buf, len), Eq((cs_hash32)(h ^ (h >> 32))));
+
+        struct cs_wyhash_state state;
+        hash32_wyhash_init(&state);
+        hash32_wyhash_update(&state, buf, len / 2);
+        hash32_wyhash_update(&state, buf + len / 2, len - len / 2);
+        ASSERT_THAT(hash64_wyhash_final(&state), Eq(h));
+    }
+}
+
+TEST(hash_ptr, pointers_spread_over_high_and_low_bits)
+{
+    /* Pointers returned by malloc share their low and high bits */
+    std::set<cs_hash64> low, high;
+    for (uintptr_t i = 0; i != 4096; ++i)
+    {
+        const void* ptr = (const void*)(uintptr_t)(0x7f0000000000ull + i * 16);
+        cs_hash64 h = hash64_ptr(&ptr, sizeof(ptr));
+        low.insert(h & 0xFFF);
+        high.insert(h >> 52);
+    }
+    /* 4096 keys in 4096 buckets fill about 63% of them */
+    EXPECT_THAT(low.size(), Gt(2400u));
+    EXPECT_THAT(high.size(), Gt(2400u));
+}
+
+TEST(hash_int, function_and_inline_versions_agree)
+{
+    for (uint32_t i = 0; i != 1000; ++i)
+    {
+        uint64_t k64 = (uint64_t)i << 40 | i;
+        EXPECT_THAT(hash32_u32(&i, sizeof(i)), Eq(hash32_mix_u32(i)));
+        EXPECT_THAT(hash32_u64(&k64, sizeof(k64)), Eq(hash32_mix_u64(k64)));
+    }
+    const void* ptr = &ptr;
+    EXPECT_THAT(hash64_ptr(&ptr, sizeof(ptr)), Eq(hash64_mix_u64((uintptr_t)ptr)));
+}
+
+TEST(hash_int, sequential_integers_spread_over_low_bits)
+{
+    /* The control tags of the hashmaps are the low 7 bits of the hash */
+    std::vector<int> u32(128), u64(128);
+    for (uint32_t i = 0; i != 128 * 64; ++i)
+    {
+        uint64_t k64 = (uint64_t)i << 32;
+        u32[hash32_mix_u32(i) & 0x7F]++;
+        u64[hash32_mix_u64(k64) & 0x7F]++;
+    }
+    EXPECT_THAT(*std::min_element(u32.begin(), u32.end()), Gt(32));
+    EXPECT_THAT(*std::min_element(u64.begin(), u64.end()), Gt(32));
+}
+
+TEST(hash_ptr, mixed_ptr_uses_every_control_tag)
+{
+    /* hash32_ptr only produces 32 of the 128 tags for these */
+    std::vector<int> tags(128);
+    for (uintptr_t i = 0; i != 128 * 64; ++i)
+    {
+        const void* ptr = (const void*)(uintptr_t)(0x7f0000000000ull + i * 16);
+        tags[hash32_mixed_ptr(&ptr, sizeof(ptr)) & 0x7F]++;
+    }
+    EXPECT_THAT(*std::min_element(tags.begin(), tags.end()), Gt(32));
+}
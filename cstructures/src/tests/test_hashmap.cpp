@@ -1,5 +1,11 @@
 #include <gmock/gmock.h>
 #include "cstructures/hashmap.h"
+#include <cstring>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #define NAME hashmap
 
@@ -10,15 +16,15 @@ static const char KEY2[16] = "KEY2";
 static const char KEY3[16] = "KEY3";
 static const char KEY4[16] = "KEY4";
 
-static cs_hash32 shitty_hash(const void* data, uintptr_t len)
+static cs_hashmap_hash shitty_hash(const void* data, uintptr_t len)
 {
     return 42;
 }
-static cs_hash32 collide_with_shitty_hash(const void* data, uintptr_t len)
+static cs_hashmap_hash collide_with_shitty_hash(const void* data, uintptr_t len)
 {
     return HM_DEFAULT_TABLE_COUNT + 42;
 }
-static cs_hash32 collide_with_shitty_hash_second_probe(const void* data, uintptr_t len)
+static cs_hashmap_hash collide_with_shitty_hash_second_probe(const void* data, uintptr_t len)
 {
     return HM_DEFAULT_TABLE_COUNT + 45; // sequence would be 42, 43, 45, 48, ...
 }
@@ -49,6 +55,18 @@ TEST_F(NAME, construct_sane_values)
     EXPECT_THAT(hm->storage, NotNull());
 }
 
+TEST(hashmap_options, table_count_is_rounded_up_to_power_of_two)
+{
+    cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_with_options(&hm, 16, 4, 100, HM_DEFAULT_HASH, 0), Eq(HM_OK));
+    EXPECT_THAT(hm.table_count, Eq(128u));
+    hashmap_deinit(&hm);
+
+    ASSERT_THAT(hashmap_init_with_options(&hm, 16, 4, 1, HM_DEFAULT_HASH, 0), Eq(HM_OK));
+    EXPECT_THAT(hm.table_count, Eq((uint32_t)HM_GROUP_SIZE));
+    hashmap_deinit(&hm);
+}
+
 TEST_F(NAME, insert_increases_slots_used)
 {
     float f = 5.6f;
@@ -90,6 +108,55 @@ TEST_F(NAME, erasing_same_key_twice_only_works_once)
     EXPECT_THAT(hashmap_count(hm), Eq(0));
 }
 
+TEST_F(NAME, find_or_emplace_inserts_new_key)
+{
+    float* value;
+    ASSERT_THAT(hashmap_find_or_emplace(hm, KEY1, (void**)&value), Eq(HM_OK));
+    ASSERT_THAT(value, NotNull());
+    *value = 5.6f;
+    EXPECT_THAT(hashmap_count(hm), Eq(1u));
+    ASSERT_THAT(hashmap_find(hm, KEY1), Eq((void*)value));
+    EXPECT_THAT(*(float*)hashmap_find(hm, KEY1), FloatEq(5.6f));
+}
+
+TEST_F(NAME, find_or_emplace_returns_existing_value)
+{
+    float a = 5.6f;
+    float* value = NULL;
+    ASSERT_THAT(hashmap_insert(hm, KEY1, &a), Eq(HM_OK));
+    ASSERT_THAT(hashmap_find_or_emplace(hm, KEY1, (void**)&value), Eq(HM_EXISTS));
+    ASSERT_THAT(value, NotNull());
+    EXPECT_THAT(*value, FloatEq(5.6f));
+    EXPECT_THAT(hashmap_count(hm), Eq(1u));
+}
+
+TEST_F(NAME, with_hash_functions_share_one_hash_across_maps)
+{
+    cs_hashmap other;
+    float a = 5.6f, b = 3.4f;
+    float* value;
+    ASSERT_THAT(hashmap_init(&other, 16, sizeof(float)), Eq(HM_OK));
+
+    cs_hashmap_hash hash = hashmap_hash_key(hm, KEY1);
+    EXPECT_THAT(hashmap_hash_key(&other, KEY1), Eq(hash));
+    ASSERT_THAT(hashmap_insert_with_hash(hm, KEY1, hash, &a), Eq(HM_OK));
+    ASSERT_THAT(hashmap_find_or_emplace_with_hash(&other, KEY1, hash, (void**)&value), Eq(HM_OK));
+    *value = b;
+
+    // Interchangeable with the plain functions
+    ASSERT_THAT(hashmap_find(hm, KEY1), NotNull());
+    EXPECT_THAT(*(float*)hashmap_find_with_hash(hm, KEY1, hash), FloatEq(a));
+    EXPECT_THAT(*(float*)hashmap_find(&other, KEY1), FloatEq(b));
+    EXPECT_THAT(hashmap_insert_with_hash(&other, KEY1, hash, &a), Eq(HM_EXISTS));
+
+    EXPECT_THAT(hashmap_erase_with_hash(hm, KEY1, hash), NotNull());
+    EXPECT_THAT(hashmap_erase_with_hash(&other, KEY1, hash), NotNull());
+    EXPECT_THAT(hashmap_find_with_hash(hm, KEY1, hash), IsNull());
+    EXPECT_THAT(hashmap_count(&other), Eq(0u));
+
+    hashmap_deinit(&other);
+}
+
 TEST_F(NAME, hash_collision_insert_ab_erase_ba)
 {
     float a = 5.6f;
@@ -240,6 +307,7 @@ TEST_F(NAME, rehash_test)
         sprintf(key, "%d", i);
         ASSERT_THAT(hashmap_insert(hm, key, &value), Eq(HM_OK));
     }
+    EXPECT_THAT(hm->table_count & (hm->table_count - 1), Eq(0u));
 
     value = 0;
     for (int i = 0; i != HM_DEFAULT_TABLE_COUNT*128; ++i, value += 1.5f)
@@ -255,3 +323,827 @@ TEST_F(NAME, rehash_test)
     }
 
 }
+
+TEST_F(NAME, hash_collisions_spill_over_into_next_group)
+{
+    char key[16];
+    float value = 0;
+    hm->hash = shitty_hash;
+    for (int i = 0; i != HM_GROUP_SIZE * 3; ++i, value += 1.5f)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        ASSERT_THAT(hashmap_insert(hm, key, &value), Eq(HM_OK));
+    }
+
+    value = 0;
+    for (int i = 0; i != HM_GROUP_SIZE * 3; ++i, value += 1.5f)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        float* retvalue = (float*)hashmap_find(hm, key);
+        ASSERT_THAT(retvalue, NotNull());
+        EXPECT_THAT(*retvalue, FloatEq(value));
+    }
+}
+
+TEST_F(NAME, erase_in_full_group_keeps_later_groups_reachable)
+{
+    char key[16];
+    float value = 0;
+    hm->hash = shitty_hash;
+    for (int i = 0; i != HM_GROUP_SIZE + 1; ++i)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        ASSERT_THAT(hashmap_insert(hm, key, &value), Eq(HM_OK));
+    }
+
+    // Key 16 was pushed into the second group, erasing from the first must not cut it off
+    memset(key, 0, sizeof key);
+    sprintf(key, "%d", 3);
+    EXPECT_THAT(hashmap_erase(hm, key), NotNull());
+    memset(key, 0, sizeof key);
+    sprintf(key, "%d", HM_GROUP_SIZE);
+    EXPECT_THAT(hashmap_find(hm, key), NotNull());
+    EXPECT_THAT(hashmap_count(hm), Eq(HM_GROUP_SIZE));
+}
+
+TEST_F(NAME, for_each_visits_every_key_once)
+{
+    float a = 5.6f, b = 3.4f, c = 1.8f;
+    hashmap_insert(hm, KEY1, &a);
+    hashmap_insert(hm, KEY2, &b);
+    hashmap_insert(hm, KEY3, &c);
+    hashmap_erase(hm, KEY2);
+
+    int visited = 0;
+    float sum = 0;
+    HASHMAP_FOR_EACH(hm, char, float, key, value)
+        visited++;
+        sum += *value;
+        EXPECT_THAT(memcmp(key, KEY2, 16), Ne(0));
+    HASHMAP_END_EACH
+    EXPECT_THAT(visited, Eq(2));
+    EXPECT_THAT(sum, FloatEq(a + c));
+}
+
+TEST_F(NAME, reserve_avoids_rehashing)
+{
+    char key[16];
+    float value = 0;
+    ASSERT_THAT(hashmap_reserve(hm, 10000), Eq(HM_OK));
+    uint32_t table_count = hm->table_count;
+    EXPECT_THAT(table_count * HM_REHASH_AT_PERCENT / 100, Ge(10000u));
+    for (int i = 0; i != 10000; ++i)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        ASSERT_THAT(hashmap_insert(hm, key, &value), Eq(HM_OK));
+    }
+    EXPECT_THAT(hm->table_count, Eq(table_count));
+}
+
+TEST_F(NAME, reserve_never_shrinks)
+{
+    ASSERT_THAT(hashmap_reserve(hm, 1), Eq(HM_OK));
+    EXPECT_THAT(hm->table_count, Eq(HM_DEFAULT_TABLE_COUNT));
+}
+
+TEST_F(NAME, insert_batch_reports_status_of_each_key)
+{
+    char keys[5][16] = {"KEY1", "KEY2", "KEY3", "KEY2", "KEY4"};
+    float values[5] = {1.0f, 2.0f, 3.0f, 4.0f, 5.0f};
+    enum cs_hashmap_status statuses[5];
+    ASSERT_THAT(hashmap_insert(hm, KEY4, &values[0]), Eq(HM_OK));
+
+    EXPECT_THAT(hashmap_insert_batch(hm, keys, values, 5, statuses), Eq(HM_OK));
+    EXPECT_THAT(statuses[0], Eq(HM_OK));
+    EXPECT_THAT(statuses[1], Eq(HM_OK));
+    EXPECT_THAT(statuses[2], Eq(HM_OK));
+    EXPECT_THAT(statuses[3], Eq(HM_EXISTS));
+    EXPECT_THAT(statuses[4], Eq(HM_EXISTS));
+    EXPECT_THAT(hashmap_count(hm), Eq(4));
+    EXPECT_THAT(*(float*)hashmap_find(hm, KEY2), FloatEq(2.0f));
+    EXPECT_THAT(*(float*)hashmap_find(hm, KEY4), FloatEq(1.0f));
+}
+
+TEST_F(NAME, insert_batch_many_keys)
+{
+    const int count = 5000;
+    std::vector<char> keys(count * 16, 0);
+    std::vector<float> values(count);
+    for (int i = 0; i != count; ++i)
+    {
+        sprintf(&keys[i * 16], "%d", i);
+        values[i] = i * 1.5f;
+    }
+
+    ASSERT_THAT(hashmap_insert_batch(hm, keys.data(), values.data(), count, NULL), Eq(HM_OK));
+    EXPECT_THAT(hashmap_count(hm), Eq(count));
+    for (int i = 0; i != count; ++i)
+    {
+        float* value = (float*)hashmap_find(hm, &keys[i * 16]);
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, FloatEq(i * 1.5f));
+    }
+}
+
+#if !defined(CSTRUCTURES_HASHMAP_64BIT)
+TEST_F(NAME, insert_batch_fails_if_the_count_would_exceed_the_maximum_table_size)
+{
+    char keys[16] = "KEY";
+    float value = 1.0f;
+    ASSERT_THAT(hashmap_insert(hm, KEY1, &value), Eq(HM_OK));
+
+    /* slots_used + count would wrap around in 32 bits. None of the keys are
+     * read, because the reservation fails first */
+    EXPECT_THAT(hashmap_insert_batch(hm, keys, &value, 0xFFFFFFFF, NULL), Eq(HM_OOM));
+    EXPECT_THAT(hashmap_count(hm), Eq(1));
+    EXPECT_THAT(hm->table_count, Eq(HM_DEFAULT_TABLE_COUNT));
+}
+#endif
+
+TEST(hashmap_incremental, keys_remain_reachable_during_migration)
+{
+    cs_hashmap hm;
+    char key[16];
+    float value = 0;
+    ASSERT_THAT(hashmap_init_with_options(&hm, 16, sizeof(float), 16, HM_DEFAULT_HASH, HM_INCREMENTAL_REHASH), Eq(HM_OK));
+
+    bool saw_migration = false;
+    for (int i = 0; i != 5000; ++i, value += 1.5f)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        ASSERT_THAT(hashmap_insert(&hm, key, &value), Eq(HM_OK));
+        ASSERT_THAT(hashmap_insert(&hm, key, &value), Eq(HM_EXISTS));
+        if (hm.old_storage)
+            saw_migration = true;
+
+        // Every other key is erased again, some of them from the old table
+        if (i % 2)
+        {
+            ASSERT_THAT(hashmap_erase(&hm, key), NotNull());
+            ASSERT_THAT(hashmap_find(&hm, key), IsNull());
+        }
+    }
+    EXPECT_THAT(saw_migration, IsTrue());
+    EXPECT_THAT(hashmap_count(&hm), Eq(2500));
+
+    value = 0;
+    for (int i = 0; i != 5000; ++i, value += 1.5f)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        float* found = (float*)hashmap_find(&hm, key);
+        if (i % 2)
+            EXPECT_THAT(found, IsNull());
+        else
+        {
+            ASSERT_THAT(found, NotNull());
+            EXPECT_THAT(*found, FloatEq(value));
+        }
+    }
+
+    hashmap_deinit(&hm);
+}
+
+TEST(hashmap_incremental, for_each_visits_both_tables_without_finishing_migration)
+{
+    cs_hashmap hm;
+    char key[16];
+    ASSERT_THAT(hashmap_init_with_options(&hm, 16, 0, 16, HM_DEFAULT_HASH, HM_INCREMENTAL_REHASH), Eq(HM_OK));
+
+    // Stop halfway through a migration, with entries in both tables
+    std::set<std::string> expected;
+    int i = 0;
+    while (hm.old_storage == NULL || hm.old_groups_migrated == 0)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i++);
+        ASSERT_THAT(hashmap_insert(&hm, key, NULL), Eq(HM_OK));
+        expected.insert(key);
+    }
+    ASSERT_THAT(hm.old_groups_migrated, Lt(hm.old_table_count / HM_GROUP_SIZE));
+
+    std::multiset<std::string> visited;
+    const struct cs_hashmap* const_hm = &hm;
+    HASHMAP_FOR_EACH(const_hm, const char, void, k, v)
+        visited.insert(std::string(k, strnlen(k, 16)));
+    HASHMAP_END_EACH
+    EXPECT_THAT(hm.old_storage, NotNull());
+    EXPECT_THAT(visited, Eq(std::multiset<std::string>(expected.begin(), expected.end())));
+
+    hashmap_deinit(&hm);
+}
+
+class hashmap_modes : public TestWithParam<uint32_t>
+{
+};
+
+TEST_P(hashmap_modes, random_churn_matches_reference)
+{
+    cs_hashmap hm;
+    std::unordered_map<uint32_t, uint32_t> reference;
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<uint32_t> dist(0, 4000);
+    ASSERT_THAT(hashmap_init_with_options(&hm, sizeof(uint32_t), sizeof(uint32_t), 16, HM_DEFAULT_HASH, GetParam()), Eq(HM_OK));
+
+    for (int i = 0; i != 50000; ++i)
+    {
+        uint32_t key = dist(rng);
+        if (i % 3 == 0)
+        {
+            uint32_t* value = (uint32_t*)hashmap_erase(&hm, &key);
+            auto it = reference.find(key);
+            if (it == reference.end())
+                ASSERT_THAT(value, IsNull());
+            else
+            {
+                ASSERT_THAT(value, NotNull());
+                ASSERT_THAT(*value, Eq(it->second));
+                reference.erase(it);
+            }
+        }
+        else
+        {
+            uint32_t value = (uint32_t)i;
+            enum cs_hashmap_status status = hashmap_insert(&hm, &key, &value);
+            ASSERT_THAT(status, Eq(reference.count(key) ? HM_EXISTS : HM_OK));
+            reference.emplace(key, value);
+        }
+        ASSERT_THAT(hashmap_count(&hm), Eq(reference.size()));
+    }
+
+    for (auto& kv : reference)
+    {
+        uint32_t* value = (uint32_t*)hashmap_find(&hm, &kv.first);
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, Eq(kv.second));
+    }
+
+    hashmap_deinit(&hm);
+}
+
+TEST_P(hashmap_modes, hash_collisions)
+{
+    cs_hashmap hm;
+    char key[16];
+    float value = 0;
+    ASSERT_THAT(hashmap_init_with_options(&hm, 16, sizeof(float), 128, shitty_hash, GetParam()), Eq(HM_OK));
+    for (int i = 0; i != 40; ++i, value += 1.5f)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        ASSERT_THAT(hashmap_insert(&hm, key, &value), Eq(HM_OK));
+    }
+
+    // Erase from the front of the cluster, everything after must stay reachable
+    value = 0;
+    for (int i = 0; i != 40; i += 2, value += 3.0f)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        float* erased = (float*)hashmap_erase(&hm, key);
+        ASSERT_THAT(erased, NotNull());
+        EXPECT_THAT(*erased, FloatEq(value));
+    }
+
+    value = 1.5f;
+    for (int i = 1; i < 40; i += 2, value += 3.0f)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        float* found = (float*)hashmap_find(&hm, key);
+        ASSERT_THAT(found, NotNull());
+        EXPECT_THAT(*found, FloatEq(value));
+    }
+
+    hashmap_deinit(&hm);
+}
+
+TEST_P(hashmap_modes, find_or_emplace_counts_like_reference)
+{
+    cs_hashmap hm;
+    std::unordered_map<uint32_t, uint32_t> reference;
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<uint32_t> dist(0, 3000);
+    ASSERT_THAT(hashmap_init_with_options(&hm, sizeof(uint32_t), sizeof(uint32_t), 16, HM_DEFAULT_HASH, GetParam()), Eq(HM_OK));
+
+    for (int i = 0; i != 20000; ++i)
+    {
+        uint32_t key = dist(rng);
+        uint32_t* count;
+        enum cs_hashmap_status status = hashmap_find_or_emplace(&hm, &key, (void**)&count);
+        ASSERT_THAT(status, Eq(reference.count(key) ? HM_EXISTS : HM_OK));
+        if (status == HM_OK)
+            *count = 1;
+        else
+            ++*count;
+        reference[key]++;
+    }
+
+    ASSERT_THAT(hashmap_count(&hm), Eq(reference.size()));
+    for (auto& kv : reference)
+    {
+        uint32_t* count = (uint32_t*)hashmap_find(&hm, &kv.first);
+        ASSERT_THAT(count, NotNull());
+        EXPECT_THAT(*count, Eq(kv.second));
+    }
+
+    hashmap_deinit(&hm);
+}
+
+TEST_P(hashmap_modes, find_many_matches_find)
+{
+    cs_hashmap hm;
+    std::vector<uint32_t> keys;
+    ASSERT_THAT(hashmap_init_with_options(&hm, sizeof(uint32_t), sizeof(uint32_t), 16, HM_DEFAULT_HASH, GetParam()), Eq(HM_OK));
+    for (uint32_t i = 0; i != 1000; ++i)
+        ASSERT_THAT(hashmap_insert(&hm, &i, &i), Eq(HM_OK));
+
+    // Every other key is missing, and the count isn't a multiple of the batch size
+    for (uint32_t i = 0; i != 2001; ++i)
+        keys.push_back(i * 2);
+    std::vector<void*> values(keys.size());
+    EXPECT_THAT(hashmap_find_many(&hm, keys.data(), (uint32_t)keys.size(), values.data()), Eq(500u));
+
+    for (size_t i = 0; i != keys.size(); ++i)
+    {
+        ASSERT_THAT(values[i], Eq(hashmap_find(&hm, &keys[i])));
+        if (keys[i] < 1000)
+            EXPECT_THAT(*(uint32_t*)values[i], Eq(keys[i]));
+    }
+
+    hashmap_deinit(&hm);
+}
+
+TEST_P(hashmap_modes, string_keys_match_reference)
+{
+    cs_hashmap hm;
+    std::unordered_map<std::string, uint32_t> reference;
+    std::mt19937 rng(99);
+    std::uniform_int_distribution<uint32_t> dist(0, 3000);
+    ASSERT_THAT(hashmap_init_with_options(&hm, 0, sizeof(uint32_t), 16, HM_DEFAULT_HASH, GetParam() | HM_VARIABLE_KEYS), Eq(HM_OK));
+
+    for (int i = 0; i != 30000; ++i)
+    {
+        // Lengths from 0 up to a few hundred bytes
+        uint32_t n = dist(rng);
+        std::string key = std::to_string(n) + std::string(n % 300, 'x');
+        if (i % 3 == 0)
+        {
+            uint32_t* value = (uint32_t*)hashmap_erase_str(&hm, key.c_str());
+            auto it = reference.find(key);
+            if (it == reference.end())
+                ASSERT_THAT(value, IsNull());
+            else
+            {
+                ASSERT_THAT(value, NotNull());
+                ASSERT_THAT(*value, Eq(it->second));
+                reference.erase(it);
+            }
+        }
+        else
+        {
+            uint32_t value = (uint32_t)i;
+            ASSERT_THAT(hashmap_insert_str(&hm, key.c_str(), &value), Eq(reference.count(key) ? HM_EXISTS : HM_OK));
+            reference.emplace(key, value);
+        }
+    }
+
+    // The arena must not keep growing with the bytes of erased keys
+    EXPECT_THAT(hm.key_arena_garbage, Le(hm.key_arena_size));
+    ASSERT_THAT(hashmap_count(&hm), Eq(reference.size()));
+    for (auto& kv : reference)
+    {
+        uint32_t* value = (uint32_t*)hashmap_find_str(&hm, kv.first.c_str());
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, Eq(kv.second));
+    }
+
+    hashmap_deinit(&hm);
+}
+
+INSTANTIATE_TEST_SUITE_P(, hashmap_modes, Values(
+    0,
+    HM_INCREMENTAL_REHASH,
+    HM_ROBIN_HOOD,
+    HM_ROBIN_HOOD | HM_INCREMENTAL_REHASH,
+    HM_SHRINK,
+    HM_ROBIN_HOOD | HM_SHRINK | HM_INCREMENTAL_REHASH));
+
+TEST(hashmap_robin_hood, erase_leaves_no_tombstones)
+{
+    cs_hashmap hm;
+    char key[16];
+    ASSERT_THAT(hashmap_init_with_options(&hm, 16, 0, 128, shitty_hash, HM_ROBIN_HOOD), Eq(HM_OK));
+    for (int i = 0; i != 20; ++i)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        ASSERT_THAT(hashmap_insert(&hm, key, NULL), Eq(HM_OK));
+    }
+    for (int i = 0; i != 20; ++i)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        ASSERT_THAT(hashmap_erase(&hm, key), NotNull());
+    }
+
+    for (uint32_t i = 0; i != hm.table_count; ++i)
+        EXPECT_THAT(((uint8_t*)hm.storage)[i], Eq(HM_CTRL_EMPTY));
+
+    hashmap_deinit(&hm);
+}
+
+TEST(hashmap_tombstones, are_counted_and_reused)
+{
+    cs_hashmap hm;
+    char key[16];
+    ASSERT_THAT(hashmap_init_with_options(&hm, 16, 0, 128, shitty_hash, 0), Eq(HM_OK));
+    for (int i = 0; i != HM_GROUP_SIZE + 1; ++i)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        ASSERT_THAT(hashmap_insert(&hm, key, NULL), Eq(HM_OK));
+    }
+    EXPECT_THAT(hm.tombstones, Eq(0u));
+
+    memset(key, 0, sizeof key);
+    sprintf(key, "%d", 3);
+    ASSERT_THAT(hashmap_erase(&hm, key), NotNull());
+    EXPECT_THAT(hm.tombstones, Eq(1u));
+    ASSERT_THAT(hashmap_insert(&hm, key, NULL), Eq(HM_OK));
+    EXPECT_THAT(hm.tombstones, Eq(0u));
+
+    hashmap_deinit(&hm);
+}
+
+TEST(hashmap_tombstones, are_purged_in_place)
+{
+    cs_hashmap hm;
+    char key[16];
+    float value;
+    ASSERT_THAT(hashmap_init_with_options(&hm, 16, sizeof(float), 128, shitty_hash, 0), Eq(HM_OK));
+    for (int i = 0; i != 64; ++i)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        value = (float)i;
+        ASSERT_THAT(hashmap_insert(&hm, key, &value), Eq(HM_OK));
+    }
+    for (int i = 0; i != 48; ++i)
+    {
+        if (i % 6 == 0)
+            continue;
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        ASSERT_THAT(hashmap_erase(&hm, key), NotNull());
+    }
+    ASSERT_THAT(hm.tombstones, Eq(40u));
+
+    // Next insertion exceeds the tombstone limit
+    memset(key, 0, sizeof key);
+    sprintf(key, "%d", 1000);
+    value = 1000;
+    ASSERT_THAT(hashmap_insert(&hm, key, &value), Eq(HM_OK));
+    EXPECT_THAT(hm.tombstones, Eq(0u));
+    EXPECT_THAT(hm.table_count, Eq(128u));
+    EXPECT_THAT(hashmap_count(&hm), Eq(25u));
+
+    for (int i = 0; i != 64; ++i)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        float* found = (float*)hashmap_find(&hm, key);
+        if (i < 48 && i % 6 != 0)
+            EXPECT_THAT(found, IsNull());
+        else
+        {
+            ASSERT_THAT(found, NotNull());
+            EXPECT_THAT(*found, FloatEq((float)i));
+        }
+    }
+
+    hashmap_deinit(&hm);
+}
+
+TEST(hashmap_tombstones, churn_does_not_grow_table)
+{
+    cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_with_options(&hm, sizeof(uint32_t), sizeof(uint32_t), 16, HM_DEFAULT_HASH, 0), Eq(HM_OK));
+    for (uint32_t i = 0; i != 1000; ++i)
+        ASSERT_THAT(hashmap_insert(&hm, &i, &i), Eq(HM_OK));
+    uint32_t table_count = hm.table_count;
+
+    // Sliding window of 1000 live keys
+    for (uint32_t i = 1000; i != 100000; ++i)
+    {
+        uint32_t erase = i - 1000;
+        ASSERT_THAT(hashmap_erase(&hm, &erase), NotNull());
+        ASSERT_THAT(hashmap_insert(&hm, &i, &i), Eq(HM_OK));
+        ASSERT_THAT(hm.tombstones * 100 / hm.table_count, Lt((uint32_t)CSTRUCTURES_HASHMAP_TOMBSTONE_PERCENT));
+    }
+    EXPECT_THAT(hm.table_count, Eq(table_count));
+
+    for (uint32_t i = 99000; i != 100000; ++i)
+    {
+        uint32_t* value = (uint32_t*)hashmap_find(&hm, &i);
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, Eq(i));
+    }
+
+    hashmap_deinit(&hm);
+}
+
+TEST(hashmap_shrink, shrink_to_fit)
+{
+    cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_with_options(&hm, sizeof(uint32_t), sizeof(uint32_t), 16, HM_DEFAULT_HASH, 0), Eq(HM_OK));
+    for (uint32_t i = 0; i != 1000; ++i)
+        ASSERT_THAT(hashmap_insert(&hm, &i, &i), Eq(HM_OK));
+    for (uint32_t i = 10; i != 1000; ++i)
+        ASSERT_THAT(hashmap_erase(&hm, &i), NotNull());
+    EXPECT_THAT(hm.table_count, Eq(2048u));
+
+    ASSERT_THAT(hashmap_shrink_to_fit(&hm), Eq(HM_OK));
+    EXPECT_THAT(hm.table_count, Eq(16u));
+    EXPECT_THAT(hm.tombstones, Eq(0u));
+    for (uint32_t i = 0; i != 10; ++i)
+    {
+        uint32_t* value = (uint32_t*)hashmap_find(&hm, &i);
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, Eq(i));
+    }
+
+    hashmap_deinit(&hm);
+}
+
+TEST(hashmap_shrink, shrink_to_fit_purges_tombstones)
+{
+    cs_hashmap hm;
+    char key[16];
+    ASSERT_THAT(hashmap_init_with_options(&hm, 16, 0, 16, shitty_hash, 0), Eq(HM_OK));
+    for (int i = 0; i != HM_GROUP_SIZE + 1; ++i)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        ASSERT_THAT(hashmap_insert(&hm, key, NULL), Eq(HM_OK));
+    }
+    ASSERT_THAT(hm.table_count, Eq(32u));
+
+    // Erasing from the full group leaves a tombstone, but the table can't shrink
+    memset(key, 0, sizeof key);
+    sprintf(key, "%d", 0);
+    ASSERT_THAT(hashmap_erase(&hm, key), NotNull());
+    ASSERT_THAT(hm.tombstones, Eq(1u));
+
+    ASSERT_THAT(hashmap_shrink_to_fit(&hm), Eq(HM_OK));
+    EXPECT_THAT(hm.table_count, Eq(32u));
+    EXPECT_THAT(hm.tombstones, Eq(0u));
+    for (int i = 1; i != HM_GROUP_SIZE + 1; ++i)
+    {
+        memset(key, 0, sizeof key);
+        sprintf(key, "%d", i);
+        EXPECT_THAT(hashmap_find(&hm, key), NotNull());
+    }
+
+    hashmap_deinit(&hm);
+}
+
+TEST(hashmap_shrink, low_water_mark_shrinks_on_erase)
+{
+    cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_with_options(&hm, sizeof(uint32_t), sizeof(uint32_t), 16, HM_DEFAULT_HASH, HM_SHRINK), Eq(HM_OK));
+    for (uint32_t i = 0; i != 10000; ++i)
+        ASSERT_THAT(hashmap_insert(&hm, &i, &i), Eq(HM_OK));
+    EXPECT_THAT(hm.table_count, Eq(16384u));
+
+    for (uint32_t i = 0; i != 9990; ++i)
+    {
+        uint32_t* value = (uint32_t*)hashmap_erase(&hm, &i);
+        ASSERT_THAT(value, NotNull());
+        ASSERT_THAT(*value, Eq(i));
+    }
+    EXPECT_THAT(hm.table_count, Le(64u));
+
+    for (uint32_t i = 9990; i != 10000; ++i)
+    {
+        uint32_t* value = (uint32_t*)hashmap_find(&hm, &i);
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, Eq(i));
+    }
+
+    hashmap_deinit(&hm);
+}
+
+#if CSTRUCTURES_HASHMAP_SHRINK_AT_PERCENT == 10
+TEST(hashmap_shrink, shrinking_leaves_the_load_between_a_quarter_and_half_of_the_rehash_load)
+{
+    cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_with_options(&hm, sizeof(uint32_t), sizeof(uint32_t), 1024, HM_DEFAULT_HASH, HM_SHRINK), Eq(HM_OK));
+    for (uint32_t i = 0; i != 102; ++i)
+        ASSERT_THAT(hashmap_insert(&hm, &i, &i), Eq(HM_OK));
+    EXPECT_THAT(hm.table_count, Eq(1024u));
+
+    /* 102 entries are below 10% of 1024 slots. 256 slots hold them at 39.8%,
+     * halving again would reach 79.7%, which is more than half of 88% */
+    uint32_t key = 0;
+    ASSERT_THAT(hashmap_erase(&hm, &key), NotNull());
+    EXPECT_THAT(hm.table_count, Eq(256u));
+    EXPECT_THAT(hashmap_count(&hm), Eq(101u));
+
+    hashmap_deinit(&hm);
+}
+#endif
+
+TEST(hashmap_str, keys_are_compared_by_length_and_content)
+{
+    cs_hashmap hm;
+    int a = 1, b = 2, c = 3;
+    std::string long_key(1000, 'a');
+    ASSERT_THAT(hashmap_init_str(&hm, sizeof(int)), Eq(HM_OK));
+
+    ASSERT_THAT(hashmap_insert_str(&hm, "abc", &a), Eq(HM_OK));
+    ASSERT_THAT(hashmap_insert_str(&hm, "ab", &b), Eq(HM_OK));
+    ASSERT_THAT(hashmap_insert_str(&hm, "", &c), Eq(HM_OK));
+    ASSERT_THAT(hashmap_insert_str(&hm, long_key.c_str(), &c), Eq(HM_OK));
+    EXPECT_THAT(hashmap_insert_str(&hm, "abc", &c), Eq(HM_EXISTS));
+    EXPECT_THAT(hashmap_count(&hm), Eq(4u));
+
+    // Only the actual string lengths are stored
+    EXPECT_THAT(hm.key_arena_size, Eq(1005u));
+    EXPECT_THAT(hm.key_size, Eq(8u));
+
+    EXPECT_THAT(*(int*)hashmap_find_str(&hm, "abc"), Eq(1));
+    EXPECT_THAT(*(int*)hashmap_find_str(&hm, "ab"), Eq(2));
+    EXPECT_THAT(*(int*)hashmap_find_str(&hm, ""), Eq(3));
+    EXPECT_THAT(hashmap_find_str(&hm, long_key.c_str()), NotNull());
+    EXPECT_THAT(hashmap_find_str(&hm, "a"), IsNull());
+    EXPECT_THAT(hashmap_find_str(&hm, "abcd"), IsNull());
+
+    EXPECT_THAT(*(int*)hashmap_erase_str(&hm, "ab"), Eq(2));
+    EXPECT_THAT(hashmap_erase_str(&hm, "ab"), IsNull());
+    EXPECT_THAT(hashmap_find_str(&hm, "abc"), NotNull());
+
+    hashmap_deinit(&hm);
+}
+
+TEST(hashmap_str, find_or_emplace)
+{
+    cs_hashmap hm;
+    int* count;
+    ASSERT_THAT(hashmap_init_str(&hm, sizeof(int)), Eq(HM_OK));
+    ASSERT_THAT(hashmap_find_or_emplace_str(&hm, "word", (void**)&count), Eq(HM_OK));
+    *count = 1;
+    ASSERT_THAT(hashmap_find_or_emplace_str(&hm, "word", (void**)&count), Eq(HM_EXISTS));
+    ++*count;
+    EXPECT_THAT(*(int*)hashmap_find_str(&hm, "word"), Eq(2));
+    EXPECT_THAT(hm.key_arena_size, Eq(4u));
+    hashmap_deinit(&hm);
+}
+
+TEST(hashmap_str, for_each_returns_key_strings)
+{
+    cs_hashmap hm;
+    std::unordered_map<std::string, int> visited;
+    ASSERT_THAT(hashmap_init_str(&hm, sizeof(int)), Eq(HM_OK));
+    for (int i = 0; i != 100; ++i)
+        ASSERT_THAT(hashmap_insert_str(&hm, std::to_string(i).c_str(), &i), Eq(HM_OK));
+
+    HASHMAP_FOR_EACH(&hm, void, int, key, value)
+        uint32_t length;
+        const char* str = hashmap_key_str(&hm, key, &length);
+        visited[std::string(str, length)] = *value;
+    HASHMAP_END_EACH
+
+    ASSERT_THAT(visited.size(), Eq(100u));
+    for (int i = 0; i != 100; ++i)
+        EXPECT_THAT(visited[std::to_string(i)], Eq(i));
+
+    hashmap_deinit(&hm);
+}
+
+TEST(hashmap_str, shrink_to_fit_compacts_key_arena)
+{
+    cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_str(&hm, 0), Eq(HM_OK));
+    for (int i = 0; i != 1000; ++i)
+        ASSERT_THAT(hashmap_insert_str(&hm, ("key" + std::to_string(i)).c_str(), NULL), Eq(HM_OK));
+    for (int i = 10; i != 1000; ++i)
+        ASSERT_THAT(hashmap_erase_str(&hm, ("key" + std::to_string(i)).c_str()), NotNull());
+
+    ASSERT_THAT(hashmap_shrink_to_fit(&hm), Eq(HM_OK));
+    EXPECT_THAT(hm.key_arena_garbage, Eq(0u));
+    EXPECT_THAT(hm.key_arena_size, Eq(40u));
+    EXPECT_THAT(hm.key_arena_capacity, Eq(40u));
+    for (int i = 0; i != 10; ++i)
+        EXPECT_THAT(hashmap_find_str(&hm, ("key" + std::to_string(i)).c_str()), NotNull());
+
+    hashmap_deinit(&hm);
+}
+
+struct composite_key
+{
+    uint32_t tenant;
+    char name[20];
+    uint64_t timestamp;
+};
+
+static composite_key make_key(uint32_t tenant, const std::string& name, uint64_t timestamp)
+{
+    composite_key key;
+    memset(&key, 0, sizeof(key));
+    key.tenant = tenant;
+    strcpy(key.name, name.c_str());
+    key.timestamp = timestamp;
+    return key;
+}
+
+static cs_hashmap_hash composite_key_hash(const void* data, void* user)
+{
+    const composite_key* key = (const composite_key*)data;
+    struct cs_wyhash_state state;
+    ++*(int*)user;
+    hash32_wyhash_init(&state);
+    hash32_wyhash_update(&state, &key->tenant, sizeof(key->tenant));
+    hash32_wyhash_update(&state, key->name, strlen(key->name));
+    hash32_wyhash_update(&state, &key->timestamp, sizeof(key->timestamp));
+#if defined(CSTRUCTURES_HASHMAP_64BIT)
+    return hash64_wyhash_final(&state);
+#else
+    return hash32_wyhash_final(&state);
+#endif
+}
+
+TEST(hashmap_key_hash, composite_keys_are_hashed_by_callback)
+{
+    cs_hashmap hm;
+    int calls = 0;
+    ASSERT_THAT(hashmap_init(&hm, sizeof(composite_key), sizeof(int)), Eq(HM_OK));
+    hashmap_set_key_hash(&hm, composite_key_hash, &calls);
+
+    for (int i = 0; i != 1000; ++i)
+    {
+        composite_key key = make_key(i % 7, "user" + std::to_string(i), i * 1000);
+        ASSERT_THAT(hashmap_insert(&hm, &key, &i), Eq(HM_OK));
+    }
+    EXPECT_THAT(calls, Eq(1000));
+
+    for (int i = 0; i != 1000; ++i)
+    {
+        composite_key key = make_key(i % 7, "user" + std::to_string(i), i * 1000);
+        int* value = (int*)hashmap_find(&hm, &key);
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, Eq(i));
+    }
+    composite_key missing = make_key(1, "user1", 1001);
+    EXPECT_THAT(hashmap_find(&hm, &missing), IsNull());
+
+    /* Same result as hashing the concatenated fields in one go */
+    composite_key key = make_key(3, "abc", 99);
+    char buf[4 + 3 + 8];
+    memcpy(buf, &key.tenant, 4);
+    memcpy(buf + 4, "abc", 3);
+    memcpy(buf + 7, &key.timestamp, 8);
+#if defined(CSTRUCTURES_HASHMAP_64BIT)
+    EXPECT_THAT(hashmap_hash_key(&hm, &key), Eq(hash64_wyhash(buf, sizeof(buf))));
+#else
+    EXPECT_THAT(hashmap_hash_key(&hm, &key), Eq(hash32_wyhash(buf, sizeof(buf))));
+#endif
+
+    /* Can't be saved, as the callback isn't known to the file format */
+    EXPECT_THAT(hashmap_save(&hm, -1), Eq(-1));
+
+    hashmap_deinit(&hm);
+}
+
+#if defined(CSTRUCTURES_HASHMAP_64BIT)
+static cs_hashmap_hash high_bits_hash(const void* data, uintptr_t len)
+{
+    /* Every key has the same low 32 bits, including the control tag */
+    uint32_t key;
+    memcpy(&key, data, sizeof(key));
+    return ((cs_hashmap_hash)key << 32) | 0x5A;
+}
+
+TEST(hashmap_64bit, hashes_differing_in_the_high_bits_are_distinct)
+{
+    cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_with_options(&hm, sizeof(uint32_t), sizeof(uint32_t), 16, high_bits_hash, 0), Eq(HM_OK));
+    for (uint32_t i = 0; i != 1000; ++i)
+        ASSERT_THAT(hashmap_insert(&hm, &i, &i), Eq(HM_OK));
+    for (uint32_t i = 0; i != 1000; ++i)
+    {
+        uint32_t* value = (uint32_t*)hashmap_find(&hm, &i);
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, Eq(i));
+    }
+    uint32_t missing = 1000;
+    EXPECT_THAT(hashmap_find(&hm, &missing), IsNull());
+    EXPECT_THAT(hashmap_hash_key(&hm, &missing), Eq(((cs_hashmap_hash)1000 << 32) | 0x5A));
+    hashmap_deinit(&hm);
+}
+#endif
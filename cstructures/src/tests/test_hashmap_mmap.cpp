@@ -0,0 +1,345 @@
+#include <gmock/gmock.h>
+#include "cstructures/hashmap.h"
+#include <cstdio>
+#include <string>
+
+#define NAME hashmap_mmap
+
+using namespace testing;
+
+class NAME : public Test
+{
+public:
+    virtual void TearDown()
+    {
+        remove(path);
+    }
+
+    int save(struct cs_hashmap* hm)
+    {
+        FILE* fp = fopen(path, "wb");
+        if (fp == NULL)
+            return -1;
+        int result = hashmap_save(hm, fileno(fp));
+        fclose(fp);
+        return result;
+    }
+
+    const char* path = "test_hashmap_mmap.bin";
+};
+
+TEST_F(NAME, mapped_hashmap_finds_all_keys)
+{
+    struct cs_hashmap hm;
+    ASSERT_THAT(hashmap_init(&hm, sizeof(uint32_t), sizeof(uint64_t)), Eq(HM_OK));
+    for (uint32_t i = 0; i != 10000; ++i)
+    {
+        uint64_t value = (uint64_t)i * 3;
+        ASSERT_THAT(hashmap_insert(&hm, &i, &value), Eq(HM_OK));
+    }
+    for (uint32_t i = 0; i < 10000; i += 7)
+        ASSERT_THAT(hashmap_erase(&hm, &i), NotNull());
+    ASSERT_THAT(save(&hm), Eq(0));
+
+    struct cs_hashmap mapped;
+    ASSERT_THAT(hashmap_open_mmap(&mapped, path), Eq(0));
+    EXPECT_THAT(mapped.flags & HM_MAPPED, Ne(0u));
+    EXPECT_THAT(hashmap_count(&mapped), Eq(hashmap_count(&hm)));
+    for (uint32_t i = 0; i != 10000; ++i)
+    {
+        uint64_t* value = (uint64_t*)hashmap_find(&mapped, &i);
+        if (i % 7 == 0)
+        {
+            ASSERT_THAT(value, IsNull());
+        }
+        else
+        {
+            ASSERT_THAT(value, NotNull());
+            ASSERT_THAT(*value, Eq((uint64_t)i * 3));
+        }
+    }
+
+    uint32_t count = 0;
+    HASHMAP_FOR_EACH(&mapped, uint32_t, uint64_t, key, value)
+        EXPECT_THAT(*value, Eq((uint64_t)*key * 3));
+        count++;
+    HASHMAP_END_EACH
+    EXPECT_THAT(count, Eq(hashmap_count(&hm)));
+
+    hashmap_deinit(&mapped);
+    hashmap_deinit(&hm);
+}
+
+TEST_F(NAME, robin_hood_hashmap_can_be_mapped)
+{
+    struct cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_with_options(&hm, sizeof(uint32_t), sizeof(uint32_t), 16,
+                                          HM_DEFAULT_HASH, HM_ROBIN_HOOD), Eq(HM_OK));
+    for (uint32_t i = 0; i != 1000; ++i)
+        ASSERT_THAT(hashmap_insert(&hm, &i, &i), Eq(HM_OK));
+    ASSERT_THAT(save(&hm), Eq(0));
+    hashmap_deinit(&hm);
+
+    ASSERT_THAT(hashmap_open_mmap(&hm, path), Eq(0));
+    EXPECT_THAT(hm.flags & HM_ROBIN_HOOD, Ne(0u));
+    for (uint32_t i = 0; i != 1000; ++i)
+    {
+        ASSERT_THAT(hashmap_find(&hm, &i), NotNull());
+        EXPECT_THAT(*(uint32_t*)hashmap_find(&hm, &i), Eq(i));
+    }
+    uint32_t missing = 1000;
+    EXPECT_THAT(hashmap_find(&hm, &missing), IsNull());
+    hashmap_deinit(&hm);
+}
+
+TEST_F(NAME, string_keys_are_mapped_with_their_arena)
+{
+    struct cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_str(&hm, sizeof(uint32_t)), Eq(HM_OK));
+    for (uint32_t i = 0; i != 1000; ++i)
+    {
+        std::string key = "key " + std::to_string(i);
+        ASSERT_THAT(hashmap_insert_str(&hm, key.c_str(), &i), Eq(HM_OK));
+    }
+    ASSERT_THAT(save(&hm), Eq(0));
+    hashmap_deinit(&hm);
+
+    ASSERT_THAT(hashmap_open_mmap(&hm, path), Eq(0));
+    for (uint32_t i = 0; i != 1000; ++i)
+    {
+        std::string key = "key " + std::to_string(i);
+        uint32_t* value = (uint32_t*)hashmap_find_str(&hm, key.c_str());
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, Eq(i));
+    }
+    EXPECT_THAT(hashmap_find_str(&hm, "key 1000"), IsNull());
+    hashmap_deinit(&hm);
+}
+
+static cs_hashmap_hash custom_hash(const void* data, uintptr_t len)
+{
+    return HM_DEFAULT_HASH(data, len) ^ 1;
+}
+
+TEST_F(NAME, unknown_hash_functions_are_not_saved)
+{
+    struct cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_with_options(&hm, sizeof(uint32_t), sizeof(uint32_t), 16,
+                                          custom_hash, 0), Eq(HM_OK));
+    EXPECT_THAT(save(&hm), Eq(-1));
+    hashmap_deinit(&hm);
+}
+
+TEST_F(NAME, invalid_files_are_rejected)
+{
+    struct cs_hashmap hm;
+    EXPECT_THAT(hashmap_open_mmap(&hm, "does_not_exist.bin"), Eq(-1));
+
+    FILE* fp = fopen(path, "wb");
+    ASSERT_THAT(fp, NotNull());
+    fputs("this is not a hashmap, but it is long enough to contain a header", fp);
+    fclose(fp);
+    EXPECT_THAT(hashmap_open_mmap(&hm, path), Eq(-1));
+
+    /* Truncated file */
+    ASSERT_THAT(hashmap_init(&hm, sizeof(uint32_t), sizeof(uint32_t)), Eq(HM_OK));
+    ASSERT_THAT(save(&hm), Eq(0));
+    hashmap_deinit(&hm);
+    fp = fopen(path, "rb");
+    ASSERT_THAT(fp, NotNull());
+    char buf[100];
+    size_t len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    fp = fopen(path, "wb");
+    fwrite(buf, 1, len, fp);
+    fclose(fp);
+    EXPECT_THAT(hashmap_open_mmap(&hm, path), Eq(-1));
+}
+
+TEST_F(NAME, trailing_bytes_are_ignored_but_unmapped)
+{
+    struct cs_hashmap hm;
+    ASSERT_THAT(hashmap_init(&hm, sizeof(uint32_t), sizeof(uint32_t)), Eq(HM_OK));
+    for (uint32_t i = 0; i != 100; ++i)
+        ASSERT_THAT(hashmap_insert(&hm, &i, &i), Eq(HM_OK));
+    ASSERT_THAT(save(&hm), Eq(0));
+    hashmap_deinit(&hm);
+
+    FILE* fp = fopen(path, "ab");
+    ASSERT_THAT(fp, NotNull());
+    std::string tail(100000, 'x');
+    fwrite(tail.data(), 1, tail.size(), fp);
+    long file_size = ftell(fp);
+    fclose(fp);
+
+    ASSERT_THAT(hashmap_open_mmap(&hm, path), Eq(0));
+    EXPECT_THAT(hm.mapped_size, Eq((uint64_t)file_size));
+    for (uint32_t i = 0; i != 100; ++i)
+    {
+        uint32_t* value = (uint32_t*)hashmap_find(&hm, &i);
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, Eq(i));
+    }
+    hashmap_deinit(&hm);
+}
+
+TEST_F(NAME, saving_ignores_the_file_offset)
+{
+    struct cs_hashmap hm;
+    ASSERT_THAT(hashmap_init(&hm, sizeof(uint32_t), sizeof(uint32_t)), Eq(HM_OK));
+    for (uint32_t i = 0; i != 100; ++i)
+        ASSERT_THAT(hashmap_insert(&hm, &i, &i), Eq(HM_OK));
+
+    FILE* fp = fopen(path, "wb");
+    ASSERT_THAT(fp, NotNull());
+    fputs("some bytes before the map", fp);
+    fflush(fp);
+    EXPECT_THAT(hashmap_save(&hm, fileno(fp)), Eq(0));
+    fclose(fp);
+    hashmap_deinit(&hm);
+
+    ASSERT_THAT(hashmap_open_mmap(&hm, path), Eq(0));
+    EXPECT_THAT(hashmap_count(&hm), Eq(100u));
+    hashmap_deinit(&hm);
+}
+
+TEST_F(NAME, empty_slots_are_saved_as_zeros)
+{
+    struct cs_hashmap hm;
+    ASSERT_THAT(hashmap_init(&hm, sizeof(uint32_t), sizeof(uint64_t)), Eq(HM_OK));
+    for (uint32_t i = 0; i != 100; ++i)
+    {
+        uint64_t value = ~(uint64_t)i;
+        ASSERT_THAT(hashmap_insert(&hm, &i, &value), Eq(HM_OK));
+    }
+    for (uint32_t i = 0; i != 100; ++i)
+        ASSERT_THAT(hashmap_erase(&hm, &i), NotNull());
+    size_t table_count = hm.table_count;
+    ASSERT_THAT(save(&hm), Eq(0));
+    hashmap_deinit(&hm);
+
+    FILE* fp = fopen(path, "rb");
+    ASSERT_THAT(fp, NotNull());
+    std::string contents;
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+        contents.append(buf, len);
+    fclose(fp);
+
+    /* Everything after the header and the tags belongs to erased entries */
+    size_t begin = contents.size() - (sizeof(cs_hashmap_hash) + 4 + 8) * (table_count + 1);
+    ASSERT_THAT(begin, Ge(table_count));
+    for (size_t i = begin; i != contents.size(); ++i)
+        ASSERT_THAT(contents[i], Eq('\0')) << "at offset " << i;
+}
+
+/* Offsets of the fields in the file header */
+#define HEADER_KEY_SIZE      24
+#define HEADER_VALUE_SIZE    28
+#define HEADER_FLAGS         32
+#define HEADER_TABLE_COUNT   40
+#define HEADER_SLOTS_USED    48
+#define HEADER_STORAGE_SIZE  64
+#define HEADER_SIZE          80
+
+static std::string read_file(const char* path)
+{
+    std::string contents;
+    char buf[4096];
+    size_t len;
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return contents;
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+        contents.append(buf, len);
+    fclose(fp);
+    return contents;
+}
+
+static void write_file(const char* path, const std::string& contents)
+{
+    FILE* fp = fopen(path, "wb");
+    fwrite(contents.data(), 1, contents.size(), fp);
+    fclose(fp);
+}
+
+template <typename T>
+static void patch(std::string* contents, size_t offset, T value)
+{
+    memcpy(&(*contents)[offset], &value, sizeof(value));
+}
+
+TEST_F(NAME, header_sizes_that_overflow_are_rejected)
+{
+    struct cs_hashmap hm;
+    ASSERT_THAT(hashmap_init(&hm, sizeof(uint32_t), sizeof(uint32_t)), Eq(HM_OK));
+    ASSERT_THAT(save(&hm), Eq(0));
+    hashmap_deinit(&hm);
+    const std::string original = read_file(path);
+
+    /*
+     * Slot size * (table_count + 1) is 2^64 + 2^31 - 3, which wraps around to
+     * a storage size of 2^31 - 3. Make the file that large (it is sparse
+     * where supported) so only the overflow check can reject it.
+     */
+    uint32_t huge = (uint32_t)(((uint64_t)1 << 32) - 2 - sizeof(cs_hashmap_hash) / 2);
+    uint64_t table_count = (uint64_t)1 << 31;
+    uint64_t wrapped = (1 + sizeof(cs_hashmap_hash) + (uint64_t)huge + huge) * (table_count + 1);
+    ASSERT_THAT(wrapped, Eq(((uint64_t)1 << 31) - 3));
+    std::string contents = original;
+    patch(&contents, HEADER_KEY_SIZE, huge);
+    patch(&contents, HEADER_VALUE_SIZE, huge);
+    patch(&contents, HEADER_TABLE_COUNT, table_count);
+    patch(&contents, HEADER_STORAGE_SIZE, wrapped);
+    write_file(path, contents);
+    FILE* fp = fopen(path, "r+b");
+    ASSERT_THAT(fp, NotNull());
+#if defined(_WIN32)
+    ASSERT_THAT(_fseeki64(fp, (__int64)(HEADER_SIZE + wrapped - 1), SEEK_SET), Eq(0));
+#else
+    ASSERT_THAT(fseeko(fp, (off_t)(HEADER_SIZE + wrapped - 1), SEEK_SET), Eq(0));
+#endif
+    fputc(0, fp);
+    fclose(fp);
+    EXPECT_THAT(hashmap_open_mmap(&hm, path), Eq(-1));
+
+    /* More slots in use than the table has */
+    contents = original;
+    patch(&contents, HEADER_SLOTS_USED, (uint64_t)1 << 40);
+    write_file(path, contents);
+    EXPECT_THAT(hashmap_open_mmap(&hm, path), Eq(-1));
+
+    /* Unknown flags */
+    contents = original;
+    patch(&contents, HEADER_FLAGS, (uint32_t)0x80000000);
+    write_file(path, contents);
+    EXPECT_THAT(hashmap_open_mmap(&hm, path), Eq(-1));
+
+    /* The unmodified file still opens */
+    write_file(path, original);
+    ASSERT_THAT(hashmap_open_mmap(&hm, path), Eq(0));
+    hashmap_deinit(&hm);
+}
+
+TEST_F(NAME, string_keys_outside_of_the_arena_are_rejected)
+{
+    struct cs_hashmap hm;
+    ASSERT_THAT(hashmap_init_str(&hm, sizeof(uint32_t)), Eq(HM_OK));
+    uint32_t value = 1;
+    ASSERT_THAT(hashmap_insert_str(&hm, "key", &value), Eq(HM_OK));
+    cs_hashmap_size table_count = hm.table_count;
+    ASSERT_THAT(save(&hm), Eq(0));
+    hashmap_deinit(&hm);
+
+    /* Point every slot's key far past the end of the arena. Empty slots are
+     * written as zeros and aren't checked, so only the one key matters */
+    std::string contents = read_file(path);
+    for (cs_hashmap_size pos = 0; pos != table_count; ++pos)
+    {
+        size_t ref = HEADER_SIZE + table_count + (sizeof(cs_hashmap_hash) + 8) * pos + sizeof(cs_hashmap_hash);
+        patch(&contents, ref + 4, (uint32_t)0x7FFFFFFF);
+    }
+    write_file(path, contents);
+    EXPECT_THAT(hashmap_open_mmap(&hm, path), Eq(-1));
+}
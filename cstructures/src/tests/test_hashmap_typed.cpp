@@ -0,0 +1,150 @@
+#include <gmock/gmock.h>
+#include "cstructures/hashmap_typed.h"
+#include <random>
+#include <unordered_map>
+
+#define NAME hashmap_typed
+
+using namespace testing;
+
+static cs_hashmap_hash hash_u32(uint32_t key)
+{
+    return HM_DEFAULT_HASH(&key, sizeof(key));
+}
+static cs_hashmap_hash hash_u64(uint64_t key)
+{
+    return HM_DEFAULT_HASH(&key, sizeof(key));
+}
+static cs_hashmap_hash hash_collide(uint64_t key)
+{
+    return 42;
+}
+#define equal(a, b) ((a) == (b))
+
+CS_HASHMAP_TYPED(u32map, uint32_t, uint32_t, hash_u32, equal)
+CS_HASHMAP_TYPED(ptrmap, uint64_t, void*, hash_u64, equal)
+CS_HASHMAP_TYPED(collidemap, uint64_t, uint64_t, hash_collide, equal)
+
+TEST(NAME, insert_find_erase)
+{
+    cs_hashmap hm;
+    ASSERT_THAT(u32map_init(&hm), Eq(HM_OK));
+    EXPECT_THAT(u32map_insert(&hm, 1, 10), Eq(HM_OK));
+    EXPECT_THAT(u32map_insert(&hm, 2, 20), Eq(HM_OK));
+    EXPECT_THAT(u32map_insert(&hm, 1, 30), Eq(HM_EXISTS));
+    EXPECT_THAT(hashmap_count(&hm), Eq(2u));
+
+    ASSERT_THAT(u32map_find(&hm, 1), NotNull());
+    EXPECT_THAT(*u32map_find(&hm, 1), Eq(10u));
+    EXPECT_THAT(*u32map_find(&hm, 2), Eq(20u));
+    EXPECT_THAT(u32map_find(&hm, 3), IsNull());
+
+    ASSERT_THAT(u32map_erase(&hm, 1), NotNull());
+    EXPECT_THAT(u32map_erase(&hm, 1), IsNull());
+    EXPECT_THAT(u32map_find(&hm, 1), IsNull());
+    EXPECT_THAT(hashmap_count(&hm), Eq(1u));
+
+    hashmap_deinit(&hm);
+}
+
+TEST(NAME, is_compatible_with_generic_functions)
+{
+    cs_hashmap hm;
+    uint64_t key = 5;
+    int a = 0;
+    ASSERT_THAT(ptrmap_init(&hm), Eq(HM_OK));
+    ASSERT_THAT(ptrmap_insert(&hm, 5, &a), Eq(HM_OK));
+
+    void** value = (void**)hashmap_find(&hm, &key);
+    ASSERT_THAT(value, NotNull());
+    EXPECT_THAT(*value, Eq((void*)&a));
+
+    key = 6;
+    ASSERT_THAT(hashmap_insert(&hm, &key, &value), Eq(HM_OK));
+    EXPECT_THAT(ptrmap_find(&hm, 6), NotNull());
+
+    int visited = 0;
+    HASHMAP_FOR_EACH(&hm, uint64_t, void*, k, v)
+        visited++;
+    HASHMAP_END_EACH
+    EXPECT_THAT(visited, Eq(2));
+
+    hashmap_deinit(&hm);
+}
+
+TEST(NAME, find_or_emplace)
+{
+    cs_hashmap hm;
+    uint32_t* count;
+    ASSERT_THAT(u32map_init(&hm), Eq(HM_OK));
+    ASSERT_THAT(u32map_find_or_emplace(&hm, 7, &count), Eq(HM_OK));
+    *count = 1;
+    ASSERT_THAT(u32map_find_or_emplace(&hm, 7, &count), Eq(HM_EXISTS));
+    ++*count;
+    EXPECT_THAT(*u32map_find(&hm, 7), Eq(2u));
+    hashmap_deinit(&hm);
+}
+
+TEST(NAME, hash_collisions_spill_over_into_next_group)
+{
+    cs_hashmap hm;
+    ASSERT_THAT(collidemap_init(&hm), Eq(HM_OK));
+    for (uint64_t i = 0; i != 40; ++i)
+        ASSERT_THAT(collidemap_insert(&hm, i, i * 2), Eq(HM_OK));
+    for (uint64_t i = 0; i < 40; i += 3)
+        ASSERT_THAT(collidemap_erase(&hm, i), NotNull());
+    for (uint64_t i = 0; i != 40; ++i)
+    {
+        uint64_t* value = collidemap_find(&hm, i);
+        if (i % 3 == 0)
+            EXPECT_THAT(value, IsNull());
+        else
+        {
+            ASSERT_THAT(value, NotNull());
+            EXPECT_THAT(*value, Eq(i * 2));
+        }
+    }
+    hashmap_deinit(&hm);
+}
+
+TEST(NAME, random_churn_matches_reference)
+{
+    cs_hashmap hm;
+    std::unordered_map<uint32_t, uint32_t> reference;
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<uint32_t> dist(0, 4000);
+    ASSERT_THAT(u32map_init(&hm), Eq(HM_OK));
+
+    for (uint32_t i = 0; i != 100000; ++i)
+    {
+        uint32_t key = dist(rng);
+        if (i % 2 == 0)
+        {
+            uint32_t* value = u32map_erase(&hm, key);
+            auto it = reference.find(key);
+            if (it == reference.end())
+                ASSERT_THAT(value, IsNull());
+            else
+            {
+                ASSERT_THAT(value, NotNull());
+                ASSERT_THAT(*value, Eq(it->second));
+                reference.erase(it);
+            }
+        }
+        else
+        {
+            ASSERT_THAT(u32map_insert(&hm, key, i), Eq(reference.count(key) ? HM_EXISTS : HM_OK));
+            reference.emplace(key, i);
+        }
+        ASSERT_THAT(hashmap_count(&hm), Eq(reference.size()));
+    }
+
+    for (auto& kv : reference)
+    {
+        uint32_t* value = u32map_find(&hm, kv.first);
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, Eq(kv.second));
+    }
+
+    hashmap_deinit(&hm);
+}
@@ -0,0 +1,165 @@
+#include <gmock/gmock.h>
+#include "cstructures/hashset.h"
+#include <random>
+#include <set>
+
+#define NAME hashset
+
+using namespace testing;
+
+class NAME : public Test
+{
+public:
+    virtual void SetUp()
+    {
+        ASSERT_THAT(hashset_init(&hs, sizeof(uint64_t)), Eq(HM_OK));
+    }
+
+    virtual void TearDown()
+    {
+        hashset_deinit(&hs);
+    }
+
+    static std::set<uint64_t> keys(const struct cs_hashset* set)
+    {
+        std::set<uint64_t> result;
+        HASHSET_FOR_EACH(set, uint64_t, key)
+            result.insert(*key);
+        HASHSET_END_EACH
+        return result;
+    }
+
+    struct cs_hashset hs;
+};
+
+TEST_F(NAME, insert_contains_erase)
+{
+    uint64_t key = 42;
+    EXPECT_THAT(hashset_contains(&hs, &key), Eq(0));
+    EXPECT_THAT(hashset_insert(&hs, &key), Eq(HM_OK));
+    EXPECT_THAT(hashset_insert(&hs, &key), Eq(HM_EXISTS));
+    EXPECT_THAT(hashset_count(&hs), Eq(1u));
+    EXPECT_THAT(hashset_contains(&hs, &key), Eq(1));
+
+    EXPECT_THAT(hashset_erase(&hs, &key), Eq(1));
+    EXPECT_THAT(hashset_erase(&hs, &key), Eq(0));
+    EXPECT_THAT(hashset_contains(&hs, &key), Eq(0));
+    EXPECT_THAT(hashset_count(&hs), Eq(0u));
+}
+
+TEST_F(NAME, grows_and_iterates_all_keys)
+{
+    std::set<uint64_t> expected;
+    for (uint64_t i = 0; i != 100000; ++i)
+    {
+        uint64_t key = i * 0x9E3779B97F4A7C15ull;
+        ASSERT_THAT(hashset_insert(&hs, &key), Eq(HM_OK));
+        expected.insert(key);
+    }
+    EXPECT_THAT(hashset_count(&hs), Eq(100000u));
+    EXPECT_THAT(keys(&hs), Eq(expected));
+    for (uint64_t key : expected)
+        ASSERT_THAT(hashset_contains(&hs, &key), Eq(1));
+}
+
+TEST_F(NAME, reserve_prevents_rehashing)
+{
+    ASSERT_THAT(hashset_reserve(&hs, 10000), Eq(HM_OK));
+    void* storage = hs.storage;
+    for (uint64_t key = 0; key != 10000; ++key)
+        ASSERT_THAT(hashset_insert(&hs, &key), Eq(HM_OK));
+    EXPECT_THAT(hs.storage, Eq(storage));
+}
+
+TEST_F(NAME, churn_does_not_grow)
+{
+    for (uint64_t key = 0; key != 10; ++key)
+        ASSERT_THAT(hashset_insert(&hs, &key), Eq(HM_OK));
+    uint32_t table_count = hs.table_count;
+    for (uint64_t key = 10; key != 100000; ++key)
+    {
+        ASSERT_THAT(hashset_insert(&hs, &key), Eq(HM_OK));
+        ASSERT_THAT(hashset_erase(&hs, &key), Eq(1));
+    }
+    EXPECT_THAT(hs.table_count, Eq(table_count));
+    EXPECT_THAT(hashset_count(&hs), Eq(10u));
+}
+
+TEST_F(NAME, random_operations_match_reference)
+{
+    std::mt19937 rng(1234);
+    std::set<uint64_t> reference;
+    for (int i = 0; i != 100000; ++i)
+    {
+        uint64_t key = rng() % 5000;
+        bool exists = reference.count(key) > 0;
+        if (rng() % 2)
+        {
+            ASSERT_THAT(hashset_insert(&hs, &key), Eq(exists ? HM_EXISTS : HM_OK));
+            reference.insert(key);
+        }
+        else
+        {
+            ASSERT_THAT(hashset_erase(&hs, &key), Eq(exists ? 1 : 0));
+            reference.erase(key);
+        }
+    }
+    EXPECT_THAT(hashset_count(&hs), Eq(reference.size()));
+    EXPECT_THAT(keys(&hs), Eq(reference));
+}
+
+TEST_F(NAME, union_and_intersection)
+{
+    struct cs_hashset other, result;
+    ASSERT_THAT(hashset_init(&other, sizeof(uint64_t)), Eq(HM_OK));
+    ASSERT_THAT(hashset_init(&result, sizeof(uint64_t)), Eq(HM_OK));
+
+    std::set<uint64_t> a, b, both, either;
+    for (uint64_t key = 0; key != 3000; ++key)
+    {
+        if (key % 2 == 0)
+        {
+            ASSERT_THAT(hashset_insert(&hs, &key), Eq(HM_OK));
+            a.insert(key);
+        }
+        if (key % 3 == 0)
+        {
+            ASSERT_THAT(hashset_insert(&other, &key), Eq(HM_OK));
+            b.insert(key);
+        }
+        if (key % 2 == 0 && key % 3 == 0)
+            both.insert(key);
+        if (key % 2 == 0 || key % 3 == 0)
+            either.insert(key);
+    }
+
+    ASSERT_THAT(hashset_intersection(&result, &hs, &other), Eq(HM_OK));
+    EXPECT_THAT(keys(&result), Eq(both));
+
+    ASSERT_THAT(hashset_union(&hs, &other), Eq(HM_OK));
+    EXPECT_THAT(hashset_count(&hs), Eq(either.size()));
+    EXPECT_THAT(keys(&hs), Eq(either));
+    EXPECT_THAT(keys(&other), Eq(b));
+
+    hashset_deinit(&result);
+    hashset_deinit(&other);
+}
+
+TEST_F(NAME, union_with_itself_does_nothing)
+{
+    std::set<uint64_t> reference;
+    for (uint64_t key = 0; key != 1000; ++key)
+    {
+        ASSERT_THAT(hashset_insert(&hs, &key), Eq(HM_OK));
+        reference.insert(key);
+    }
+    /* Leave tombstones behind so an insert would want to purge them */
+    for (uint64_t key = 0; key < 1000; key += 2)
+    {
+        ASSERT_THAT(hashset_erase(&hs, &key), Eq(1));
+        reference.erase(key);
+    }
+
+    ASSERT_THAT(hashset_union(&hs, &hs), Eq(HM_OK));
+    EXPECT_THAT(keys(&hs), Eq(reference));
+}
@@ -0,0 +1,244 @@
+#include <gmock/gmock.h>
+#include "cstructures/memory.h"
+#include "cstructures/pool.h"
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#define NAME pool
+
+using namespace testing;
+
+TEST(NAME, released_objects_are_reused)
+{
+    struct cs_pool* pool = pool_create(24);
+    ASSERT_THAT(pool, NotNull());
+    EXPECT_THAT(pool_object_size(pool), Eq(24u));
+
+    void* a = pool_alloc(pool);
+    ASSERT_THAT(a, NotNull());
+    pool_release(pool, a);
+    EXPECT_THAT(pool_alloc(pool), Eq(a));
+    pool_release(pool, a);
+
+    pool_free(pool);
+}
+
+TEST(NAME, objects_are_distinct_and_aligned)
+{
+    struct cs_pool* pool = pool_create(20);
+    std::vector<uint32_t*> objects;
+    for (uint32_t i = 0; i != 10000; ++i)
+    {
+        uint32_t* p = (uint32_t*)pool_alloc(pool);
+        ASSERT_THAT(p, NotNull());
+        EXPECT_THAT((uintptr_t)p % sizeof(void*), Eq(0u));
+        for (int j = 0; j != 5; ++j)
+            p[j] = i;
+        objects.push_back(p);
+    }
+
+    for (uint32_t i = 0; i != objects.size(); ++i)
+        for (int j = 0; j != 5; ++j)
+            ASSERT_THAT(objects[i][j], Eq(i));
+
+    for (uint32_t* p : objects)
+        pool_release(pool, p);
+    pool_free(pool);
+}
+
+TEST(NAME, multiples_of_16_are_16_byte_aligned)
+{
+    struct cs_pool* pool = pool_create(48);
+    std::vector<void*> objects;
+    for (int i = 0; i != 1000; ++i)
+    {
+        objects.push_back(pool_alloc(pool));
+        EXPECT_THAT((uintptr_t)objects.back() % 16, Eq(0u));
+    }
+    for (void* p : objects)
+        pool_release(pool, p);
+    pool_free(pool);
+}
+
+TEST(NAME, large_objects_get_larger_slabs)
+{
+    struct cs_pool* pool = pool_create_with_options(3000, 0, 0);
+    std::set<void*> objects;
+    for (int i = 0; i != 100; ++i)
+        objects.insert(pool_alloc(pool));
+    EXPECT_THAT(objects.size(), Eq(100u));
+    EXPECT_THAT(objects.count(NULL), Eq(0u));
+    for (void* p : objects)
+        pool_release(pool, p);
+    pool_free(pool);
+}
+
+#if defined(CSTRUCTURES_MEMORY_DEBUGGING)
+TEST(NAME, objects_are_tracked_by_memory_report)
+{
+    struct cs_pool* pool = pool_create(16);
+    uintptr_t allocs = memory_get_num_allocs();
+    void* p = pool_alloc(pool);
+    EXPECT_THAT(memory_get_num_allocs(), Eq(allocs + 1));
+    pool_release(pool, p);
+    EXPECT_THAT(memory_get_num_allocs(), Eq(allocs));
+    pool_free(pool);
+}
+#endif
+
+TEST(NAME, more_pools_than_thread_caches)
+{
+    std::vector<struct cs_pool*> pools;
+    std::vector<std::vector<uint32_t*>> held(POOL_THREAD_CACHES * 2 + 1);
+    for (size_t i = 0; i != held.size(); ++i)
+        pools.push_back(pool_create(8));
+
+    /* Every pool's cache gets evicted by another pool over and over */
+    for (int round = 0; round != 100; ++round)
+        for (size_t i = 0; i != pools.size(); ++i)
+        {
+            uint32_t* p = (uint32_t*)pool_alloc(pools[i]);
+            ASSERT_THAT(p, NotNull());
+            p[0] = (uint32_t)i;
+            held[i].push_back(p);
+            if (round % 3 == 2)
+            {
+                pool_release(pools[i], held[i].front());
+                held[i].erase(held[i].begin());
+            }
+        }
+
+    for (size_t i = 0; i != pools.size(); ++i)
+    {
+        for (uint32_t* p : held[i])
+        {
+            EXPECT_THAT(p[0], Eq(i));
+            pool_release(pools[i], p);
+        }
+        pool_free(pools[i]);
+    }
+}
+
+TEST(NAME, cached_objects_are_returned_when_a_thread_exits)
+{
+    struct cs_pool* pool = pool_create(16);
+    std::set<void*> released;
+    std::thread([&] {
+        std::vector<void*> objects;
+        for (int i = 0; i != 10; ++i)
+            objects.push_back(pool_alloc(pool));
+        for (void* p : objects)
+        {
+            released.insert(p);
+            pool_release(pool, p);
+        }
+    }).join();
+
+    /*
+     * The thread took cache_size objects from the depot. They all went back
+     * when it exited, so the next cache_size allocations get them again.
+     */
+    std::vector<void*> objects;
+    size_t reused = 0;
+    for (int i = 0; i != POOL_DEFAULT_CACHE_SIZE; ++i)
+    {
+        objects.push_back(pool_alloc(pool));
+        reused += released.count(objects.back());
+    }
+    EXPECT_THAT(reused, Eq(released.size()));
+    for (void* p : objects)
+        pool_release(pool, p);
+    pool_free(pool);
+}
+
+TEST(NAME, freeing_a_pool_drops_the_caches_of_other_threads)
+{
+    struct cs_pool* pool = pool_create(16);
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool cached = false, freed = false;
+
+    std::thread thread([&] {
+        pool_release(pool, pool_alloc(pool));
+        std::unique_lock<std::mutex> lock(mutex);
+        cached = true;
+        cv.notify_all();
+        cv.wait(lock, [&] { return freed; });
+        /* Exiting finds the pool gone and must not touch its objects */
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return cached; });
+    }
+    pool_free(pool);
+
+    /* New pools may get the old address, but never the old cache */
+    std::vector<struct cs_pool*> pools;
+    for (int i = 0; i != POOL_THREAD_CACHES; ++i)
+        pools.push_back(pool_create(16));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        freed = true;
+        cv.notify_all();
+    }
+    thread.join();
+
+    for (struct cs_pool* p : pools)
+    {
+        void* object = pool_alloc(p);
+        EXPECT_THAT(object, NotNull());
+        pool_release(p, object);
+        pool_free(p);
+    }
+}
+
+static void churn(struct cs_pool* pool, uint32_t id)
+{
+    std::vector<uint32_t*> held;
+    uint32_t rng = 0x9E3779B9u * (id + 1);
+    for (int i = 0; i != 10000; ++i)
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        if (held.empty() || (rng % 3 != 0 && held.size() < 200))
+        {
+            uint32_t* p = (uint32_t*)pool_alloc(pool);
+            ASSERT_THAT(p, NotNull());
+            p[0] = id;
+            p[1] = (uint32_t)i;
+            held.push_back(p);
+        }
+        else
+        {
+            uint32_t* p = held.back();
+            held.pop_back();
+            /* Nobody else wrote to the object while this thread owned it */
+            ASSERT_THAT(p[0], Eq(id));
+            pool_release(pool, p);
+        }
+    }
+    for (uint32_t* p : held)
+    {
+        ASSERT_THAT(p[0], Eq(id));
+        pool_release(pool, p);
+    }
+}
+
+TEST(NAME, concurrent_alloc_and_release)
+{
+    for (uint32_t cache_size : {0u, 4u, (uint32_t)POOL_DEFAULT_CACHE_SIZE})
+    {
+        struct cs_pool* pool = pool_create_with_options(8, 0, cache_size);
+        std::vector<std::thread> threads;
+        for (uint32_t id = 0; id != 4; ++id)
+            threads.emplace_back(churn, pool, id);
+        for (auto& t : threads)
+            t.join();
+        pool_free(pool);
+    }
+}
@@ -0,0 +1,118 @@
+#include <gmock/gmock.h>
+#include "cstructures/shardmap.h"
+#include <thread>
+#include <vector>
+
+#define NAME shardmap
+
+using namespace testing;
+
+class NAME : public Test
+{
+public:
+    virtual void SetUp()
+    {
+        ASSERT_THAT(shardmap_create(&sm, 3, sizeof(uint32_t), sizeof(uint32_t)), Eq(HM_OK));
+    }
+
+    virtual void TearDown()
+    {
+        shardmap_free(sm);
+    }
+
+    struct cs_shardmap* sm;
+};
+
+TEST_F(NAME, insert_find_erase)
+{
+    uint32_t key = 7, value = 70;
+    EXPECT_THAT(shardmap_shard_count(sm), Eq(8u));
+    EXPECT_THAT(shardmap_insert(sm, &key, &value), Eq(HM_OK));
+    EXPECT_THAT(shardmap_insert(sm, &key, &value), Eq(HM_EXISTS));
+
+    value = 0;
+    EXPECT_THAT(shardmap_find(sm, &key, &value), Eq(1));
+    EXPECT_THAT(value, Eq(70u));
+    EXPECT_THAT(shardmap_count(sm), Eq(1u));
+
+    value = 0;
+    EXPECT_THAT(shardmap_erase(sm, &key, &value), Eq(1));
+    EXPECT_THAT(value, Eq(70u));
+    EXPECT_THAT(shardmap_find(sm, &key, NULL), Eq(0));
+    EXPECT_THAT(shardmap_erase(sm, &key, NULL), Eq(0));
+}
+
+TEST_F(NAME, keys_live_in_the_shard_selected_by_their_hash)
+{
+    for (uint32_t key = 0; key != 1000; ++key)
+        ASSERT_THAT(shardmap_insert(sm, &key, &key), Eq(HM_OK));
+
+    uint32_t total = 0;
+    for (uint32_t i = 0; i != shardmap_shard_count(sm); ++i)
+    {
+        total += hashmap_count(shardmap_shard(sm, i));
+        EXPECT_THAT(hashmap_count(shardmap_shard(sm, i)), Gt(0u));
+    }
+    EXPECT_THAT(total, Eq(1000u));
+
+    for (uint32_t key = 0; key != 1000; ++key)
+    {
+        cs_hashmap_hash hash = shardmap_hash_key(sm, &key);
+        struct cs_hashmap* shard = shardmap_shard(sm, shardmap_shard_index(sm, hash));
+        uint32_t* value = (uint32_t*)hashmap_find_with_hash(shard, &key, hash);
+        ASSERT_THAT(value, NotNull());
+        EXPECT_THAT(*value, Eq(key));
+    }
+}
+
+TEST_F(NAME, reserve_grows_one_shard)
+{
+    uint32_t before = shardmap_shard(sm, 1)->table_count;
+    EXPECT_THAT(shardmap_reserve(sm, 0, 10000), Eq(HM_OK));
+    EXPECT_THAT(shardmap_shard(sm, 0)->table_count, Ge(10000u));
+    EXPECT_THAT(shardmap_shard(sm, 1)->table_count, Eq(before));
+}
+
+static void countShard(struct cs_hashmap* shard, uint32_t shard_index, void* user_data)
+{
+    std::vector<uint32_t>& visits = *(std::vector<uint32_t>*)user_data;
+    visits[shard_index]++;
+}
+
+TEST_F(NAME, for_each_shard_splits_shards_between_workers)
+{
+    std::vector<uint32_t> visits(shardmap_shard_count(sm));
+    for (uint32_t worker = 0; worker != 3; ++worker)
+        shardmap_for_each_shard(sm, worker, 3, countShard, &visits);
+    EXPECT_THAT(visits, Each(Eq(1u)));
+}
+
+TEST_F(NAME, concurrent_inserts)
+{
+    const uint32_t thread_count = 4;
+    const uint32_t per_thread = 10000;
+
+    /* Memory debugging isn't thread safe, so don't grow while threads run */
+    for (uint32_t i = 0; i != shardmap_shard_count(sm); ++i)
+        ASSERT_THAT(shardmap_reserve(sm, i, per_thread * thread_count / 4), Eq(HM_OK));
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t != thread_count; ++t)
+        threads.emplace_back([this, t, thread_count, per_thread]() {
+            for (uint32_t i = 0; i != per_thread; ++i)
+            {
+                uint32_t key = i * thread_count + t;
+                EXPECT_THAT(shardmap_insert(sm, &key, &key), Eq(HM_OK));
+            }
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    EXPECT_THAT(shardmap_count(sm), Eq(per_thread * thread_count));
+    for (uint32_t key = 0; key != per_thread * thread_count; ++key)
+    {
+        uint32_t value;
+        ASSERT_THAT(shardmap_find(sm, &key, &value), Eq(1));
+        ASSERT_THAT(value, Eq(key));
+    }
+}
@@ -44,10 +44,21 @@ vector_create(const cs_vec_size element_size)
 /* ------------------------------------------------------------------------- */
 void
 vector_init(struct cs_vector* vector, const cs_vec_size element_size)
+{
+    vector_init_with_allocator(vector, element_size, &memory_default_allocator);
+}
+
+/* ------------------------------------------------------------------------- */
+void
+vector_init_with_allocator(struct cs_vector* vector,
+                           const cs_vec_size element_size,
+                           const struct cs_allocator* allocator)
 {
     assert(vector);
+    assert(allocator);
     memset(vector, 0, sizeof *vector);
     vector->element_size = element_size;
+    vector->allocator = allocator;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -56,7 +67,7 @@ vector_deinit(struct cs_vector* vector)
 {
     assert(vector);
 
-    XFREE(vector->data);
+    ALLOCATOR_XFREE(vector->allocator, vector->data);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -88,7 +99,7 @@ vector_compact(struct cs_vector* vector)
 
     if (vector->count == 0)
     {
-        XFREE(vector->data);
+        ALLOCATOR_XFREE(vector->allocator, vector->data);
         vector->data = NULL;
         vector->capacity = 0;
     }
@@ -107,7 +118,7 @@ vector_clear_compact(struct cs_vector* vector)
 {
     assert(vector);
 
-    XFREE(vector->data);
+    ALLOCATOR_XFREE(vector->allocator, vector->data);
     vector->count = 0;
     vector->capacity = 0;
     vector->data = NULL;
@@ -395,7 +406,7 @@ vector_realloc(struct cs_vector *vector,
     if (!vector->data)
     {
         new_capacity = (new_capacity == 0 ? CSTRUCTURES_VEC_MIN_CAPACITY : new_capacity);
-        vector->data = MALLOC((new_capacity + 1) * vector->element_size);
+        vector->data = ALLOCATOR_MALLOC(vector->allocator, (new_capacity + 1) * vector->element_size);
         if (!vector->data)
             return -1;
         vector->capacity = new_capacity;
@@ -403,7 +414,7 @@ vector_realloc(struct cs_vector *vector,
     }
 
     /* Realloc the data. Make sure to have space for the swap element at the end */
-    if ((new_data = REALLOC(vector->data, (new_capacity  + 1) * vector->element_size)) == NULL)
+    if ((new_data = ALLOCATOR_REALLOC(vector->allocator, vector->data, (new_capacity  + 1) * vector->element_size)) == NULL)
         return -1;
     vector->data = new_data;
 